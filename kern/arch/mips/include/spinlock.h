@@ -46,6 +46,15 @@ SPINLOCK_INLINE
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 SPINLOCK_INLINE
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+SPINLOCK_INLINE
+spinlock_data_t spinlock_data_fetchadd(volatile spinlock_data_t *sd,
+				       unsigned val);
+SPINLOCK_INLINE
+spinlock_data_t spinlock_data_swap(volatile spinlock_data_t *sd,
+				   unsigned val);
+SPINLOCK_INLINE
+spinlock_data_t spinlock_data_cas(volatile spinlock_data_t *sd,
+				  unsigned oldval, unsigned newval);
 
 ////////////////////////////////////////////////////////////
 
@@ -118,5 +127,92 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+/*
+ * The rest of these also use LL/SC, but unlike test-and-set they have
+ * to succeed, so they loop until the SC does. Each returns the value
+ * the word had before.
+ */
+
+/*
+ * Atomically add VAL to a spinlock_data_t.
+ */
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_fetchadd(volatile spinlock_data_t *sd, unsigned val)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%3);"	/*   x = *sd */
+		"addu %1, %0, %2;"	/*   y = x + val */
+		"sc %1, 0(%3);"		/*   *sd = y; y = success? */
+		"beqz %1, 1b;"		/*   if failed, try again */
+		"nop;"			/*   (delay slot) */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (val), "r" (sd) : "memory");
+	return x;
+}
+
+/*
+ * Atomically store VAL in a spinlock_data_t.
+ */
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_swap(volatile spinlock_data_t *sd, unsigned val)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%3);"	/*   x = *sd */
+		"move %1, %2;"		/*   y = val */
+		"sc %1, 0(%3);"		/*   *sd = y; y = success? */
+		"beqz %1, 1b;"		/*   if failed, try again */
+		"nop;"			/*   (delay slot) */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (val), "r" (sd) : "memory");
+	return x;
+}
+
+/*
+ * Atomically store NEWVAL in a spinlock_data_t if it contains OLDVAL.
+ * It worked if the return value is OLDVAL.
+ */
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_cas(volatile spinlock_data_t *sd,
+		  unsigned oldval, unsigned newval)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%4);"	/*   x = *sd */
+		"bne %0, %2, 2f;"	/*   if x != oldval, give up */
+		"move %1, %3;"		/*   y = newval (delay slot) */
+		"sc %1, 0(%4);"		/*   *sd = y; y = success? */
+		"beqz %1, 1b;"		/*   if failed, try again */
+		"nop;"			/*   (delay slot) */
+		"2:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (oldval), "r" (newval), "r" (sd)
+		: "memory");
+	return x;
+}
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
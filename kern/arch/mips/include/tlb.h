@@ -53,20 +53,29 @@
  *        is not set. To completely invalidate the TLB, load it with
  *        translations for addresses in one of the unmapped address
  *        ranges - these will never be matched.
+ *
+ *   tlb_setasid: set the address space ID the processor matches TLB
+ *        entries against, from the TLBHI_PID bits of ENTRYHI. Note
+ *        that tlb_random, tlb_write, and tlb_probe also set it, from
+ *        the ENTRYHI they're passed, and tlb_read sets it from the
+ *        entry read.
  */
 
 void tlb_random(uint32_t entryhi, uint32_t entrylo);
 void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
+void tlb_setasid(uint32_t entryhi);
 
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * The MIPS has support for a 6-bit address space ID (TLBHI_PID). An
+ * entry only matches when its PID is the current one, unless
+ * TLBLO_GLOBAL is set, so entries for several address spaces can be
+ * in the TLB at once. dumbvm doesn't use it and leaves the PID zero.
+ * TLBLO_GLOBAL, and the bits that aren't assigned a meaning, can be
+ * left always zero.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -78,7 +87,7 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
@@ -101,5 +110,12 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 #define NUM_TLB  64
 
+/*
+ * Number of address space IDs, and where they go in the high word.
+ */
+
+#define NUM_ASID        64
+#define TLBHI_PIDSHIFT  6
+
 
 #endif /* _MIPS_TLB_H_ */
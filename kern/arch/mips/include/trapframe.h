@@ -104,5 +104,16 @@ __DEAD void mips_usermode(struct trapframe *tf);
 extern vaddr_t cpustacks[];
 extern vaddr_t cputhreads[];
 
+/*
+ * Array of page tables, by CPU, used by the fast-path TLB refill
+ * handler. 0 sends every refill to vm_fault.
+ */
+extern vaddr_t cpupagetables[];
+
+/*
+ * Array of counts of fast-path TLB refills, by CPU. See vmstat.c.
+ */
+extern uint32_t cputlbrefills[];
+
 
 #endif /* _MIPS_TRAPFRAME_H_ */
@@ -66,6 +66,7 @@
  * a valid address, and will make a *huge* mess if you scribble on it.
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
 
 /*
  * The top of user space. (Actually, the address immediately above the
@@ -113,14 +114,20 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
- * We'll take up to 16 invalidations before just flushing the whole TLB.
+ * A shootdown invalidates the translations for up to
+ * TLBSHOOTDOWN_PAGES pages of one address space, or if ts_npages is
+ * TLBSHOOTDOWN_ALL, all of them.
  */
 
+struct addrspace;
+
+#define TLBSHOOTDOWN_PAGES 8
+#define TLBSHOOTDOWN_ALL   ((unsigned)-1)
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct addrspace *ts_as;
+	unsigned ts_npages;
+	vaddr_t ts_pages[TLBSHOOTDOWN_PAGES];
 };
 
 #define TLBSHOOTDOWN_MAX 16
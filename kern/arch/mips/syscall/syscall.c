@@ -35,6 +35,7 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include "opt-dumbvm.h"
 
 
 /*
@@ -109,6 +110,36 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_open:
+		err = sys_open((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2,
+			       &retval);
+		break;
+
+	    case SYS_close:
+		err = sys_close(tf->tf_a0);
+		break;
+
+#if !OPT_DUMBVM
+	    case SYS_mmap:
+		err = sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			       tf->tf_a2, tf->tf_a3, (userptr_t)tf->tf_sp,
+			       &retval);
+		break;
+
+	    case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+
+	    case SYS_msync:
+		err = sys_msync((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+				tf->tf_a2);
+		break;
+
+	    case SYS_getvmstat:
+		err = sys_getvmstat(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+#endif
+
 	    /* Add stuff here */
 
 	    default:
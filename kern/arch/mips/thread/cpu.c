@@ -67,6 +67,19 @@
 vaddr_t cpustacks[MAXCPUS];
 vaddr_t cputhreads[MAXCPUS];
 
+/*
+ * The page table of the address space each CPU is using, for the
+ * fast-path TLB refill in exception-mips1.S; see vm.c. This stays 0
+ * with dumbvm, which has no page tables.
+ */
+vaddr_t cpupagetables[MAXCPUS];
+
+/*
+ * Count of TLB misses each CPU has handled in the fast-path refill,
+ * for vmstat. Only the CPU itself changes its count.
+ */
+uint32_t cputlbrefills[MAXCPUS];
+
 /*
  * Do machine-dependent initialization of the cpu structure or things
  * associated with a new cpu. Note that we're not running on the new
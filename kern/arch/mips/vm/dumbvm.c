@@ -38,6 +38,7 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -59,15 +60,10 @@
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 #define DUMBVM_STACKPAGES    18
 
-/*
- * Wrap ram_stealmem in a spinlock.
- */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
-
 void
 vm_bootstrap(void)
 {
-	/* Do nothing. */
+	/* Do nothing; the coremap was set up by coremap_bootstrap. */
 }
 
 /*
@@ -90,55 +86,16 @@ dumbvm_can_sleep(void)
 	}
 }
 
-static
-paddr_t
-getppages(unsigned long npages)
-{
-	paddr_t addr;
-
-	spinlock_acquire(&stealmem_lock);
-
-	addr = ram_stealmem(npages);
-
-	spinlock_release(&stealmem_lock);
-	return addr;
-}
-
-/* Allocate/free some kernel-space virtual pages */
-vaddr_t
-alloc_kpages(unsigned npages)
-{
-	paddr_t pa;
-
-	dumbvm_can_sleep();
-	pa = getppages(npages);
-	if (pa==0) {
-		return 0;
-	}
-	return PADDR_TO_KVADDR(pa);
-}
-
 void
-free_kpages(vaddr_t addr)
+vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	/* nothing - leak the memory. */
-
-	(void)addr;
-}
-
-unsigned
-int
-coremap_used_bytes() {
-
-	/* dumbvm doesn't track page allocations. Return 0 so that khu works. */
-
-	return 0;
+	(void)ts;
+	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
 void
-vm_tlbshootdown(const struct tlbshootdown *ts)
+vm_tlbshootdown_all(void)
 {
-	(void)ts;
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
@@ -266,6 +223,17 @@ void
 as_destroy(struct addrspace *as)
 {
 	dumbvm_can_sleep();
+
+	/* Any of these may be missing if as_prepare_load failed. */
+	if (as->as_pbase1 != 0) {
+		coremap_free(as->as_pbase1);
+	}
+	if (as->as_pbase2 != 0) {
+		coremap_free(as->as_pbase2);
+	}
+	if (as->as_stackpbase != 0) {
+		coremap_free(as->as_stackpbase);
+	}
 	kfree(as);
 }
 
@@ -353,17 +321,17 @@ as_prepare_load(struct addrspace *as)
 
 	dumbvm_can_sleep();
 
-	as->as_pbase1 = getppages(as->as_npages1);
+	as->as_pbase1 = coremap_allocuser(as->as_npages1);
 	if (as->as_pbase1 == 0) {
 		return ENOMEM;
 	}
 
-	as->as_pbase2 = getppages(as->as_npages2);
+	as->as_pbase2 = coremap_allocuser(as->as_npages2);
 	if (as->as_pbase2 == 0) {
 		return ENOMEM;
 	}
 
-	as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
+	as->as_stackpbase = coremap_allocuser(DUMBVM_STACKPAGES);
 	if (as->as_stackpbase == 0) {
 		return ENOMEM;
 	}
@@ -53,13 +53,39 @@
  */
 #define CPU_FREQUENCY 25000000 /* 25 MHz */
 
+/*
+ * Shortest time, in cycles, we'll set the timer for. Less than this
+ * and count might get past compare before it's written.
+ */
+#define MIPS_TIMER_MINCYCLES 100
+
 /*
  * Access to the on-chip timer.
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
- * asserted. Writing to c0_compare again clears the interrupt.
+ * asserted and count starts over from zero. Writing to c0_compare
+ * again clears the interrupt.
  */
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/*
+	 * $9 == c0_count; we can't use the symbolic name inside
+	 * the asm string.
+	 */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
 static
 void
 mips_timer_set(uint32_t count)
@@ -76,6 +102,21 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Set the timer to go off NSECS from now.
+ */
+void
+mainbus_settimer(uint32_t nsecs)
+{
+	uint32_t cycles;
+
+	cycles = nsecs / (1000000000 / CPU_FREQUENCY);
+	if (cycles < MIPS_TIMER_MINCYCLES) {
+		cycles = MIPS_TIMER_MINCYCLES;
+	}
+	mips_timer_set(mips_timer_get() + cycles);
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -314,10 +355,8 @@ mainbus_interrupt(struct trapframe *tf)
 		seen = true;
 	}
 	if (cause & MIPS_TIMER_BIT) {
-		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
-		/* and call hardclock */
-		hardclock();
+		/* cpuclock resets the timer, which clears the interrupt */
+		cpuclock();
 		seen = true;
 	}
 
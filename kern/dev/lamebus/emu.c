@@ -52,6 +52,7 @@
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <pagecache.h>
 #include <emufs.h>
 #include "autoconf.h"
 
@@ -547,6 +548,12 @@ emufs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+	/* Changes made through mmap have to reach the file first. */
+	result = pagecache_preio(v, uio->uio_offset, uio->uio_resid);
+	if (result) {
+		return result;
+	}
+
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -597,12 +604,20 @@ int
 emufs_write(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+	off_t offset = uio->uio_offset;
+	size_t resid = uio->uio_resid;
 	uint32_t amt;
 	size_t oldresid;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	/* Keep mappings of the file up to date (see pagecache.h). */
+	result = pagecache_preio(v, offset, resid);
+	if (result) {
+		return result;
+	}
+
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -613,7 +628,7 @@ emufs_write(struct vnode *v, struct uio *uio)
 
 		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
 
 		if (uio->uio_resid == oldresid) {
@@ -622,7 +637,8 @@ emufs_write(struct vnode *v, struct uio *uio)
 		}
 	}
 
-	return 0;
+	pagecache_postwrite(v, offset, resid - uio->uio_resid);
+	return result;
 }
 
 /*
@@ -845,13 +861,16 @@ emufs_namefile(struct vnode *v, struct uio *uio)
 
 /*
  * VOP_MMAP
+ *
+ * Regular files can be mapped; the pages are read and written with
+ * emufs_read and emufs_write.
  */
 static
 int
 emufs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 //////////////////////////////
@@ -36,9 +36,10 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
+#include <wchan.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <disksched.h>
 #include <lamebus/lhd.h>
 #include "autoconf.h"
 
@@ -60,6 +61,47 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/*
+ * Number of requests that can be outstanding at once, and the size of
+ * the bounce buffer each one gets. Transfers that need bouncing are
+ * done LHD_BOUNCESECT sectors at a time.
+ */
+#define LHD_NSLOTS      4
+#define LHD_BOUNCESECT  8
+
+/*
+ * A request slot. Each thread doing I/O holds one for the duration,
+ * and sleeps on its wait channel, so that finishing a request wakes
+ * only the thread that made it.
+ */
+struct lhd_slot {
+	struct wchan *ls_wchan;		/* Where our requester waits */
+	char *ls_bounce;		/* LHD_BOUNCESECT sectors */
+	bool ls_inuse;			/* Held by some thread */
+};
+
+/*
+ * An I/O request. The device only transfers one sector at a time,
+ * so the interrupt handler walks through each request sector by
+ * sector, starting the next transfer as soon as the previous one
+ * finishes. The requesting thread sleeps once for the whole request.
+ *
+ * Pending requests are kept by the disk scheduler (lh_sched), which
+ * decides the order and merges adjacent requests into runs. A run is
+ * done back to back: when one request in it finishes, the next one
+ * continues from the following sector.
+ */
+struct lhd_request {
+	struct dsreq lr_ds;		/* Scheduler's view of this request */
+	uint32_t lr_sector;		/* Next sector to transfer */
+	uint32_t lr_nsect;		/* Sectors left to transfer */
+	char *lr_data;			/* Memory for the next sector */
+	struct lhd_slot *lr_slot;	/* Where the requester waits */
+	bool lr_iswrite;		/* Direction */
+	bool lr_done;			/* Set when finished */
+	int lr_result;			/* Result, when finished */
+};
+
 /*
  * Shortcut for reading a register.
  */
@@ -96,15 +138,82 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the transfer of the next sector of the active request. If
+ * there isn't one, ask the scheduler for the next run.
+ */
+static
+void
+lhd_start(struct lhd_softc *lh)
+{
+	struct lhd_request *lr;
+	struct dsreq *dr;
+	uint32_t statval = LHD_WORKING;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+	KASSERT(!lh->lh_busy);
+
+	if (lh->lh_active == NULL) {
+		dr = disksched_next(lh->lh_sched);
+		if (dr == NULL) {
+			return;
+		}
+		lh->lh_active = dr->dr_data;
+	}
+	lr = lh->lh_active;
+	KASSERT(lr->lr_nsect > 0);
+
+	/* If writing, transfer the data to the on-card buffer. */
+	if (lr->lr_iswrite) {
+		memcpy(lh->lh_buf, lr->lr_data, LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want, and start the operation. */
+	lhd_wreg(lh, LHD_REG_SECT, lr->lr_sector);
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+	lh->lh_busy = true;
+}
+
+/*
+ * Record that a sector transfer has completed. If the request is done
+ * (or failed) wake up whoever's waiting for it and move on to the
+ * next request in its run, if any. Then start the next transfer right
+ * away.
  */
 static
 void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct lhd_request *lr;
+	struct dsreq *next;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	lr = lh->lh_active;
+	KASSERT(lr != NULL);
+	lh->lh_busy = false;
+
+	if (err == 0) {
+		/* If reading, transfer the data out of the on-card buffer. */
+		if (!lr->lr_iswrite) {
+			membar_load_load();
+			memcpy(lr->lr_data, lh->lh_buf, LHD_SECTSIZE);
+		}
+		lr->lr_sector++;
+		lr->lr_data += LHD_SECTSIZE;
+		lr->lr_nsect--;
+	}
+
+	if (err != 0 || lr->lr_nsect == 0) {
+		next = lr->lr_ds.dr_mergenext;
+		lh->lh_active = next ? next->dr_data : NULL;
+		lr->lr_result = err;
+		lr->lr_done = true;
+		wchan_wakeone(lr->lr_slot->ls_wchan, &lh->lh_lock);
+	}
+
+	lhd_start(lh);
 }
 
 /*
@@ -118,6 +227,8 @@ lhd_irq(void *vlh)
 	struct lhd_softc *lh = vlh;
 	uint32_t val;
 
+	spinlock_acquire(&lh->lh_lock);
+
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
@@ -128,9 +239,13 @@ lhd_irq(void *vlh)
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		if (lh->lh_busy) {
+			lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		}
 		break;
 	}
+
+	spinlock_release(&lh->lh_lock);
 }
 
 /*
@@ -179,22 +294,119 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Get a request slot, waiting for one if they're all in use.
+ */
+static
+struct lhd_slot *
+lhd_getslot(struct lhd_softc *lh)
+{
+	unsigned i;
+
+	spinlock_acquire(&lh->lh_lock);
+	while (1) {
+		for (i=0; i<LHD_NSLOTS; i++) {
+			if (!lh->lh_slots[i].ls_inuse) {
+				lh->lh_slots[i].ls_inuse = true;
+				spinlock_release(&lh->lh_lock);
+				return &lh->lh_slots[i];
+			}
+		}
+		wchan_sleep(lh->lh_wchan, &lh->lh_lock);
+	}
+}
+
+/*
+ * Give back a request slot.
+ */
+static
+void
+lhd_putslot(struct lhd_softc *lh, struct lhd_slot *ls)
+{
+	spinlock_acquire(&lh->lh_lock);
+	KASSERT(ls->ls_inuse);
+	ls->ls_inuse = false;
+	wchan_wakeone(lh->lh_wchan, &lh->lh_lock);
+	spinlock_release(&lh->lh_lock);
+}
+
+/*
+ * Queue a request and wait for it to finish.
+ */
+static
+int
+lhd_dorequest(struct lhd_softc *lh, struct lhd_request *lr)
+{
+	lr->lr_ds.dr_sector = lr->lr_sector;
+	lr->lr_ds.dr_nsect = lr->lr_nsect;
+	lr->lr_ds.dr_iswrite = lr->lr_iswrite;
+	lr->lr_ds.dr_data = lr;
+
+	spinlock_acquire(&lh->lh_lock);
+
+	disksched_add(lh->lh_sched, &lr->lr_ds);
+
+	if (!lh->lh_busy) {
+		lhd_start(lh);
+	}
+
+	while (!lr->lr_done) {
+		wchan_sleep(lr->lr_slot->ls_wchan, &lh->lh_lock);
+	}
+
+	spinlock_release(&lh->lh_lock);
+	return lr->lr_result;
+}
+
+/*
+ * Transfer LEN sectors starting at SECTOR to or from DATA, waiting in
+ * slot LS. Returns the number of bytes transferred in *DONE.
+ */
+static
+int
+lhd_xfer(struct lhd_softc *lh, struct lhd_slot *ls, uint32_t sector,
+	 uint32_t len, char *data, bool iswrite, size_t *done)
+{
+	struct lhd_request lr;
+	int result;
+
+	lr.lr_sector = sector;
+	lr.lr_nsect = len;
+	lr.lr_data = data;
+	lr.lr_slot = ls;
+	lr.lr_iswrite = iswrite;
+	lr.lr_done = false;
+	lr.lr_result = 0;
+
+	result = lhd_dorequest(lh, &lr);
+	*done = lr.lr_data - data;
+	return result;
+}
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * If the transfer is to a single kernel buffer, the interrupt handler
+ * copies straight into (or out of) it. Otherwise the data goes through
+ * the request slot's bounce buffer, a piece at a time, since the
+ * interrupt handler can't uiomove.
  */
 static
 int
 lhd_io(struct device *d, struct uio *uio)
 {
 	struct lhd_softc *lh = d->d_data;
+	struct lhd_slot *ls;
+	struct iovec *iov;
 
 	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
-	int result;
+	bool iswrite = (uio->uio_rw == UIO_WRITE);
+	uint32_t n;
+	size_t done;
+	int result, result2;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -202,66 +414,57 @@ lhd_io(struct device *d, struct uio *uio)
 	}
 
 	/* Don't allow I/O past the end of the disk. */
-	/* XXX this check can overflow */
-	if (sector+len > lh->lh_dev.d_blocks) {
+	if (sector > lh->lh_dev.d_blocks ||
+	    len > lh->lh_dev.d_blocks - sector) {
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	ls = lhd_getslot(lh);
+
+	iov = uio->uio_iov;
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1 &&
+	    iov->iov_len == uio->uio_resid) {
+		/* A single kernel buffer; transfer to or from it directly. */
+		result = lhd_xfer(lh, ls, sector, len, iov->iov_kbase,
+				  iswrite, &done);
+		iov->iov_kbase = (char *)iov->iov_kbase + done;
+		iov->iov_len -= done;
+		uio->uio_resid -= done;
+		uio->uio_offset += done;
+		lhd_putslot(lh, ls);
+		return result;
+	}
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
+	result = 0;
+	while (len > 0) {
+		n = len < LHD_BOUNCESECT ? len : LHD_BOUNCESECT;
+		if (iswrite) {
+			result = uiomove(ls->ls_bounce, n * LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		result = lhd_xfer(lh, ls, sector, n, ls->ls_bounce, iswrite,
+				  &done);
+		if (!iswrite && done > 0) {
+			result2 = uiomove(ls->ls_bounce, done, uio);
+			if (result == 0) {
+				result = result2;
+			}
 		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
 		if (result) {
-			return result;
+			break;
 		}
+		sector += n;
+		len -= n;
 	}
 
-	return 0;
+	lhd_putslot(lh, ls);
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
@@ -277,6 +480,7 @@ int
 config_lhd(struct lhd_softc *lh, int lhdno)
 {
 	char name[32];
+	unsigned i;
 
 	/* Figure out what our name is. */
 	snprintf(name, sizeof(name), "lhd%d", lhdno);
@@ -284,17 +488,34 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_wchan = wchan_create("lhd");
+	if (lh->lh_wchan == NULL) {
+		spinlock_cleanup(&lh->lh_lock);
 		return ENOMEM;
 	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
+	lh->lh_slots = kmalloc(LHD_NSLOTS * sizeof(struct lhd_slot));
+	if (lh->lh_slots == NULL) {
+		goto fail_wchan;
+	}
+	for (i=0; i<LHD_NSLOTS; i++) {
+		lh->lh_slots[i].ls_wchan = wchan_create("lhd_req");
+		lh->lh_slots[i].ls_bounce = kmalloc(LHD_BOUNCESECT *
+						    LHD_SECTSIZE);
+		lh->lh_slots[i].ls_inuse = false;
+		if (lh->lh_slots[i].ls_wchan == NULL ||
+		    lh->lh_slots[i].ls_bounce == NULL) {
+			i++;
+			goto fail_slots;
+		}
+	}
+	lh->lh_sched = disksched_create(name);
+	if (lh->lh_sched == NULL) {
+		goto fail_slots;
 	}
+	lh->lh_active = NULL;
+	lh->lh_busy = false;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_ops = &lhd_devops;
@@ -305,4 +526,19 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 
 	/* Add the VFS device structure to the VFS device list. */
 	return vfs_adddev(name, &lh->lh_dev, 1);
+
+ fail_slots:
+	while (i-- > 0) {
+		if (lh->lh_slots[i].ls_wchan != NULL) {
+			wchan_destroy(lh->lh_slots[i].ls_wchan);
+		}
+		if (lh->lh_slots[i].ls_bounce != NULL) {
+			kfree(lh->lh_slots[i].ls_bounce);
+		}
+	}
+	kfree(lh->lh_slots);
+ fail_wchan:
+	wchan_destroy(lh->lh_wchan);
+	spinlock_cleanup(&lh->lh_lock);
+	return ENOMEM;
 }
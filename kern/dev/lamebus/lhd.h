@@ -30,8 +30,13 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
 #include <device.h>
 
+struct disksched;    /* in disksched.h */
+struct lhd_request;  /* private to lhd.c */
+struct lhd_slot;     /* private to lhd.c */
+
 /*
  * Our sector size
  */
@@ -51,9 +56,12 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* Protects the rest */
+	struct wchan *lh_wchan;		/* Where requesters wait for a slot */
+	struct lhd_slot *lh_slots;	/* Per-request waits and bounce buffers */
+	struct disksched *lh_sched;	/* Pending requests */
+	struct lhd_request *lh_active;	/* Request in progress */
+	bool lh_busy;			/* Device has a sector in flight */
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -46,11 +46,6 @@
 #define LT_REG_COUNT  16    /* Time for countdown timer (usec) */
 #define LT_REG_SPKR   20    /* Beep control */
 
-/* Granularity of countdown timer (usec) */
-#define LT_GRANULARITY   1000000
-
-static bool havetimerclock;
-
 /*
  * Setup routine called by autoconf stuff when an ltimer is found.
  */
@@ -84,18 +79,11 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 	lt->lt_hardclock = 0;
 
 	/*
-	 * We do, however, use ltimer for the timer clock, since the
-	 * on-chip timer can't do that.
+	 * Nor do we use its countdown timer for anything else: timed
+	 * operations are done with callouts, which also run off the
+	 * on-chip timer. So leave it switched off, rather than have
+	 * it interrupt idle CPUs for nothing.
 	 */
-	if (!havetimerclock) {
-		havetimerclock = true;
-		lt->lt_timerclock = 1;
-
-		/* Wire it to go off once every second. */
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 1);
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
-				   LT_GRANULARITY);
-	}
 
 	return 0;
 }
@@ -118,12 +106,6 @@ ltimer_irq(void *vlt)
 		if (lt->lt_hardclock) {
 			hardclock();
 		}
-		/*
-		 * Likewise for timerclock.
-		 */
-		if (lt->lt_timerclock) {
-			timerclock();
-		}
 	}
 }
 
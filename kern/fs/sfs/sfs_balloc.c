@@ -35,20 +35,30 @@
 #include <types.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <synch.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Zero out a disk block.
+ * Zero out a disk block. This only zeros the cached copy; the buffer
+ * cache writes it out later.
  */
 static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct buf *buf;
+	int result;
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+	result = buffer_get(&sfs->sfs_absfs, block, &buf);
+	if (result) {
+		return result;
+	}
+	bzero(buffer_map(buf), SFS_BLOCKSIZE);
+	buffer_mark_dirty(buf);
+	buffer_release(buf);
+	return 0;
 }
 
 /*
@@ -59,33 +69,46 @@ sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
 	if (result) {
+		lock_release(sfs->sfs_freemaplock);
 		return result;
 	}
 	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
 		      sfs->sfs_sb.sb_volname, *diskblock);
 	}
 
-	/* Clear block before returning it */
+	/*
+	 * Clear block before returning it. The block is ours now, so
+	 * this doesn't need the freemap lock.
+	 */
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
+		lock_acquire(sfs->sfs_freemaplock);
 		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		lock_release(sfs->sfs_freemaplock);
 	}
 	return result;
 }
 
 /*
- * Free a block.
+ * Free a block. Any cached copy is now garbage; throw it away so it
+ * doesn't get written back.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	buffer_drop(&sfs->sfs_absfs, diskblock);
+
+	lock_acquire(sfs->sfs_freemaplock);
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
 	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
 }
 
 /*
@@ -94,10 +117,17 @@ sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 int
 sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: sfs_bused called on out of range block %u\n",
 		      sfs->sfs_sb.sb_volname, diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+
+	return ret;
 }
 
@@ -35,7 +35,9 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -49,25 +51,17 @@ int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	 daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *idbuf;
+	uint32_t *iddata;
 	daddr_t block;
 	daddr_t idblock;
 	uint32_t idnum, idoff;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	COMPILE_ASSERT(SFS_DBPERIDB * sizeof(uint32_t) == SFS_BLOCKSIZE);
 
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -154,38 +148,37 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		/* Mark the inode dirty */
 		sv->sv_dirty = true;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
-	}
-	else {
 		/*
-		 * We already have an indirect block allocated; load it.
+		 * sfs_balloc zeroed the new block through the buffer
+		 * cache, so loading it below will find it there.
 		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
 	}
 
+	/* Load the indirect block. */
+	result = buffer_read(&sfs->sfs_absfs, idblock, &idbuf);
+	if (result) {
+		return result;
+	}
+	iddata = buffer_map(idbuf);
+
 	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	block = iddata[idoff];
 
 	/* If there's no block there, allocate one */
 	if (block==0 && doalloc) {
 		result = sfs_balloc(sfs, &block);
 		if (result) {
+			buffer_release(idbuf);
 			return result;
 		}
 
 		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+		iddata[idoff] = block;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+		/* The indirect block is now dirty */
+		buffer_mark_dirty(idbuf);
 	}
+	buffer_release(idbuf);
 
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
@@ -198,21 +191,15 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Called for ftruncate() and from sfs_reclaim. The caller must hold
+ * the vnode's lock.
  */
 int
 sfs_itrunc(struct sfs_vnode *sv, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *idbuf;
+	uint32_t *iddata;
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
@@ -223,9 +210,7 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	int result;
 	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
-	vfs_biglock_acquire();
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -253,41 +238,40 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 		/* We're past the proposed EOF; may need to free stuff */
 
 		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = buffer_read(&sfs->sfs_absfs, idblock, &idbuf);
 		if (result) {
-			vfs_biglock_release();
 			return result;
 		}
+		iddata = buffer_map(idbuf);
 
 		hasnonzero = 0;
 		iddirty = 0;
 		for (j=0; j<SFS_DBPERIDB; j++) {
 			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
+			if (blocklen < baseblock+j && iddata[j] != 0) {
+				sfs_bfree(sfs, iddata[j]);
+				iddata[j] = 0;
 				iddirty = 1;
 			}
 			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
+			if (iddata[j]!=0) {
 				hasnonzero=1;
 			}
 		}
 
 		if (!hasnonzero) {
 			/* The whole indirect block is empty now; free it */
+			buffer_release_and_invalidate(idbuf);
 			sfs_bfree(sfs, idblock);
 			sv->sv_i.sfi_indirect = 0;
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
+		else {
+			/* If dirty, the buffer cache will write it back */
+			if (iddirty) {
+				buffer_mark_dirty(idbuf);
 			}
+			buffer_release(idbuf);
 		}
 	}
 
@@ -297,7 +281,59 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
 
+
+/*
+ * Called for fsync(): write back the file's blocks from the buffer
+ * cache. That's its data blocks, its indirect block, and the inode,
+ * which the caller should have copied into the buffer cache with
+ * sfs_sync_inode. The caller must hold the vnode's lock.
+ */
+int
+sfs_bsync(struct sfs_vnode *sv)
+{
+	struct fs *fs = sv->sv_absvn.vn_fs;
+	struct buf *idbuf;
+	uint32_t *iddata;
+	uint32_t i;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	for (i=0; i<SFS_NDIRECT; i++) {
+		if (sv->sv_i.sfi_direct[i] != 0) {
+			result = buffer_sync(fs, sv->sv_i.sfi_direct[i]);
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	if (sv->sv_i.sfi_indirect != 0) {
+		result = buffer_read(fs, sv->sv_i.sfi_indirect, &idbuf);
+		if (result) {
+			return result;
+		}
+		iddata = buffer_map(idbuf);
+		for (i=0; i<SFS_DBPERIDB; i++) {
+			if (iddata[i] == 0) {
+				continue;
+			}
+			result = buffer_sync(fs, iddata[i]);
+			if (result) {
+				buffer_release(idbuf);
+				return result;
+			}
+		}
+		buffer_release(idbuf);
+
+		result = buffer_sync(fs, sv->sv_i.sfi_indirect);
+		if (result) {
+			return result;
+		}
+	}
+
+	return buffer_sync(fs, sv->sv_ino);
+}
@@ -36,6 +36,7 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <vfs.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -95,10 +96,291 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+////////////////////////////////////////////////////////////
+// Hashed directories
+
+/*
+ * Check if a directory is hashed.
+ */
+static
+bool
+sfs_dir_ishashed(struct sfs_vnode *sv)
+{
+	return (sv->sv_i.sfi_flags & SFS_IFLAG_HASHDIR) != 0;
+}
+
+/*
+ * The directory hash function. This must match the definition in
+ * <kern/sfs.h>, since the userlevel tools compute it too.
+ */
+static
+uint32_t
+sfs_dirhash(const char *name)
+{
+	uint32_t hash = SFS_DIRHASH_BASIS;
+
+	while (*name) {
+		hash ^= (unsigned char)*name;
+		hash *= SFS_DIRHASH_PRIME;
+		name++;
+	}
+	return hash;
+}
+
+/*
+ * Compute the number of buckets in a hashed directory.
+ */
+static
+unsigned
+sfs_dir_nbuckets(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	off_t size;
+
+	size = sv->sv_i.sfi_size;
+	if (size == 0 || size % SFS_BLOCKSIZE != 0) {
+		panic("sfs: %s: hashed directory %u: Invalid size %llu\n",
+		      sfs->sfs_sb.sb_volname, sv->sv_ino, size);
+	}
+
+	return size / SFS_BLOCKSIZE;
+}
+
+/*
+ * Get a bucket of a hashed directory from the buffer cache, and check
+ * its header. The caller looks at it in place with buffer_map and
+ * must buffer_release it. Every bucket is written when the directory
+ * is made, so none of them can be a hole.
+ */
+static
+int
+sfs_dir_getbucket(struct sfs_vnode *sv, unsigned bucket, struct buf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dirhdr *hdr;
+	struct buf *buf;
+	daddr_t block;
+	int result;
+
+	result = sfs_bmap(sv, bucket, false, &block);
+	if (result) {
+		return result;
+	}
+	if (block == 0) {
+		panic("sfs: %s: hashed directory %u: Missing bucket %u\n",
+		      sfs->sfs_sb.sb_volname, sv->sv_ino, bucket);
+	}
+
+	result = buffer_read(&sfs->sfs_absfs, block, &buf);
+	if (result) {
+		return result;
+	}
+
+	hdr = buffer_map(buf);
+	if (hdr->sdh_noino != SFS_NOINO || hdr->sdh_magic != SFS_DIRHASH_MAGIC) {
+		panic("sfs: %s: hashed directory %u: Bad header in bucket %u\n",
+		      sfs->sfs_sb.sb_volname, sv->sv_ino, bucket);
+	}
+	*ret = buf;
+	return 0;
+}
+
+/*
+ * Check if a directory entry is for NAME. The entry is in the buffer
+ * cache, so we can't null-terminate it in place.
+ */
+static
+bool
+sfs_dir_namematch(const struct sfs_direntry *sd, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<sizeof(sd->sfd_name); i++) {
+		if (sd->sfd_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	/* Unterminated on disk; treat it as cut off, like elsewhere */
+	return false;
+}
+
+/*
+ * Adjust the passing count in the header of a bucket by DELTA.
+ */
+static
+int
+sfs_dir_adjpassing(struct sfs_vnode *sv, unsigned bucket, int delta)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_dirhdr hdr;
+	off_t pos;
+	int result;
+
+	pos = bucket * SFS_BLOCKSIZE;
+	result = sfs_metaio(sv, pos, &hdr, sizeof(hdr), UIO_READ);
+	if (result) {
+		return result;
+	}
+	if (delta < 0 && hdr.sdh_passing < (uint32_t)-delta) {
+		panic("sfs: %s: hashed directory %u: Passing count "
+		      "underflow in bucket %u\n",
+		      sfs->sfs_sb.sb_volname, sv->sv_ino, bucket);
+	}
+	hdr.sdh_passing += delta;
+	return sfs_metaio(sv, pos, &hdr, sizeof(hdr), UIO_WRITE);
+}
+
+/*
+ * findname for hashed directories. Probe from the name's home bucket
+ * until we find it or run out of entries that were pushed past.
+ */
+static
+int
+sfs_hdir_findname(struct sfs_vnode *sv, const char *name,
+		  uint32_t *ino, int *slot)
+{
+	struct buf *buf;
+	struct sfs_direntry *sds;
+	struct sfs_dirhdr *hdr;
+	unsigned nbuckets, bucket, n, i;
+	bool done;
+	int result;
+
+	nbuckets = sfs_dir_nbuckets(sv);
+	bucket = sfs_dirhash(name) % nbuckets;
+
+	for (n=0; n<nbuckets; n++) {
+		result = sfs_dir_getbucket(sv, bucket, &buf);
+		if (result) {
+			return result;
+		}
+		sds = buffer_map(buf);
+		hdr = (struct sfs_dirhdr *)&sds[0];
+		for (i=1; i<SFS_DIRSLOTS; i++) {
+			if (sds[i].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			if (sfs_dir_namematch(&sds[i], name)) {
+				if (slot != NULL) {
+					*slot = bucket * SFS_DIRSLOTS + i;
+				}
+				if (ino != NULL) {
+					*ino = sds[i].sfd_ino;
+				}
+				buffer_release(buf);
+				return 0;
+			}
+		}
+		done = (hdr->sdh_passing == 0);
+		buffer_release(buf);
+		if (done) {
+			break;
+		}
+		bucket = (bucket + 1) % nbuckets;
+	}
+
+	return ENOENT;
+}
+
+/*
+ * Find a slot for NAME in a hashed directory: the first free slot at
+ * or after its home bucket. Bump the passing count of each bucket
+ * passed over on the way.
+ */
+static
+int
+sfs_hdir_allocslot(struct sfs_vnode *sv, const char *name, int *slot)
+{
+	struct buf *buf;
+	struct sfs_direntry *sds;
+	unsigned nbuckets, home, bucket, n, i;
+	int result;
+
+	nbuckets = sfs_dir_nbuckets(sv);
+	home = sfs_dirhash(name) % nbuckets;
+
+	bucket = home;
+	for (n=0; n<nbuckets; n++) {
+		result = sfs_dir_getbucket(sv, bucket, &buf);
+		if (result) {
+			return result;
+		}
+		sds = buffer_map(buf);
+		for (i=1; i<SFS_DIRSLOTS; i++) {
+			if (sds[i].sfd_ino == SFS_NOINO) {
+				break;
+			}
+		}
+		buffer_release(buf);
+		if (i < SFS_DIRSLOTS) {
+			break;
+		}
+		bucket = (bucket + 1) % nbuckets;
+	}
+	if (n == nbuckets) {
+		/* The table is full. */
+		return ENOSPC;
+	}
+
+	*slot = bucket * SFS_DIRSLOTS + i;
+
+	for (bucket = home; n > 0; n--) {
+		result = sfs_dir_adjpassing(sv, bucket, 1);
+		if (result) {
+			return result;
+		}
+		bucket = (bucket + 1) % nbuckets;
+	}
+	return 0;
+}
+
+/*
+ * Undo sfs_hdir_allocslot for the entry in SLOT, which is about to be
+ * cleared.
+ */
+static
+int
+sfs_hdir_freeslot(struct sfs_vnode *sv, int slot)
+{
+	struct sfs_direntry sd;
+	unsigned nbuckets, bucket, target;
+	int result;
+
+	KASSERT(slot % SFS_DIRSLOTS != 0);
+
+	result = sfs_readdir(sv, slot, &sd);
+	if (result) {
+		return result;
+	}
+	KASSERT(sd.sfd_ino != SFS_NOINO);
+	sd.sfd_name[sizeof(sd.sfd_name)-1] = 0;
+
+	nbuckets = sfs_dir_nbuckets(sv);
+	target = slot / SFS_DIRSLOTS;
+	for (bucket = sfs_dirhash(sd.sfd_name) % nbuckets;
+	     bucket != target;
+	     bucket = (bucket + 1) % nbuckets) {
+		result = sfs_dir_adjpassing(sv, bucket, -1);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
  * empty directory slot if one is found.
+ *
+ * Hashed directories never report an empty slot; sfs_dir_link picks
+ * the slot for them.
  */
 int
 sfs_dir_findname(struct sfs_vnode *sv, const char *name,
@@ -107,6 +389,10 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
 
+	if (sfs_dir_ishashed(sv)) {
+		return sfs_hdir_findname(sv, name, ino, slot);
+	}
+
 	nentries = sfs_dir_nentries(sv);
 
 	/* For each slot... */
@@ -128,10 +414,10 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 			/* Ensure null termination, just in case */
 			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
 			if (!strcmp(tsd.sfd_name, name)) {
-
-				/* Each name may legally appear only once... */
-				KASSERT(found==0);
-
+				/*
+				 * Each name may legally appear only once
+				 * (sfsck checks this) so stop here.
+				 */
 				found = 1;
 				if (slot != NULL) {
 					*slot = i;
@@ -139,6 +425,7 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 				if (ino != NULL) {
 					*ino = tsd.sfd_ino;
 				}
+				break;
 			}
 		}
 	}
@@ -170,8 +457,15 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 		return ENAMETOOLONG;
 	}
 
-	/* If we didn't get an empty slot, add the entry at the end. */
-	if (emptyslot < 0) {
+	if (sfs_dir_ishashed(sv)) {
+		/* Hashed directories have a place for each name. */
+		result = sfs_hdir_allocslot(sv, name, &emptyslot);
+		if (result) {
+			return result;
+		}
+	}
+	else if (emptyslot < 0) {
+		/* If we didn't get an empty slot, add the entry at the end. */
 		emptyslot = sfs_dir_nentries(sv);
 	}
 
@@ -196,6 +490,14 @@ int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_direntry sd;
+	int result;
+
+	if (sfs_dir_ishashed(sv)) {
+		result = sfs_hdir_freeslot(sv, slot);
+		if (result) {
+			return result;
+		}
+	}
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
@@ -36,11 +36,13 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
-#include <array.h>
 #include <bitmap.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
+#include <namecache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -106,21 +108,74 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 }
 
 /*
- * Sync routine for the vnode table.
+ * Sync routine for the vnode table. This copies each dirty in-memory
+ * inode into the buffer cache; the caller writes the buffers out.
+ *
+ * We can't lock a vnode with the vnode table locked, because the
+ * vnode's lock comes first in the lock order. So we walk the table
+ * once, holding a reference to the vnode we're at while the table is
+ * unlocked. The reference keeps that vnode in its chain, so we can
+ * carry on from its sv_hashnext, and bumping sfs_vnodes_walkers
+ * keeps the table from being rehashed under us. A vnode that's being
+ * reclaimed is waited for, so it's on disk (or in the buffer cache)
+ * by the time we return; one that's still being loaded is skipped.
  */
 static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
-	unsigned i, num;
+	struct sfs_vnode *sv, *pos, *held = NULL;
+	unsigned chain;
+	int result, ret = 0;
+
+	lock_acquire(sfs->sfs_vnlock);
+	sfs->sfs_vnodes_walkers++;
+
+	for (chain=0; chain < sfs->sfs_vnodes_size; chain++) {
+		/* pos is the last vnode we synced in this chain */
+		pos = NULL;
+		sv = sfs->sfs_vnodes[chain];
+		while (sv != NULL) {
+			if (sv->sv_loading) {
+				/* nothing of it in memory to write yet */
+				sv = sv->sv_hashnext;
+				continue;
+			}
+			if (sv->sv_reclaiming) {
+				cv_wait(sfs->sfs_reclaimcv, sfs->sfs_vnlock);
+				/* it may be gone; look again from our spot */
+				sv = (pos != NULL) ? pos->sv_hashnext :
+					sfs->sfs_vnodes[chain];
+				continue;
+			}
+
+			VOP_INCREF(&sv->sv_absvn);
+			lock_release(sfs->sfs_vnlock);
+
+			if (held != NULL) {
+				VOP_DECREF(&held->sv_absvn);
+			}
+			held = pos = sv;
+
+			lock_acquire(sv->sv_lock);
+			result = sfs_sync_inode(sv);
+			lock_release(sv->sv_lock);
+			if (result && ret == 0) {
+				ret = result;
+			}
+
+			lock_acquire(sfs->sfs_vnlock);
+			sv = sv->sv_hashnext;
+		}
+	}
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+	sfs->sfs_vnodes_walkers--;
+	lock_release(sfs->sfs_vnlock);
+
+	if (held != NULL) {
+		VOP_DECREF(&held->sv_absvn);
 	}
-	return 0;
+	return ret;
 }
 
 /*
@@ -132,13 +187,16 @@ sfs_sync_freemap(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_freemapio(sfs, UIO_WRITE);
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 
 	return 0;
 }
@@ -152,14 +210,17 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_superdirty) {
 		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 					sizeof(sfs->sfs_sb));
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 	return 0;
 }
 
@@ -174,8 +235,6 @@ sfs_sync(struct fs *fs)
 	struct sfs_fs *sfs;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -211,25 +270,27 @@ sfs_sync(struct fs *fs)
 	/* If any vnodes need to be written, write them. */
 	result = sfs_sync_vnodes(sfs);
 	if (result) {
-		vfs_biglock_release();
+		return result;
+	}
+
+	/* Write back any dirty blocks in the buffer cache. */
+	result = sync_fs_buffers(&sfs->sfs_absfs);
+	if (result) {
 		return result;
 	}
 
 	/* If the free block map needs to be written, write it. */
 	result = sfs_sync_freemap(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* If the superblock needs to be written, write it. */
 	result = sfs_sync_superblock(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -243,13 +304,26 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
 
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
+	/* The volume name doesn't change, so no locking is needed. */
+	return sfs->sfs_sb.sb_volname;
+}
 
-	return ret;
+/*
+ * Block I/O hooks for the buffer cache.
+ */
+static
+int
+sfs_fs_readblock(struct fs *fs, daddr_t block, void *data, size_t len)
+{
+	return sfs_readblock(fs->fs_data, block, data, len);
+}
+
+static
+int
+sfs_fs_writeblock(struct fs *fs, daddr_t block, void *data, size_t len)
+{
+	return sfs_writeblock(fs->fs_data, block, data, len);
 }
 
 /*
@@ -262,7 +336,10 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
-	vnodearray_destroy(sfs->sfs_vnodes);
+	sfs_vnodetable_cleanup(sfs);
+	sfs_iobufs_cleanup(sfs);
+	lock_destroy(sfs->sfs_freemaplock);
+	lock_destroy(sfs->sfs_vnlock);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
 }
@@ -277,19 +354,47 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sfs->sfs_vnlock);
 
 	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+	if (sfs->sfs_vnodes_num > 0) {
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
 
-	/* We should have just had sfs_sync called. */
+	/*
+	 * The VFS layer holds the mount table locked, so nobody can
+	 * find this volume to open anything new on it. Drop the lock
+	 * so we can destroy it.
+	 */
+	lock_release(sfs->sfs_vnlock);
+
+	/*
+	 * We just had sfs_sync called, but a vnode may have been
+	 * reclaimed since then, which writes its inode and may free
+	 * blocks. Every reclaim has finished by now (a vnode leaves the
+	 * table only at the end of sfs_reclaim) so flush once more.
+	 */
+	result = sync_fs_buffers(&sfs->sfs_absfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_sync_freemap(sfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_sync_superblock(sfs);
+	if (result) {
+		return result;
+	}
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Get rid of our (by now clean) blocks in the buffer cache */
+	drop_fs_buffers(&sfs->sfs_absfs);
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -297,7 +402,6 @@ sfs_unmount(struct fs *fs)
 	sfs_fs_destroy(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -309,6 +413,8 @@ static const struct fs_ops sfs_fsops = {
 	.fsop_getvolname = sfs_getvolname,
 	.fsop_getroot = sfs_getroot,
 	.fsop_unmount = sfs_unmount,
+	.fsop_readblock = sfs_fs_readblock,
+	.fsop_writeblock = sfs_fs_writeblock,
 };
 
 /*
@@ -328,6 +434,8 @@ sfs_fs_create(void)
 	COMPILE_ASSERT(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	COMPILE_ASSERT(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	COMPILE_ASSERT(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	COMPILE_ASSERT(sizeof(struct sfs_dirhdr)==sizeof(struct sfs_direntry));
+	COMPILE_ASSERT(NAMECACHE_NAMELEN >= SFS_NAMELEN - 1);
 
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
@@ -351,17 +459,33 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
+	sfs->sfs_vnlock = lock_create("sfs_vnlock");
+	if (sfs->sfs_vnlock == NULL) {
 		goto cleanup_object;
 	}
+	if (sfs_vnodetable_init(sfs)) {
+		goto cleanup_vnlock;
+	}
 
 	/* freemap */
+	sfs->sfs_freemaplock = lock_create("sfs_freemaplock");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnodes;
+	}
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
 
+	/* buffers for user I/O */
+	spinlock_init(&sfs->sfs_iobuflock);
+	sfs->sfs_iobufs = NULL;
+	sfs->sfs_niobufs = 0;
+
 	return sfs;
 
+cleanup_vnodes:
+	sfs_vnodetable_cleanup(sfs);
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -388,7 +512,10 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	int result;
 	struct sfs_fs *sfs;
 
-	vfs_biglock_acquire();
+	/*
+	 * Nobody else can see the new volume until we return, so
+	 * there's no need to lock anything here.
+	 */
 
 	/* We don't pass any options through mount */
 	(void)options;
@@ -402,7 +529,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
@@ -410,7 +536,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
@@ -423,7 +548,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -436,7 +560,6 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			SFS_MAGIC);
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
@@ -453,21 +576,18 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (sfs->sfs_freemap == NULL) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_freemapio(sfs, UIO_READ);
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -35,26 +35,244 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
+#include <buf.h>
+#include <namecache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
+////////////////////////////////////////////////////////////
+// Vnode table
+
+/* Initial number of hash chains; must be a power of 2. */
+#define SFS_VNODETABLE_INITSIZE  32
+
+/*
+ * Hash function. Inode numbers are block numbers and tend to be
+ * clustered, so mix the bits a little.
+ */
+static
+unsigned
+sfs_vnodetable_hash(uint32_t ino, unsigned size)
+{
+	return ((ino * 2654435761U) >> 8) & (size - 1);
+}
+
+/*
+ * Constructor and destructor for sfs_vnodecache. A free sfs_vnode
+ * in the cache holds onto its (unheld) lock.
+ */
+static
+int
+sfs_vnode_ctor(void *obj)
+{
+	struct sfs_vnode *sv = obj;
+
+	sv->sv_lock = lock_create("sfs vnode");
+	if (sv->sv_lock == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+sfs_vnode_dtor(void *obj)
+{
+	struct sfs_vnode *sv = obj;
+
+	lock_destroy(sv->sv_lock);
+}
+
 /*
- * Write an on-disk inode structure back out to disk.
+ * Set up the vnode table (and the cache the vnodes come from) for a
+ * new sfs_fs.
+ */
+int
+sfs_vnodetable_init(struct sfs_fs *sfs)
+{
+	unsigned i;
+
+	sfs->sfs_vnodecache = kmem_cache_create("sfs_vnode",
+						sizeof(struct sfs_vnode),
+						sfs_vnode_ctor,
+						sfs_vnode_dtor);
+	if (sfs->sfs_vnodecache == NULL) {
+		return ENOMEM;
+	}
+
+	sfs->sfs_reclaimcv = cv_create("sfs_reclaim");
+	if (sfs->sfs_reclaimcv == NULL) {
+		kmem_cache_destroy(sfs->sfs_vnodecache);
+		sfs->sfs_vnodecache = NULL;
+		return ENOMEM;
+	}
+
+	sfs->sfs_vnodes = kmalloc(SFS_VNODETABLE_INITSIZE *
+				  sizeof(struct sfs_vnode *));
+	if (sfs->sfs_vnodes == NULL) {
+		cv_destroy(sfs->sfs_reclaimcv);
+		sfs->sfs_reclaimcv = NULL;
+		kmem_cache_destroy(sfs->sfs_vnodecache);
+		sfs->sfs_vnodecache = NULL;
+		return ENOMEM;
+	}
+	for (i=0; i<SFS_VNODETABLE_INITSIZE; i++) {
+		sfs->sfs_vnodes[i] = NULL;
+	}
+	sfs->sfs_vnodes_size = SFS_VNODETABLE_INITSIZE;
+	sfs->sfs_vnodes_num = 0;
+	sfs->sfs_vnodes_walkers = 0;
+	return 0;
+}
+
+/*
+ * Destroy the vnode table. It must be empty.
+ */
+void
+sfs_vnodetable_cleanup(struct sfs_fs *sfs)
+{
+	KASSERT(sfs->sfs_vnodes_num == 0);
+	kfree(sfs->sfs_vnodes);
+	sfs->sfs_vnodes = NULL;
+	sfs->sfs_vnodes_size = 0;
+	cv_destroy(sfs->sfs_reclaimcv);
+	sfs->sfs_reclaimcv = NULL;
+	kmem_cache_destroy(sfs->sfs_vnodecache);
+	sfs->sfs_vnodecache = NULL;
+}
+
+/*
+ * Find a loaded vnode by inode number. Returns NULL if not loaded.
+ */
+static
+struct sfs_vnode *
+sfs_vnodetable_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_vnode *sv;
+	unsigned h;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	h = sfs_vnodetable_hash(ino, sfs->sfs_vnodes_size);
+	for (sv = sfs->sfs_vnodes[h]; sv != NULL; sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			return sv;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Double the number of hash chains. If we can't get the memory, just
+ * keep using the smaller table; chains get longer but nothing breaks.
+ */
+static
+void
+sfs_vnodetable_grow(struct sfs_fs *sfs)
+{
+	struct sfs_vnode **newtable, *sv;
+	unsigned newsize, i, h;
+
+	newsize = sfs->sfs_vnodes_size * 2;
+	newtable = kmalloc(newsize * sizeof(struct sfs_vnode *));
+	if (newtable == NULL) {
+		return;
+	}
+	for (i=0; i<newsize; i++) {
+		newtable[i] = NULL;
+	}
+
+	for (i=0; i<sfs->sfs_vnodes_size; i++) {
+		while ((sv = sfs->sfs_vnodes[i]) != NULL) {
+			sfs->sfs_vnodes[i] = sv->sv_hashnext;
+			h = sfs_vnodetable_hash(sv->sv_ino, newsize);
+			sv->sv_hashnext = newtable[h];
+			newtable[h] = sv;
+		}
+	}
+
+	kfree(sfs->sfs_vnodes);
+	sfs->sfs_vnodes = newtable;
+	sfs->sfs_vnodes_size = newsize;
+}
+
+/*
+ * Add a vnode to the table.
+ */
+static
+void
+sfs_vnodetable_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned h;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	if (sfs->sfs_vnodes_num >= sfs->sfs_vnodes_size * 2 &&
+	    sfs->sfs_vnodes_walkers == 0) {
+		sfs_vnodetable_grow(sfs);
+	}
+
+	h = sfs_vnodetable_hash(sv->sv_ino, sfs->sfs_vnodes_size);
+	sv->sv_hashnext = sfs->sfs_vnodes[h];
+	sfs->sfs_vnodes[h] = sv;
+	sfs->sfs_vnodes_num++;
+}
+
+/*
+ * Remove a vnode from the table.
+ */
+static
+void
+sfs_vnodetable_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **svp;
+	unsigned h;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	h = sfs_vnodetable_hash(sv->sv_ino, sfs->sfs_vnodes_size);
+	for (svp = &sfs->sfs_vnodes[h]; *svp != NULL;
+	     svp = &(*svp)->sv_hashnext) {
+		if (*svp == sv) {
+			*svp = sv->sv_hashnext;
+			sv->sv_hashnext = NULL;
+			sfs->sfs_vnodes_num--;
+			return;
+		}
+	}
+	panic("sfs: %s: vnode %u not in vnode pool\n",
+	      sfs->sfs_sb.sb_volname, sv->sv_ino);
+}
+
+////////////////////////////////////////////////////////////
+// Inodes
+
+/*
+ * Write an on-disk inode structure back out to disk. (Or rather, into
+ * the buffer cache, which writes it to disk later.) The caller must
+ * hold the vnode's lock.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *buf;
 	int result;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	if (sv->sv_dirty) {
-		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
-					sizeof(sv->sv_i));
+		/* The inode is a whole block, so no need to read it first */
+		result = buffer_get(&sfs->sfs_absfs, sv->sv_ino, &buf);
 		if (result) {
 			return result;
 		}
+		memcpy(buffer_map(buf), &sv->sv_i, sizeof(sv->sv_i));
+		buffer_mark_dirty(buf);
+		buffer_release(buf);
 		sv->sv_dirty = false;
 	}
 	return 0;
@@ -70,15 +288,27 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	/*
+	 * Take the vnode lock first, per the lock ordering. Then lock
+	 * the vnode table so sfs_loadvnode can't hand out a new
+	 * reference while we decide.
+	 */
+	lock_acquire(sv->sv_lock);
+	lock_acquire(sfs->sfs_vnlock);
+
+	/*
+	 * Get rid of name cache entries for this vnode. This must come
+	 * before the refcount check: after it, no new references can
+	 * come from the name cache, and any that already have show up
+	 * in the refcount.
+	 */
+	namecache_purge(v);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it.
 	 */
 	spinlock_acquire(&v->vn_countlock);
 	if (v->vn_refcount != 1) {
@@ -88,25 +318,34 @@ sfs_reclaim(struct vnode *v)
 		v->vn_refcount--;
 
 		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
 		return EBUSY;
 	}
 	spinlock_release(&v->vn_countlock);
 
+	/*
+	 * Mark the vnode so sfs_loadvnode waits for us instead of
+	 * handing it out, and drop the table lock so we aren't holding
+	 * it across the disk I/O below. The vnode stays in the table
+	 * (and counted) until we're done, so sfs_unmount can't get
+	 * past its busy check while we're still writing things out.
+	 */
+	sv->sv_reclaiming = true;
+	lock_release(sfs->sfs_vnlock);
+
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
-			return result;
+			goto fail;
 		}
 	}
 
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
-		return result;
+		goto fail;
 	}
 
 	/* If there are no on-disk references, discard the inode */
@@ -115,77 +354,79 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
-		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
-		      sfs->sfs_sb.sb_volname, sv->sv_ino);
-	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	lock_acquire(sfs->sfs_vnlock);
+	sfs_vnodetable_remove(sfs, sv);
+	cv_broadcast(sfs->sfs_reclaimcv, sfs->sfs_vnlock);
 
 	vnode_cleanup(&sv->sv_absvn);
 
-	vfs_biglock_release();
+	lock_release(sfs->sfs_vnlock);
+	lock_release(sv->sv_lock);
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(sfs->sfs_vnodecache, sv);
 
 	/* Done */
 	return 0;
+
+ fail:
+	/* Leave the vnode loaded, as before, and let waiters have it. */
+	lock_acquire(sfs->sfs_vnlock);
+	sv->sv_reclaiming = false;
+	cv_broadcast(sfs->sfs_reclaimcv, sfs->sfs_vnlock);
+	lock_release(sfs->sfs_vnlock);
+	lock_release(sv->sv_lock);
+	return result;
 }
 
 /*
  * Function to load a inode into memory as a vnode, or dig up one
  * that's already resident.
+ *
+ * A vnode being loaded goes in the table first, marked sv_loading,
+ * so two threads can't both load the same inode; then the table is
+ * unlocked while the inode is read, so lookups of other inodes don't
+ * wait for the disk. If the inode is in the middle of being loaded
+ * or reclaimed, wait until whoever is doing that has finished.
  */
 int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
+	struct buf *buf;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	sv = sfs_vnodetable_find(sfs, ino);
+	while (sv != NULL && (sv->sv_loading || sv->sv_reclaiming)) {
+		cv_wait(sfs->sfs_reclaimcv, sfs->sfs_vnlock);
+		sv = sfs_vnodetable_find(sfs, ino);
+	}
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: %s: Found inode %u in unallocated block\n",
 			      sfs->sfs_sb.sb_volname, sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
-		}
+		VOP_INCREF(&sv->sv_absvn);
+		lock_release(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kmem_cache_alloc(sfs->sfs_vnodecache);
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -195,16 +436,29 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		      "unallocated block\n", sfs->sfs_sb.sb_volname, ino);
 	}
 
+	/* Claim the inode number, then read it without the table lock */
+	sv->sv_ino = ino;
+	sv->sv_loading = true;
+	sv->sv_reclaiming = false;
+	sfs_vnodetable_add(sfs, sv);
+	lock_release(sfs->sfs_vnlock);
+
 	/* Read the block the inode is in */
-	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
+	result = buffer_read(&sfs->sfs_absfs, ino, &buf);
 	if (result) {
-		kfree(sv);
-		return result;
+		goto fail;
 	}
+	memcpy(&sv->sv_i, buffer_map(buf), sizeof(sv->sv_i));
+	buffer_release(buf);
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
 
+	/* No reads yet */
+	sv->sv_ranext = 0;
+	sv->sv_rawindow = 0;
+	sv->sv_raend = 0;
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out by sfs_balloc and
@@ -235,24 +489,27 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
-		return result;
+		goto fail;
 	}
 
-	/* Set the other fields in our vnode structure */
-	sv->sv_ino = ino;
-
-	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
-	if (result) {
-		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
-		return result;
-	}
+	/* Let anyone waiting for it have it */
+	lock_acquire(sfs->sfs_vnlock);
+	sv->sv_loading = false;
+	cv_broadcast(sfs->sfs_reclaimcv, sfs->sfs_vnlock);
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
 	return 0;
+
+ fail:
+	/* Take it back out; anyone waiting will try loading it again. */
+	lock_acquire(sfs->sfs_vnlock);
+	sfs_vnodetable_remove(sfs, sv);
+	cv_broadcast(sfs->sfs_reclaimcv, sfs->sfs_vnlock);
+	lock_release(sfs->sfs_vnlock);
+	kmem_cache_free(sfs->sfs_vnodecache, sv);
+	return result;
 }
 
 /*
@@ -296,25 +553,20 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
+		VOP_DECREF(&sv->sv_absvn);
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
@@ -36,8 +36,10 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
+#include <buf.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -62,8 +64,6 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	int result;
 	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	DEBUG(DB_SFS, "sfs: %s %llu\n",
 	      uio->uio_rw == UIO_READ ? "read" : "write",
 	      uio->uio_offset / SFS_BLOCKSIZE);
@@ -102,7 +102,8 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 }
 
 /*
- * Read a block.
+ * Read a block, bypassing the buffer cache. The buffer cache itself
+ * uses this (via fsop_readblock) to load blocks.
  */
 int
 sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
@@ -117,7 +118,7 @@ sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 }
 
 /*
- * Write a block.
+ * Write a block, bypassing the buffer cache.
  */
 int
 sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
@@ -150,16 +151,9 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *iobuf;
+	char *ioptr;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -169,9 +163,6 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
 
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Compute the block offset of this block in the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
 
@@ -184,40 +175,37 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block from the buffer cache. We need the old
+	 * contents even if we're writing, so read it in.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = buffer_read(&sfs->sfs_absfs, diskblock, &iobuf);
 	if (result) {
 		return result;
 	}
+	ioptr = buffer_map(iobuf);
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 */
+	result = uiomove(ioptr+skipstart, len, uio);
+
+	/*
+	 * If it was a write, the buffer is now dirty, even if we
+	 * failed partway through; whatever was copied is in there.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		buffer_mark_dirty(iobuf);
 	}
+	buffer_release(iobuf);
 
-	return 0;
+	return result;
 }
 
 /*
@@ -228,14 +216,11 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct buf *iobuf;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -258,33 +243,110 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
-
-	/*
-	 * Temporarily set the residue to be one block size.
+	 * Get the block from the buffer cache. If we're writing, we
+	 * are going to overwrite all of it, so don't bother reading
+	 * the old contents in.
 	 */
 	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
+	if (uio->uio_rw == UIO_READ) {
+		result = buffer_read(&sfs->sfs_absfs, diskblock, &iobuf);
+	}
+	else {
+		result = buffer_get(&sfs->sfs_absfs, diskblock, &iobuf);
+	}
+	if (result) {
+		return result;
+	}
 
-	result = sfs_rwblock(sfs, uio);
+	result = uiomove(buffer_map(iobuf), SFS_BLOCKSIZE, uio);
 
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+	if (uio->uio_rw == UIO_WRITE) {
+		if (result == 0 || buffer_is_valid(iobuf)) {
+			buffer_mark_dirty(iobuf);
+		}
+		else {
+			/* Half-filled and we had no old contents; toss it. */
+			buffer_release_and_invalidate(iobuf);
+			return result;
+		}
+	}
+	buffer_release(iobuf);
 
 	return result;
 }
 
+/*
+ * Read-ahead window limits, in blocks.
+ */
+#define SFS_RA_MINWINDOW	2
+#define SFS_RA_MAXWINDOW	16
+
+/*
+ * Start read-ahead after a read of file blocks FIRST through LAST.
+ *
+ * A read that picks up where the previous one left off (or rereads
+ * its last block, as small reads do) is sequential and doubles the
+ * window; anything else resets it. The blocks in the window past
+ * LAST that haven't been asked for already are handed to the buffer
+ * cache to load in the background. If the cache refuses any because
+ * it's backed up, halve the window again.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, uint32_t first, uint32_t last)
+{
+	uint32_t fileblock, endblock, eofblock;
+	daddr_t diskblock;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (first == sv->sv_ranext || first + 1 == sv->sv_ranext) {
+		sv->sv_rawindow *= 2;
+		if (sv->sv_rawindow < SFS_RA_MINWINDOW) {
+			sv->sv_rawindow = SFS_RA_MINWINDOW;
+		}
+		if (sv->sv_rawindow > SFS_RA_MAXWINDOW) {
+			sv->sv_rawindow = SFS_RA_MAXWINDOW;
+		}
+	}
+	else {
+		sv->sv_rawindow = 0;
+		sv->sv_raend = 0;
+	}
+	sv->sv_ranext = last + 1;
+
+	if (sv->sv_rawindow == 0) {
+		return;
+	}
+
+	eofblock = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	endblock = last + 1 + sv->sv_rawindow;
+	if (endblock > eofblock) {
+		endblock = eofblock;
+	}
+	fileblock = last + 1;
+	if (fileblock < sv->sv_raend) {
+		fileblock = sv->sv_raend;
+	}
+
+	for (; fileblock < endblock; fileblock++) {
+		result = sfs_bmap(sv, fileblock, false, &diskblock);
+		if (result) {
+			break;
+		}
+		if (diskblock == 0) {
+			/* Hole; nothing to read */
+			continue;
+		}
+		if (!buffer_readahead(sv->sv_absvn.vn_fs, diskblock)) {
+			sv->sv_rawindow /= 2;
+			break;
+		}
+	}
+	sv->sv_raend = fileblock;
+}
+
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
  */
@@ -295,8 +357,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	uint32_t nblocks, i;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	off_t origoffset;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	origresid = uio->uio_resid;
+	origoffset = uio->uio_offset;
 
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
@@ -381,6 +447,14 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		sv->sv_dirty = true;
 	}
 
+	/* If reading and we got anything, prefetch what comes next */
+	if (result == 0 &&
+	    uio->uio_rw == UIO_READ &&
+	    uio->uio_offset > origoffset) {
+		sfs_readahead(sv, origoffset / SFS_BLOCKSIZE,
+			      (uio->uio_offset - 1) / SFS_BLOCKSIZE);
+	}
+
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
@@ -388,6 +462,176 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	return result;
 }
 
+/*
+ * Size of the pieces sfs_userio copies user data in, and how many
+ * spare ones each volume keeps for reuse.
+ */
+#define SFS_USERIO_CHUNK	(8 * SFS_BLOCKSIZE)
+#define SFS_USERIO_SPARES	4
+
+/*
+ * Get a chunk buffer, reusing a spare one if there is one. The spares
+ * are chained through their first word.
+ */
+static
+void *
+sfs_iobuf_get(struct sfs_fs *sfs)
+{
+	void *chunk;
+
+	spinlock_acquire(&sfs->sfs_iobuflock);
+	chunk = sfs->sfs_iobufs;
+	if (chunk != NULL) {
+		sfs->sfs_iobufs = *(void **)chunk;
+		sfs->sfs_niobufs--;
+	}
+	spinlock_release(&sfs->sfs_iobuflock);
+
+	if (chunk == NULL) {
+		chunk = kmalloc(SFS_USERIO_CHUNK);
+	}
+	return chunk;
+}
+
+/*
+ * Give back a chunk buffer; keep it if we're short of spares.
+ */
+static
+void
+sfs_iobuf_put(struct sfs_fs *sfs, void *chunk)
+{
+	spinlock_acquire(&sfs->sfs_iobuflock);
+	if (sfs->sfs_niobufs < SFS_USERIO_SPARES) {
+		*(void **)chunk = sfs->sfs_iobufs;
+		sfs->sfs_iobufs = chunk;
+		sfs->sfs_niobufs++;
+		chunk = NULL;
+	}
+	spinlock_release(&sfs->sfs_iobuflock);
+
+	if (chunk != NULL) {
+		kfree(chunk);
+	}
+}
+
+/*
+ * Free the spare chunk buffers, at unmount.
+ */
+void
+sfs_iobufs_cleanup(struct sfs_fs *sfs)
+{
+	void *chunk;
+
+	while ((chunk = sfs->sfs_iobufs) != NULL) {
+		sfs->sfs_iobufs = *(void **)chunk;
+		sfs->sfs_niobufs--;
+		kfree(chunk);
+	}
+	KASSERT(sfs->sfs_niobufs == 0);
+	spinlock_cleanup(&sfs->sfs_iobuflock);
+}
+
+/*
+ * Do I/O for read() or write(), taking the vnode lock.
+ *
+ * Copying to or from userspace can fault, and the fault handler may
+ * need to read this very file (the user buffer may be mapped from it,
+ * or be part of a program being demand-loaded from it), which would
+ * deadlock on the vnode lock. So user data goes through a kernel
+ * buffer a chunk at a time and is copied in or out with the vnode
+ * unlocked. This makes a large read or write atomic only a chunk at a
+ * time with respect to other I/O on the file.
+ *
+ * A chunk never spans two iovecs, so if a write gets only part of a
+ * chunk to the file, the user uio can be backed up over the rest and
+ * the caller told exactly how much was written.
+ */
+int
+sfs_userio(struct sfs_vnode *sv, struct uio *uio)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct iovec iov, *uiov;
+	struct uio ku;
+	char *chunk;
+	size_t len, done;
+	int result = 0, result2;
+
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		lock_acquire(sv->sv_lock);
+		result = sfs_io(sv, uio);
+		lock_release(sv->sv_lock);
+		return result;
+	}
+
+	chunk = sfs_iobuf_get(sfs);
+	if (chunk == NULL) {
+		return ENOMEM;
+	}
+
+	while (uio->uio_resid > 0) {
+		/* Step past used-up iovecs, as uiomove would */
+		while (uio->uio_iov->iov_len == 0) {
+			KASSERT(uio->uio_iovcnt > 1);
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+		}
+		uiov = uio->uio_iov;
+
+		len = uio->uio_resid;
+		if (len > uiov->iov_len) {
+			len = uiov->iov_len;
+		}
+		if (len > SFS_USERIO_CHUNK) {
+			len = SFS_USERIO_CHUNK;
+		}
+
+		if (uio->uio_rw == UIO_WRITE) {
+			/* uiomove advances uio_offset past the chunk */
+			result = uiomove(chunk, len, uio);
+			if (result) {
+				break;
+			}
+			uio_kinit(&iov, &ku, chunk, len,
+				  uio->uio_offset - len, UIO_WRITE);
+		}
+		else {
+			uio_kinit(&iov, &ku, chunk, len, uio->uio_offset,
+				  UIO_READ);
+		}
+
+		lock_acquire(sv->sv_lock);
+		result = sfs_io(sv, &ku);
+		lock_release(sv->sv_lock);
+
+		done = len - ku.uio_resid;
+		if (uio->uio_rw == UIO_READ) {
+			if (done > 0) {
+				result2 = uiomove(chunk, done, uio);
+				if (result == 0) {
+					result = result2;
+				}
+			}
+			if (done < len) {
+				/* EOF */
+				break;
+			}
+		}
+		else if (done < len) {
+			/* Un-copy what didn't make it to the file */
+			uiov->iov_ubase -= len - done;
+			uiov->iov_len += len - done;
+			uio->uio_resid += len - done;
+			uio->uio_offset -= len - done;
+		}
+		if (result) {
+			break;
+		}
+	}
+
+	sfs_iobuf_put(sfs, chunk);
+	return result;
+}
+
 ////////////////////////////////////////////////////////////
 // Metadata I/O
 
@@ -412,19 +656,11 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	uint32_t blockoffset;
 	daddr_t diskblock;
 	bool doalloc;
+	struct buf *iobuf;
+	char *ioptr;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/* Figure out which block of the vnode (directory, whatever) this is */
 	vnblock = actualpos / SFS_BLOCKSIZE;
@@ -446,26 +682,25 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block from the buffer cache */
+	result = buffer_read(&sfs->sfs_absfs, diskblock, &iobuf);
 	if (result) {
 		return result;
 	}
+	ioptr = buffer_map(iobuf);
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, ioptr + blockoffset, len);
+		buffer_release(iobuf);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
+		memcpy(ioptr + blockoffset, data, len);
 
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		/* The buffer cache will write the block back */
+		buffer_mark_dirty(iobuf);
+		buffer_release(iobuf);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
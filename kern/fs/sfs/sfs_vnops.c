@@ -38,7 +38,11 @@
 #include <stat.h>
 #include <lib.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
+#include <buf.h>
+#include <namecache.h>
+#include <pagecache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -91,7 +95,7 @@ sfs_eachopendir(struct vnode *v, int openflags)
 }
 
 /*
- * Called for read(). sfs_io() does the work.
+ * Called for read(). sfs_userio() does the work.
  */
 static
 int
@@ -102,29 +106,35 @@ sfs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
-	vfs_biglock_release();
-
-	return result;
+	/* Changes made through mmap have to reach the file first. */
+	result = pagecache_preio(v, uio->uio_offset, uio->uio_resid);
+	if (result) {
+		return result;
+	}
+	return sfs_userio(sv, uio);
 }
 
 /*
- * Called for write(). sfs_io() does the work.
+ * Called for write(). sfs_userio() does the work.
  */
 static
 int
 sfs_write(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	off_t offset = uio->uio_offset;
+	size_t resid = uio->uio_resid;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
-	vfs_biglock_acquire();
-	result = sfs_io(sv, uio);
-	vfs_biglock_release();
-
+	/* Keep mappings of the file up to date (see pagecache.h). */
+	result = pagecache_preio(v, offset, resid);
+	if (result) {
+		return result;
+	}
+	result = sfs_userio(sv, uio);
+	pagecache_postwrite(v, offset, resid - uio->uio_resid);
 	return result;
 }
 
@@ -164,8 +174,10 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	lock_acquire(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
 	statbuf->st_nlink = sv->sv_i.sfi_linkcount;
+	lock_release(sv->sv_lock);
 
 	/* We don't support this yet */
 	statbuf->st_blocks = 0;
@@ -185,16 +197,13 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
 
-	vfs_biglock_acquire();
-
+	/* The type never changes, so we don't need to lock. */
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: %s: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -224,22 +233,27 @@ sfs_fsync(struct vnode *v)
 	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	if (result == 0) {
+		/* Push the inode and file data out of the buffer cache */
+		result = sfs_bsync(sv);
+	}
+	lock_release(sv->sv_lock);
 
 	return result;
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Any regular file can be mapped; the VM system
+ * does the rest with VOP_READ and VOP_WRITE.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 /*
@@ -250,8 +264,13 @@ int
 sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	lock_acquire(sv->sv_lock);
+	result = sfs_itrunc(sv, len);
+	lock_release(sv->sv_lock);
 
-	return sfs_itrunc(sv, len);
+	return result;
 }
 
 /*
@@ -286,21 +305,37 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_vnode *newguy;
+	struct vnode *cached;
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
-
-	/* Look up the name */
-	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
-	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
-		return result;
+	lock_acquire(sv->sv_lock);
+
+	/* Look up the name, in the name cache first */
+	if (namecache_lookup(v, name, &cached)) {
+		if (cached != NULL) {
+			if (excl) {
+				VOP_DECREF(cached);
+				lock_release(sv->sv_lock);
+				return EEXIST;
+			}
+			*ret = cached;
+			lock_release(sv->sv_lock);
+			return 0;
+		}
+		result = ENOENT;
+	}
+	else {
+		result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
+		if (result!=0 && result!=ENOENT) {
+			lock_release(sv->sv_lock);
+			return result;
+		}
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return EEXIST;
 	}
 
@@ -308,18 +343,19 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got something; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
 			return result;
 		}
+		namecache_enter(v, name, &newguy->sv_absvn);
 		*ret = &newguy->sv_absvn;
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return 0;
 	}
 
 	/* Didn't exist - create it */
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -329,20 +365,25 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	/* Link it into the directory */
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
+		lock_release(sv->sv_lock);
 		VOP_DECREF(&newguy->sv_absvn);
-		vfs_biglock_release();
 		return result;
 	}
 
 	/* Update the linkcount of the new file */
+	lock_acquire(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
 	newguy->sv_dirty = true;
+	lock_release(newguy->sv_lock);
+
+	/* The name exists now; replace any negative name cache entry */
+	namecache_enter(v, name, &newguy->sv_absvn);
 
 	*ret = &newguy->sv_absvn;
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -361,26 +402,34 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
-	vfs_biglock_acquire();
-
-	/* Hard links to directories aren't allowed. */
+	/*
+	 * Hard links to directories aren't allowed. (The type never
+	 * changes, so we can check it before locking; this also means
+	 * F can't be the directory, so locking both is safe.)
+	 */
 	if (f->sv_i.sfi_type == SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
+	lock_acquire(sv->sv_lock);
+
 	/* Create the link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
+	/* The name exists now; drop any negative name cache entry */
+	namecache_remove(dir, name);
+
 	/* and update the link count, marking the inode dirty */
+	lock_acquire(f->sv_lock);
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
+	lock_release(f->sv_lock);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -396,28 +445,37 @@ sfs_remove(struct vnode *dir, const char *name)
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
+	/* We don't support subdirectories, so this can't be a directory. */
+	KASSERT(victim != sv);
+
 	/* Erase its directory entry. */
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
+		/* The name is gone; forget it */
+		namecache_remove(dir, name);
+
 		/* If we succeeded, decrement the link count. */
+		lock_acquire(victim->sv_lock);
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
+		lock_release(victim->sv_lock);
 	}
 
+	lock_release(sv->sv_lock);
+
 	/* Discard the reference that sfs_lookonce got us */
 	VOP_DECREF(&victim->sv_absvn);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -438,15 +496,15 @@ sfs_rename(struct vnode *d1, const char *n1,
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
-
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOTDIR_INO);
 
+	lock_acquire(sv->sv_lock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -466,9 +524,15 @@ sfs_rename(struct vnode *d1, const char *n1,
 		goto puke;
 	}
 
+	/* Both names change; forget whatever we knew about them */
+	namecache_remove(d1, n1);
+	namecache_remove(d2, n2);
+
 	/* Increment the link count, and mark inode dirty */
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -480,14 +544,17 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * Decrement the link count again, and mark the inode dirty again,
 	 * in case it's been synced behind our back.
 	 */
+	lock_acquire(g1->sv_lock);
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
+
+	lock_release(sv->sv_lock);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
 
-	vfs_biglock_release();
 	return 0;
 
  puke_harder:
@@ -503,11 +570,13 @@ sfs_rename(struct vnode *d1, const char *n1,
 		panic("sfs: %s: rename: Cannot recover\n",
 		      sfs->sfs_sb.sb_volname);
 	}
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount--;
+	lock_release(g1->sv_lock);
  puke:
+	lock_release(sv->sv_lock);
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
-	vfs_biglock_release();
 	return result;
 }
 
@@ -525,15 +594,12 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
+	/* The type never changes, so this doesn't need locking. */
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -541,7 +607,6 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_absvn);
 	*ret = &sv->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -557,24 +622,41 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_vnode *final;
+	struct vnode *cached;
 	int result;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
+	/*
+	 * Try the name cache. A hit doesn't need the directory lock;
+	 * the answer is as good as if we'd looked just before whatever
+	 * change is in progress.
+	 */
+	if (namecache_lookup(v, path, &cached)) {
+		if (cached == NULL) {
+			return ENOENT;
+		}
+		*ret = cached;
+		return 0;
+	}
+
+	lock_acquire(sv->sv_lock);
 	result = sfs_lookonce(sv, path, &final, NULL);
+	if (result == 0) {
+		namecache_enter(v, path, &final->sv_absvn);
+	}
+	else if (result == ENOENT) {
+		namecache_enter(v, path, NULL);
+	}
+	lock_release(sv->sv_lock);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	*ret = &final->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
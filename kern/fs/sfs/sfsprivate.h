@@ -51,6 +51,7 @@ int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
+int sfs_bsync(struct sfs_vnode *sv);
 
 /* Functions in sfs_dir.c */
 int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
@@ -63,6 +64,8 @@ int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		int *slot);
 
 /* Functions in sfs_inode.c */
+int sfs_vnodetable_init(struct sfs_fs *sfs);
+void sfs_vnodetable_cleanup(struct sfs_fs *sfs);
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
@@ -74,6 +77,8 @@ int sfs_getroot(struct fs *fs, struct vnode **ret);
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
+int sfs_userio(struct sfs_vnode *sv, struct uio *uio);
+void sfs_iobufs_cleanup(struct sfs_fs *sfs);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
 
@@ -36,16 +36,67 @@
 
 
 #include <vm.h>
+#include <platform/maxcpus.h>
+#include <kern/vmstat.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
+struct pagecache;
+struct pagetable;
 
 
+#if !OPT_DUMBVM
+/*
+ * A stretch of a region whose contents are read from the backing file
+ * on demand: fm_size bytes at fm_vaddr come from fm_offset.
+ */
+struct vm_filemap {
+	vaddr_t fm_vaddr;		/* where the file data goes */
+	off_t fm_offset;		/* where it is in the file */
+	size_t fm_size;			/* how much of it there is */
+};
+
+/* Most file mappings in one region */
+#define VR_MAXFILEMAPS	4
+
+/*
+ * A region of an address space: a page-aligned range of virtual
+ * addresses that may be touched. Pages are allocated when first
+ * faulted on. They start out zeroed, except that the parts of the
+ * region described by vr_filemaps, if there is a backing file, are
+ * read from it. There can be more than one because program segments
+ * that share a page are merged into a single region.
+ *
+ * A region made by mmap instead gets its pages from a page cache, if
+ * it has one (see pagecache.h): the page at vr_base+N comes from the
+ * cache at vr_cacheoffset+N. A private mapping maps cached pages
+ * copy-on-write. A private anonymous mapping has no cache and works
+ * like any other zero-filled region.
+ *
+ * Regions are kept on a list sorted by address.
+ */
+struct vm_region {
+	vaddr_t vr_base;		/* first page */
+	unsigned vr_npages;		/* length in pages */
+	bool vr_writeable;		/* may be written */
+	unsigned vr_flags;		/* VR_* flags below */
+	struct vnode *vr_vnode;		/* backing file, or NULL */
+	unsigned vr_nfilemaps;		/* number of vr_filemaps in use */
+	struct vm_filemap vr_filemaps[VR_MAXFILEMAPS];
+	struct pagecache *vr_cache;	/* mmap page cache, or NULL */
+	off_t vr_cacheoffset;		/* where vr_base is in it */
+	struct vm_region *vr_next;
+};
+
+/* vr_flags */
+#define VR_MMAP		0x1	/* made by mmap; can be unmapped */
+#define VR_SHARED	0x2	/* writes go to the page cache */
+#endif
+
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
- *
- * You write this.
  */
 
 struct addrspace {
@@ -58,13 +109,31 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct vm_region *as_regions;	/* defined regions, by address */
+        struct pagetable *as_pt;	/* page table */
+        struct lock *as_lock;		/* protects the above */
+        uint32_t as_asid[MAXCPUS];	/* ASID on each CPU; see vm.c */
+        uint32_t as_vmstat[VMSTAT_NCOUNTERS]; /* see vmstat.h */
+        struct addrspace *as_next;	/* on as_list */
 #endif
 };
 
+#if !OPT_DUMBVM
+/*
+ * Every address space, linked through as_next, so pages shared by
+ * more than one can be found from the coremap side when paging out.
+ * Holding as_listlock keeps them from being destroyed.
+ */
+extern struct lock *as_listlock;
+extern struct addrspace *as_list;
+#endif
+
 /*
  * Functions in addrspace.c:
  *
+ *    as_bootstrap - (not with dumbvm) set up as_list. Called from
+ *                vm_bootstrap.
+ *
  *    as_create - create a new empty address space. You need to make
  *                sure this gets called in all the right places. You
  *                may find you want to change the argument list. May
@@ -87,7 +156,8 @@ struct addrspace {
  *                the way this works if implementing user-level threads.
  *
  *    as_define_region - set up a region of memory within the address
- *                space.
+ *                space. (Not with dumbvm:) if it shares pages with
+ *                regions already defined, they're merged into one.
  *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
@@ -99,10 +169,33 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_map_file - (not with dumbvm) arrange for FILESIZE bytes at
+ *                VADDR, which must be inside a region already defined,
+ *                to be read on demand from file V at OFFSET. Takes a
+ *                reference to V.
+ *
+ *    as_findregion - (not with dumbvm) return the region containing
+ *                VADDR, or NULL. The caller must hold as_lock.
+ *
+ *    as_mmap   - (not with dumbvm) map LEN bytes of file V from
+ *                OFFSET, or anonymous memory if V is NULL; FLAGS are
+ *                the MAP_* flags from <kern/mman.h>. Uses *VADDR if
+ *                MAP_FIXED is set, and otherwise picks an address
+ *                and hands it back there.
+ *
+ *    as_munmap - (not with dumbvm) remove mmap mappings in the range,
+ *                writing back shared pages that were changed.
+ *
+ *    as_msync  - (not with dumbvm) write back the changed pages of
+ *                shared file mappings in the range.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
 
+#if !OPT_DUMBVM
+void              as_bootstrap(void);
+#endif
 struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret);
 void              as_activate(void);
@@ -118,6 +211,20 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if !OPT_DUMBVM
+int               as_map_file(struct addrspace *as, vaddr_t vaddr,
+                              struct vnode *v, off_t offset,
+                              size_t filesize);
+struct vm_region *as_findregion(struct addrspace *as, vaddr_t vaddr);
+int               as_mmap(struct addrspace *as, vaddr_t *vaddr,
+                          size_t len, int writeable, int flags,
+                          struct vnode *v, off_t offset);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr,
+                            size_t len);
+int               as_msync(struct addrspace *as, vaddr_t vaddr,
+                           size_t len);
+#endif
+
 
 /*
  * Functions in loadelf.c
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BUF_H_
+#define _BUF_H_
+
+/*
+ * File system buffer cache.
+ *
+ * The buffer cache holds recently used file system blocks in memory,
+ * indexed by (file system, block number). Every block is BUFFER_SIZE
+ * bytes. Buffers are recycled least-recently-used first; dirty
+ * buffers are written back when they're recycled or when the file
+ * system is synced.
+ *
+ * The file system does the actual I/O through the fsop_readblock and
+ * fsop_writeblock operations in struct fs_ops.
+ *
+ * While a buffer is held (between buffer_read/buffer_get and
+ * buffer_release) the holding thread has exclusive use of it. Don't
+ * try to get the same block twice; that deadlocks.
+ */
+
+struct fs;  /* in fs.h */
+struct buf; /* opaque */
+
+/* Size of a cached block. This is the SFS block (and disk sector) size. */
+#define BUFFER_SIZE	512
+
+/*
+ * Functions:
+ *
+ * buffer_bootstrap    - Initialize the buffer cache. Called once at boot.
+ *
+ * buffer_read         - Get the buffer for BLOCK on FS, reading it in
+ *                       from disk if it isn't already cached.
+ * buffer_get          - Get the buffer for BLOCK on FS without reading
+ *                       it. If the block wasn't cached, the contents
+ *                       are undefined; the caller must overwrite the
+ *                       whole buffer and call buffer_mark_valid.
+ *
+ * buffer_map          - Return a pointer to the buffer's data.
+ * buffer_is_valid     - Check if the buffer's data is good.
+ * buffer_mark_valid   - Declare the buffer's data good.
+ * buffer_mark_dirty   - Declare the buffer modified; implies valid.
+ * buffer_release      - Give the buffer back to the cache.
+ * buffer_release_and_invalidate
+ *                     - Give the buffer back, discarding its contents
+ *                       (e.g. because an overwrite failed halfway).
+ *
+ * buffer_readahead    - Ask for BLOCK on FS to be read into the cache in
+ *                       the background. Returns false if the request
+ *                       couldn't be queued because too many are pending.
+ *
+ * buffer_drop         - Discard any cached copy of BLOCK on FS without
+ *                       writing it back; used when a block is freed.
+ * buffer_sync         - Write back the cached copy of BLOCK on FS, if
+ *                       it's dirty, waiting for it if it's in use.
+ * sync_fs_buffers     - Write back all dirty buffers belonging to FS,
+ *                       waiting for any that are in use.
+ * drop_fs_buffers     - Discard all buffers belonging to FS, which must
+ *                       be clean and not in use, and cancel pending
+ *                       read-ahead for it. Used at unmount time.
+ *
+ * buffer_printstats   - Print cache hit/miss statistics.
+ */
+
+void buffer_bootstrap(void);
+
+int buffer_read(struct fs *fs, daddr_t block, struct buf **ret);
+int buffer_get(struct fs *fs, daddr_t block, struct buf **ret);
+
+void *buffer_map(struct buf *b);
+bool buffer_is_valid(struct buf *b);
+void buffer_mark_valid(struct buf *b);
+void buffer_mark_dirty(struct buf *b);
+void buffer_release(struct buf *b);
+void buffer_release_and_invalidate(struct buf *b);
+
+bool buffer_readahead(struct fs *fs, daddr_t block);
+
+void buffer_drop(struct fs *fs, daddr_t block);
+int buffer_sync(struct fs *fs, daddr_t block);
+int sync_fs_buffers(struct fs *fs);
+void drop_fs_buffers(struct fs *fs);
+
+void buffer_printstats(void);
+
+
+#endif /* _BUF_H_ */
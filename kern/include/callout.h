@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: functions to be called at some time in the future.
+ *
+ * Each CPU keeps the callouts scheduled on it in a timer wheel: an
+ * array of slots, one per hardclock tick, each holding the callouts
+ * due during that tick (or that tick plus a multiple of the wheel
+ * size). Callouts are kept to the nanosecond, not just to the tick;
+ * the CPU's timer is programmed to go off for the earliest one, so a
+ * callout can run between hardclocks, and while the CPU is idle and
+ * not taking hardclocks at all. See clock.c.
+ *
+ * A callout runs once, in interrupt context, on the CPU that
+ * scheduled it. It must not sleep. It may reschedule itself.
+ *
+ * The caller provides the storage for the callout and must keep it
+ * around until the callout has run or has been cancelled.
+ */
+
+#include <kern/time.h>
+
+struct cpu;
+struct callwheel; /* Opaque. */
+
+struct callout {
+	uint64_t co_when;		/* When to run, in nanoseconds */
+	void (*co_func)(void *);	/* What to call */
+	void *co_data;			/* Argument for it */
+	struct callwheel *co_wheel;	/* Wheel it's on, or NULL */
+	struct callout *co_next;	/* Rest of the wheel slot */
+	struct callout **co_pprev;	/* Pointer to us in the slot */
+};
+
+/*
+ * Functions:
+ *
+ * callout_init     - Set up a callout to call FUNC(DATA).
+ * callout_schedule - Run a callout after DELAY, on the current CPU.
+ *                    It must not already be pending.
+ * callout_cancel   - Take a callout off its wheel. Returns true if
+ *                    it was pending, and false if it wasn't or if it
+ *                    has already started running. In the latter case
+ *                    it may still be running when callout_cancel
+ *                    returns.
+ * callout_pending  - Check if a callout is scheduled and hasn't
+ *                    started running yet.
+ *
+ * For the clock code:
+ *
+ * callwheel_create - Make the timer wheel for a new CPU.
+ * callout_run      - Run the current CPU's callouts that are due by
+ *                    NOW. Interrupts must be off.
+ * callout_next     - Get the time the current CPU's earliest callout
+ *                    is due. Returns false if there aren't any.
+ */
+void callout_init(struct callout *co, void (*func)(void *), void *data);
+void callout_schedule(struct callout *co, const struct timespec *delay);
+bool callout_cancel(struct callout *co);
+bool callout_pending(struct callout *co);
+
+struct callwheel *callwheel_create(void);
+void callout_run(uint64_t now);
+bool callout_next(uint64_t *ret);
+
+
+#endif /* _CALLOUT_H_ */
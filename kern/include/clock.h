@@ -38,26 +38,44 @@
 
 
 /*
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU HZ times a second, for
+ * scheduling, except while the CPU is idle.
+ *
+ * Each CPU has a one-shot timer that the machine-dependent code calls
+ * cpuclock() for. Once clock_bootstrap() has been called, cpuclock
+ * runs callouts (see callout.h) as they come due and calls hardclock
+ * when a tick is due, and sets the timer for whichever is next.
+ * Before that, it just calls hardclock every tick.
+ *
+ * An idle CPU calls hardclock_suspend before idling and
+ * hardclock_resume after, so it takes no timer interrupts while idle
+ * other than for callouts, and one a second to look for work.
+ * hardclock_resume advances c_hardclocks over the ticks skipped.
+ *
+ * clock_timerdue makes sure the current CPU's timer goes off by WHEN.
+ * Interrupts must be off. It's for callout_schedule.
  */
 
 /* hardclocks per second */
 #define HZ  100
 
+/* nanoseconds per hardclock */
+#define HARDCLOCK_NSEC	(1000000000 / HZ)
+
 void hardclock_bootstrap(void);
+void clock_bootstrap(void);
+void cpuclock(void);
 void hardclock(void);
-
-/*
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
- */
-void timerclock(void);
+void hardclock_suspend(void);
+void hardclock_resume(void);
+void clock_timerdue(uint64_t when);
 
 /*
  * gettime() may be used to fetch the current time of day.
+ * gettime_ns() gets it in nanoseconds.
  */
 void gettime(struct timespec *ret);
+uint64_t gettime_ns(void);
 
 /*
  * arithmetic on times
@@ -76,8 +94,12 @@ void timespec_sub(const struct timespec *t1,
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ *
+ * clocknanosleep() suspends execution for the requested time, like
+ * userlevel nanosleep(2), to the resolution of the timer hardware.
  */
 void clocksleep(int seconds);
+void clocknanosleep(const struct timespec *duration);
 
 
 #endif /* _CLOCK_H_ */
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Coremap: the table of all physical pages, and the physical page
+ * allocator built on it.
+ *
+ * Every page of RAM has an entry. Pages below the first free address
+ * at boot (the kernel image, the coremap itself, anything stolen with
+ * ram_stealmem) are fixed and never handed out. Free pages are on a
+ * doubly linked free list. An allocation is a block of one or more
+ * physically contiguous pages; its first page records the length, so
+ * it can be freed given just its address.
+ *
+ * Kernel pages come from alloc_kpages/free_kpages (see vm.h), which
+ * are implemented here.
+ *
+ * Pages of a paged address space also record which address space
+ * and virtual address they belong to, so the pageout code can find
+ * the page table entry to change when it evicts them. While a page
+ * is being filled in or paged out it is busy: it won't be chosen for
+ * eviction, and coremap_free waits for it.
+ *
+ * A user page can be shared copy-on-write by several address spaces
+ * at the same virtual address. It has a reference count, and isn't
+ * evicted while shared.
+ *
+ * When there aren't enough free pages, the allocator calls
+ * vm_pageout to evict some.
+ *
+ * A kernel thread zeroes free pages in the background and keeps a
+ * pool of them, so that pages that have to start out zeroed can
+ * usually be had without doing it at allocation time. Zeroed pages
+ * are still free pages as far as everything else is concerned.
+ *
+ * Functions:
+ *
+ * coremap_bootstrap  - Build the coremap. Must be called right after
+ *                      ram_bootstrap, before anything allocates memory.
+ * coremap_zero_bootstrap - Start the page-zeroing thread, and set up
+ *                      the wait channel coremap_free uses. Must be
+ *                      called once threads can be created.
+ * coremap_allocuser  - Allocate NPAGES contiguous pages for user memory
+ *                      that is never paged out (dumbvm, and the mmap
+ *                      page cache).
+ *                      Returns 0 if there aren't enough free pages.
+ * coremap_allocpage  - Allocate a page to map at VADDR in address
+ *                      space AS, zeroed if ZERO is set. It is
+ *                      returned busy. Returns 0 if there's no memory
+ *                      even after paging out.
+ * coremap_free       - Free the block starting at physical address PA,
+ *                      and the swap slot of its clean copy if any.
+ * coremap_share      - Add a reference to the user page at PA.
+ * coremap_refcount   - Return the number of references to the user
+ *                      page at PA.
+ * coremap_isshared   - Check if the user page at PA has more than one
+ *                      reference.
+ * coremap_release    - Drop address space AS's reference to the user
+ *                      page at PA, freeing it if that was the last.
+ *                      Waits if the page is busy.
+ * coremap_unpin      - Clear the busy flag of the user page at PA.
+ * coremap_reference  - Mark the user page at PA recently used by AS.
+ *                      If it is no longer shared and its owner is
+ *                      unknown, AS becomes its owner.
+ * coremap_getslot    - Get the swap slot holding a clean copy of the
+ *                      user page at PA, or CM_NONE.
+ * coremap_setslot    - Set it.
+ * coremap_pickvictim - Choose a user page to evict, mark it busy, and
+ *                      return it and where it's mapped. If it's shared,
+ *                      or its owner isn't known, *AS is just one of
+ *                      the address spaces mapping it, or NULL. Returns
+ *                      0 if there aren't any candidates.
+ * coremap_freepages  - Return the number of free pages.
+ * coremap_userpages  - Return the number of user pages, and in RECENT
+ *                      how many have their use bits set.
+ */
+
+#define CM_NONE		0xffffffff	/* null page or slot number */
+
+/* Use bits for page replacement, by page number; see coremap.c. */
+extern uint8_t *coremap_usebits;
+
+struct addrspace;
+
+void coremap_bootstrap(void);
+void coremap_zero_bootstrap(void);
+paddr_t coremap_allocuser(unsigned npages);
+paddr_t coremap_allocpage(struct addrspace *as, vaddr_t vaddr, bool zero);
+void coremap_free(paddr_t pa);
+void coremap_share(paddr_t pa);
+unsigned coremap_refcount(paddr_t pa);
+bool coremap_isshared(paddr_t pa);
+void coremap_release(paddr_t pa, struct addrspace *as);
+void coremap_unpin(paddr_t pa);
+void coremap_reference(paddr_t pa, struct addrspace *as);
+uint32_t coremap_getslot(paddr_t pa);
+void coremap_setslot(paddr_t pa, uint32_t slot);
+paddr_t coremap_pickvictim(struct addrspace **as, vaddr_t *vaddr);
+unsigned coremap_freepages(void);
+unsigned coremap_userpages(unsigned *recent);
+
+
+#endif /* _COREMAP_H_ */
@@ -35,8 +35,16 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct callwheel; /* from <callout.h> */
+
 extern unsigned num_cpus;
 
+/*
+ * Number of priority levels in each CPU's run queue. See the
+ * scheduler in thread.c.
+ */
+#define SCHED_NLEVELS	4
+
 /*
  * Per-cpu structure
  *
@@ -60,15 +68,19 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
-	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_hardclocks;		/* Counter of hardclock ticks */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	uint64_t c_nexttick;		/* When the next tick is due */
+	uint64_t c_nexttimer;		/* When the timer will go off */
+	bool c_tickless;		/* Idle, not taking ticks */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queues, by priority */
+	unsigned c_runcount;		/* Threads on all of them */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -78,7 +90,10 @@ struct cpu {
 	 * TLB shootdown requests made to this CPU are queued in
 	 * c_shootdown[], with c_numshootdown holding the number of
 	 * requests. TLBSHOOTDOWN_MAX is the maximum number that can
-	 * be queued at once, which is machine-dependent.
+	 * be queued at once, which is machine-dependent; past that,
+	 * c_shootdown_all is set instead and the whole TLB is flushed.
+	 * c_shootdown_sent counts requests made and c_shootdown_done
+	 * how many of them have been carried out.
 	 *
 	 * The contents of struct tlbshootdown are also machine-
 	 * dependent and might reasonably be either an address space
@@ -87,8 +102,23 @@ struct cpu {
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	unsigned c_numshootdown;
+	bool c_shootdown_all;
+	unsigned c_shootdown_sent;
+	unsigned c_shootdown_done;
 	struct spinlock c_ipi_lock;
 
+	/*
+	 * Queue nodes for MCS spinlocks. Allocated only by this cpu,
+	 * but other cpus in the same queue write to them; see
+	 * spinlock.c.
+	 */
+	struct spinlock_mcsnode c_mcsnodes[SPINLOCK_MCSNODES];
+
+	/*
+	 * Accessed by other cpus. Protected inside callout.c.
+	 */
+	struct callwheel *c_callwheel;	/* Callouts scheduled here */
+
 	/*
 	 * Accessed by other cpus. Protected inside hangman.c.
 	 */
@@ -156,6 +186,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_wait waits until the target has carried out every
+ * shootdown sent to it so far, including the caller's.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -170,6 +202,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_wait(struct cpu *target);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _DISKSCHED_H_
+#define _DISKSCHED_H_
+
+/*
+ * Disk request scheduler.
+ *
+ * A disk driver keeps its pending requests in a struct disksched and
+ * asks it which one to do next. The scheduler sorts requests by
+ * sector, merges requests for adjacent sectors in the same direction
+ * into one run, and picks among them according to a policy:
+ *
+ *    DISKSCHED_FIFO     - arrival order.
+ *    DISKSCHED_CSCAN    - circular elevator: sweep upward from the
+ *                         current head position, then wrap around to
+ *                         the lowest pending sector.
+ *    DISKSCHED_DEADLINE - C-SCAN, except that a request that has been
+ *                         waiting past its deadline goes first. Reads
+ *                         get a shorter deadline than writes.
+ *
+ * disksched_add and disksched_next do no locking and never sleep or
+ * allocate; the driver calls them under its own spinlock, including
+ * from its interrupt handler.
+ */
+
+#include <kern/time.h>
+
+struct disksched; /* Opaque. */
+
+/* Policies */
+#define DISKSCHED_FIFO		0
+#define DISKSCHED_CSCAN		1
+#define DISKSCHED_DEADLINE	2
+
+/*
+ * One request. The driver embeds this in its own request structure
+ * and fills in the first four fields before calling disksched_add;
+ * the rest belong to the scheduler.
+ *
+ * disksched_next hands back the first request of a merged run.
+ * The rest of the run follows on dr_mergenext, in sector order, with
+ * each request starting where the previous one ends.
+ */
+struct dsreq {
+	uint32_t dr_sector;		/* First sector */
+	uint32_t dr_nsect;		/* Number of sectors */
+	bool dr_iswrite;		/* Direction */
+	void *dr_data;			/* Driver's private pointer */
+
+	struct dsreq *dr_mergenext;	/* Next request in merged run */
+	struct dsreq *dr_sortprev;	/* Sector-order queue */
+	struct dsreq *dr_sortnext;
+	struct dsreq *dr_fifoprev;	/* Arrival-order queue */
+	struct dsreq *dr_fifonext;
+	struct timespec dr_deadline;	/* When this must be started by */
+	uint32_t dr_runsect;		/* Total sectors in the merged run */
+};
+
+/*
+ * Functions:
+ *
+ * disksched_create     - Make a scheduler. NAME is used for printing
+ *                        stats.
+ * disksched_destroy    - Destroy a scheduler, which must be empty.
+ * disksched_add        - Queue a request, merging it if possible.
+ * disksched_next       - Remove and return the next run to do, or
+ *                        NULL if there's nothing pending.
+ * disksched_isempty    - Check if there's nothing pending.
+ *
+ * disksched_setpolicy  - Change the policy of every scheduler.
+ * disksched_policyname - Get the name of a policy, or NULL if invalid.
+ * disksched_printstats - Print stats for every scheduler.
+ */
+struct disksched *disksched_create(const char *name);
+void disksched_destroy(struct disksched *ds);
+void disksched_add(struct disksched *ds, struct dsreq *dr);
+struct dsreq *disksched_next(struct disksched *ds);
+bool disksched_isempty(struct disksched *ds);
+
+void disksched_setpolicy(int policy);
+const char *disksched_policyname(int policy);
+void disksched_printstats(void);
+
+
+#endif /* _DISKSCHED_H_ */
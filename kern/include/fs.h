@@ -51,6 +51,8 @@ struct fs {
  *      fsop_getvolname - Return volume name of filesystem.
  *      fsop_getroot    - Return root vnode of filesystem.
  *      fsop_unmount    - Attempt unmount of filesystem.
+ *      fsop_readblock  - Read a block from the underlying device.
+ *      fsop_writeblock - Write a block to the underlying device.
  *
  * fsop_getvolname may return NULL on filesystem types that don't
  * support the concept of a volume name. The string returned is
@@ -68,12 +70,19 @@ struct fs {
  * consequently the struct fs instance should remain valid. On success,
  * however, the filesystem object and all storage associated with the
  * filesystem should have been discarded/released.
+ *
+ * fsop_readblock and fsop_writeblock are called by the buffer cache
+ * (see buf.h) to move a block between memory and disk; they are only
+ * needed by filesystems that use the buffer cache, and may be NULL
+ * otherwise.
  */
 struct fs_ops {
 	int           (*fsop_sync)(struct fs *);
 	const char   *(*fsop_getvolname)(struct fs *);
 	int           (*fsop_getroot)(struct fs *, struct vnode **);
 	int           (*fsop_unmount)(struct fs *);
+	int           (*fsop_readblock)(struct fs *, daddr_t, void *, size_t);
+	int           (*fsop_writeblock)(struct fs *, daddr_t, void *, size_t);
 };
 
 /*
@@ -83,6 +92,8 @@ struct fs_ops {
 #define FSOP_GETVOLNAME(fs)  ((fs)->fs_ops->fsop_getvolname(fs))
 #define FSOP_GETROOT(fs, ret) ((fs)->fs_ops->fsop_getroot(fs, ret))
 #define FSOP_UNMOUNT(fs)     ((fs)->fs_ops->fsop_unmount(fs))
+#define FSOP_READBLOCK(fs, b, d, l)  ((fs)->fs_ops->fsop_readblock(fs, b, d, l))
+#define FSOP_WRITEBLOCK(fs, b, d, l) ((fs)->fs_ops->fsop_writeblock(fs, b, d, l))
 
 /* Initialization functions for builtin fake file systems. */
 void semfs_bootstrap(void);
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for libc's <sys/mman.h>.
+ */
+
+/* Protections for mmap: PROT_NONE, or any of the others */
+#define PROT_NONE     0      /* No access */
+#define PROT_READ     1      /* Pages may be read */
+#define PROT_WRITE    2      /* Pages may be written */
+#define PROT_EXEC     4      /* Pages may be executed */
+
+/* Flags for mmap: choose one of these: */
+#define MAP_SHARED    1      /* Changes go to the file and other mappings */
+#define MAP_PRIVATE   2      /* Changes are private (copy-on-write) */
+/* then or in any of these: */
+#define MAP_FIXED     4      /* Map at exactly the address given */
+#define MAP_ANON      8      /* Anonymous memory; no file */
+
+/* Additional related definitions */
+#define MAP_TYPE      3      /* mask for MAP_SHARED/MAP_PRIVATE */
+#define MAP_FAILED    ((void *)-1)   /* error return from mmap */
+
+/* Flags for msync */
+#define MS_ASYNC      1      /* Start writing back (we wait anyway) */
+#define MS_SYNC       2      /* Write back and wait */
+#define MS_INVALIDATE 4      /* Accepted; mappings are always coherent */
+
+#endif /* _KERN_MMAN_H_ */
@@ -67,6 +67,9 @@
 #define SFS_TYPE_FILE     1
 #define SFS_TYPE_DIR      2
 
+/* Inode flags for sfi_flags */
+#define SFS_IFLAG_HASHDIR 0x1     /* Directory is hashed (see below) */
+
 /*
  * On-disk superblock
  */
@@ -86,7 +89,8 @@ struct sfs_dinode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_flags;			/* SFS_IFLAG_* above */
+	uint32_t sfi_waste[128-4-SFS_NDIRECT];	/* unused space, set to 0 */
 };
 
 /*
@@ -97,5 +101,40 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/* Number of directory slots in a block */
+#define SFS_DIRSLOTS (SFS_BLOCKSIZE / sizeof(struct sfs_direntry))
+
+/*
+ * Hashed directories.
+ *
+ * A directory whose inode has SFS_IFLAG_HASHDIR set is a hash table
+ * of fixed size, chosen when the directory is created. Each block is
+ * one bucket. Slot 0 of each bucket holds a struct sfs_dirhdr rather
+ * than a directory entry; its first word is SFS_NOINO, so code that
+ * scans the directory linearly sees it as a free slot.
+ *
+ * A name's home bucket is its hash % (number of buckets), where the
+ * hash is 32-bit FNV-1a over the bytes of the name, as defined by the
+ * constants below. (It's computed by sfs_dirhash() in the kernel and
+ * sfsdir_hash() in sfsck.)
+ * If the home bucket is full the entry goes in the next bucket with
+ * room, wrapping around at the end, and sdh_passing is incremented in
+ * every bucket skipped over. A lookup therefore can stop at the first
+ * bucket that does not contain the name and has sdh_passing == 0.
+ */
+#define SFS_DIRHASH_MAGIC  0x64697268    /* "dirh" */
+#define SFS_DIRHASH_BASIS  2166136261U   /* FNV-1a offset basis */
+#define SFS_DIRHASH_PRIME  16777619U     /* FNV-1a prime */
+
+/*
+ * On-disk hashed directory bucket header
+ */
+struct sfs_dirhdr {
+	uint32_t sdh_noino;			/* Always SFS_NOINO */
+	uint32_t sdh_magic;			/* SFS_DIRHASH_MAGIC */
+	uint32_t sdh_passing;			/* # entries placed past here */
+	uint32_t sdh_waste[16-3];		/* unused space, set to 0 */
+};
+
 
 #endif /* _KERN_SFS_H_ */
@@ -197,6 +197,13 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Later additions --
+//                              (numbered from the end, so as not to
+//                              take a slot reserved above)
+//                              (virtual memory; see SYS_mmap)
+#define SYS_msync        121
+#define SYS_getvmstat    122
+
 /*CALLEND*/
 
 
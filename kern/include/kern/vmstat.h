@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _KERN_VMSTAT_H_
+#define _KERN_VMSTAT_H_
+
+/*
+ * Virtual memory statistics, as returned by getvmstat().
+ */
+
+/* Event counters; indexes into vs_counters[] */
+#define VMSTAT_TLBREFILL      0   /* TLB misses handled without a fault */
+#define VMSTAT_FAULT_READ     1   /* vm_fault calls, by type... */
+#define VMSTAT_FAULT_WRITE    2
+#define VMSTAT_FAULT_READONLY 3
+#define VMSTAT_ZEROFILL       4   /* pages filled with zeros */
+#define VMSTAT_FILEFILL       5   /* pages read from an executable */
+#define VMSTAT_CACHEFILL      6   /* pages mapped from the mmap page cache */
+#define VMSTAT_COWCOPY        7   /* copy-on-write pages copied */
+#define VMSTAT_COWTAKE        8   /* copy-on-write pages no longer shared */
+#define VMSTAT_SWAPIN         9   /* pages read from swap */
+#define VMSTAT_SWAPOUT        10  /* pages written to swap */
+#define VMSTAT_EVICT          11  /* pages evicted, written or not */
+#define VMSTAT_NCOUNTERS      12
+
+/* Whose statistics getvmstat() returns */
+#define VMSTAT_SELF   0       /* the calling process */
+#define VMSTAT_ALL    1       /* the whole system */
+
+struct vmstat {
+	__u32 vs_counters[VMSTAT_NCOUNTERS];
+	__u32 vs_resident;	/* pages in memory */
+	__u32 vs_recent;	/* of those, used since the clock passed */
+};
+
+/*
+ * TLB refills are only counted for the whole system. vs_resident and
+ * vs_recent for the whole system count pages in use by user programs
+ * (including the mmap page cache) rather than mappings.
+ */
+
+#endif /* _KERN_VMSTAT_H_ */
@@ -135,6 +135,30 @@ void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
 
+/*
+ * Object caches, for kernel structures that are allocated and freed
+ * often. Objects are exact-size and come from pages of their own.
+ *
+ * kmem_cache_create makes a cache of objects of SIZE bytes; NAME is
+ * used when printing stats and is not copied. CTOR, if not NULL, is
+ * called on an object before it is handed out for the first time,
+ * and may fail by returning an errno. Objects must then be freed
+ * back in their constructed state, and are reused in that state.
+ * DTOR, if not NULL, undoes CTOR when the memory is given back.
+ *
+ * kmem_cache_reap gives back all free memory a cache is holding.
+ * kmem_cache_destroy requires all objects to have been freed.
+ */
+struct kmem_cache;
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void kmem_cache_reap(struct kmem_cache *kc);
+
 /*
  * C string functions.
  *
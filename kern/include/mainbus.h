@@ -52,6 +52,12 @@ void mainbus_interrupt(struct trapframe *);
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/*
+ * Make the current CPU's timer interrupt go off in NSECS nanoseconds,
+ * replacing whatever it was set to. The interrupt calls cpuclock().
+ */
+void mainbus_settimer(uint32_t nsecs);
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _NAMECACHE_H_
+#define _NAMECACHE_H_
+
+/*
+ * Name lookup cache.
+ *
+ * Maps (directory vnode, name) to the vnode that name refers to, or
+ * records that the name doesn't exist ("negative" entries). This lets
+ * filesystems skip scanning the directory for names looked up often.
+ *
+ * The cache does not hold references to the vnodes in it. Instead,
+ * filesystems must call namecache_purge from VOP_RECLAIM, before
+ * they decide whether the vnode is really going away, so a stale
+ * vnode can never be handed out.
+ *
+ * Filesystems must also keep the cache consistent with their
+ * directories: call namecache_enter only while holding whatever lock
+ * protects the directory's contents, and call namecache_remove (under
+ * the same lock) whenever a name is created, removed, or renamed.
+ *
+ * Names longer than NAMECACHE_NAMELEN are never cached. It's big
+ * enough for any SFS name (SFS_NAMELEN less the terminating null);
+ * sfs_fs_create checks this.
+ */
+
+struct vnode;
+
+#define NAMECACHE_NAMELEN  59
+
+/*
+ * Functions:
+ *
+ * namecache_bootstrap - Initialize the cache. Called once at boot.
+ *
+ * namecache_lookup    - Look up NAME in DIR. Returns false if there is
+ *                       no entry. Otherwise returns true and sets *RET
+ *                       to the vnode (with a reference added), or to
+ *                       NULL if the entry is negative.
+ * namecache_enter     - Record that NAME in DIR is VN. VN may be NULL to
+ *                       record that NAME doesn't exist.
+ * namecache_remove    - Forget anything cached about NAME in DIR.
+ * namecache_purge     - Forget every entry involving VN, either as the
+ *                       directory or as the target.
+ *
+ * namecache_printstats - Print hit/miss statistics.
+ */
+
+void namecache_bootstrap(void);
+
+bool namecache_lookup(struct vnode *dir, const char *name,
+		      struct vnode **ret);
+void namecache_enter(struct vnode *dir, const char *name, struct vnode *vn);
+void namecache_remove(struct vnode *dir, const char *name);
+void namecache_purge(struct vnode *vn);
+
+void namecache_printstats(void);
+
+
+#endif /* _NAMECACHE_H_ */
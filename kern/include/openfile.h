@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _OPENFILE_H_
+#define _OPENFILE_H_
+
+/*
+ * Open files.
+ *
+ * This is the least that file-backed mmap needs: a way for a process
+ * to name a file it has opened, and the access mode it opened it
+ * with, which mmap checks against the protection asked for. It is not
+ * a full file table. Its limits:
+ *
+ *   - There is only open and close; no read, write, lseek, dup2, and
+ *     so on, and so no seek position in struct openfile.
+ *   - Nothing sets up the console on descriptors 0-2, so the first
+ *     file a process opens gets descriptor 0.
+ *   - The table isn't copied to a new process (there's no fork).
+ *   - It isn't locked. Each process has one thread, and only that
+ *     thread uses its table, except proc_destroy, after it's gone.
+ *
+ * A process's table, p_files, is indexed by file descriptor.
+ *
+ * Functions:
+ *
+ * openfile_lookup  - Get the open file for descriptor FD of the
+ *                    current process. Returns EBADF if there isn't
+ *                    one.
+ * openfile_closeall - Close all the open files of process P.
+ */
+
+struct vnode;
+struct proc;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_accmode;		/* O_RDONLY, O_WRONLY, or O_RDWR */
+};
+
+int openfile_lookup(int fd, struct openfile **ret);
+void openfile_closeall(struct proc *p);
+
+
+#endif /* _OPENFILE_H_ */
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache for mmap.
+ *
+ * Every file that is mapped with mmap has one page cache, shared by
+ * all its mappings, so that MAP_SHARED mappings of the same file in
+ * different processes see the same physical pages. A MAP_PRIVATE
+ * mapping maps the same pages copy-on-write, and only gets a copy of
+ * its own when it writes. A shared anonymous mapping gets a cache of
+ * its own, with no file behind it, that its mappings in forked
+ * children share.
+ *
+ * Cached pages hold a coremap reference of their own. They aren't
+ * paged out like other user pages; instead, when memory is short,
+ * pagecache_reclaim lets go of clean file pages that nothing has
+ * mapped, which can be read in again. Dirty pages are written back to
+ * the file when asked with pagecache_flush and when the cache is
+ * destroyed.
+ *
+ * Reads and writes of a file don't go through its page cache, so
+ * filesystems call pagecache_preio before each, so they see changes
+ * made through mappings, and pagecache_postwrite after writing, so
+ * mappings see the write.
+ *
+ * Functions:
+ *
+ * pagecache_bootstrap - Setup function.
+ * pagecache_get       - Get the cache for vnode V, creating it if
+ *                       needed, with a new reference. If V is NULL,
+ *                       make a new anonymous cache. Returns NULL if
+ *                       out of memory.
+ * pagecache_incref    - Add a reference.
+ * pagecache_decref    - Drop a reference. Dropping the last one writes
+ *                       back dirty pages and frees the cache.
+ * pagecache_getpage   - Get the page at file offset OFFSET, reading it
+ *                       in if needed, with a new coremap reference for
+ *                       the caller to map and coremap_release later.
+ *                       The part of the page past end of file reads as
+ *                       zeros.
+ * pagecache_markdirty - Note that the page at OFFSET has been written.
+ * pagecache_flush     - Write back dirty pages from offset START for
+ *                       LEN bytes, or to the end if LEN is 0.
+ * pagecache_preio     - Write back dirty cached pages of file V, if it
+ *                       has a cache, from OFFSET for LEN bytes.
+ * pagecache_postwrite - Update the cached pages of file V, if it has a
+ *                       cache, from the LEN bytes just written at
+ *                       OFFSET.
+ * pagecache_reclaim   - Free up to MAX clean, unmapped cached pages,
+ *                       without waiting for anything. Returns how many.
+ */
+
+#include "opt-dumbvm.h"
+
+
+struct vnode;
+struct pagecache; /* Opaque. */
+
+void pagecache_bootstrap(void);
+struct pagecache *pagecache_get(struct vnode *v);
+void pagecache_incref(struct pagecache *pc);
+void pagecache_decref(struct pagecache *pc);
+int pagecache_getpage(struct pagecache *pc, off_t offset, paddr_t *ret);
+void pagecache_markdirty(struct pagecache *pc, off_t offset);
+int pagecache_flush(struct pagecache *pc, off_t start, off_t len);
+
+#if OPT_DUMBVM
+/* No mmap, so nothing to keep in step with. */
+#define pagecache_preio(v, offset, len) \
+	((void)(v), (void)(offset), (void)(len), 0)
+#define pagecache_postwrite(v, offset, len) \
+	((void)(v), (void)(offset), (void)(len))
+#else
+int pagecache_preio(struct vnode *v, off_t offset, size_t len);
+void pagecache_postwrite(struct vnode *v, off_t offset, size_t len);
+#endif
+unsigned pagecache_reclaim(unsigned max);
+
+
+#endif /* _PAGECACHE_H_ */
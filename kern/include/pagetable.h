@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page tables for user address spaces.
+ *
+ * A virtual address is split 10/10/12: the top ten bits index the
+ * first-level table, the next ten index a second-level table of
+ * page table entries, and the rest is the offset in the page. Only
+ * the user half of the address space is covered, so the first-level
+ * table has 512 slots. Second-level tables are one page each and are
+ * only allocated once something in their 4M of address space is
+ * touched.
+ *
+ * A page table entry for a page in memory holds the physical page
+ * address and PTE_VALID. For a page that's been paged out it holds
+ * the swap slot number (shifted into the same place) and PTE_SWAPPED.
+ * An entry of 0 means the page isn't there yet and should be filled
+ * in from scratch; this is also what clean pages that have no copy in
+ * swap go back to when they're evicted.
+ *
+ * PTE_DIRTY means the page has been written since it was filled in or
+ * read from swap, so it must be written out to be evicted. Clean
+ * pages are mapped read-only in the TLB so the first write faults and
+ * sets it.
+ *
+ * PTE_COW means the page may be shared with another address space
+ * after a fork. It is mapped read-only, and the first write copies it
+ * (or just takes it over, if the others have let go of it by then).
+ *
+ * The fast-path TLB refill handler in exception-mips1.S walks these
+ * tables itself, so it has to be kept in step with the layout and
+ * the bits here.
+ */
+
+#include <vm.h>
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME	0xfffff000	/* physical page address */
+#define PTE_VALID	0x00000001	/* page is in memory */
+#define PTE_SWAPPED	0x00000002	/* page is in swap */
+#define PTE_DIRTY	0x00000004	/* page has been written */
+#define PTE_COW		0x00000008	/* page is copy-on-write */
+
+#define PTE_SLOT(pte)	((pte) >> 12)
+#define PTE_MKSWAP(slot) (((pte_t)(slot) << 12) | PTE_SWAPPED)
+
+#define PT_L2ENTRIES	(PAGE_SIZE / sizeof(pte_t))
+#define PT_L1ENTRIES	(USERSPACETOP / (PT_L2ENTRIES * PAGE_SIZE))
+
+#define PT_L1INDEX(va)	((va) >> 22)
+#define PT_L2INDEX(va)	(((va) >> 12) & 0x3ff)
+#define PT_VADDR(l1, l2) (((vaddr_t)(l1) << 22) | ((vaddr_t)(l2) << 12))
+
+struct pagetable {
+	pte_t *pt_l2[PT_L1ENTRIES];	/* second-level tables, or NULL */
+};
+
+/*
+ * Functions:
+ *
+ * pt_create  - Make an empty page table. Returns NULL if out of memory.
+ * pt_destroy - Free a page table. The pages it maps must already have
+ *              been freed and their entries cleared.
+ * pt_lookup  - Find the entry for virtual address VA. If its
+ *              second-level table doesn't exist, allocate it if CREATE
+ *              is true and return NULL otherwise. Also returns NULL if
+ *              out of memory.
+ */
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t va, bool create);
+
+
+#endif /* _PAGETABLE_H_ */
@@ -36,9 +36,11 @@
  * Note: curproc is defined by <current.h>.
  */
 
+#include <limits.h>
 #include <spinlock.h>
 
 struct addrspace;
+struct openfile;
 struct thread;
 struct vnode;
 
@@ -69,6 +71,7 @@ struct proc {
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
+	struct openfile *p_files[OPEN_MAX]; /* for mmap; see openfile.h */
 
 	/* add more material here as needed */
 };
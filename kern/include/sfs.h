@@ -50,25 +50,76 @@
 
 /*
  * In-memory inode
+ *
+ * sv_lock protects sv_i, sv_dirty, the read-ahead state, and the
+ * contents of the file. (sv_i.sfi_type never changes once the inode
+ * is loaded, so it may be examined without the lock.)
+ *
+ * The read-ahead state tracks sequential reads: sv_ranext is the
+ * file block a sequential reader would read next, sv_rawindow is how
+ * many blocks past the current read to prefetch, and sv_raend is the
+ * first file block not yet prefetched.
  */
 struct sfs_vnode {
 	struct vnode sv_absvn;          /* abstract vnode structure */
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	uint32_t sv_ranext;		/* expected next block to read */
+	uint32_t sv_rawindow;		/* read-ahead window in blocks */
+	uint32_t sv_raend;		/* end of read-ahead so far */
+	struct lock *sv_lock;		/* lock for the above */
+	struct sfs_vnode *sv_hashnext;	/* next in vnode table chain */
+	bool sv_loading;		/* being loaded (sfs_vnlock) */
+	bool sv_reclaiming;		/* being reclaimed (sfs_vnlock) */
 };
 
 /*
  * In-memory info for a whole fs volume
+ *
+ * The vnode table is a hash table of sfs_vnodes keyed by inode
+ * number, chained through sv_hashnext. The number of chains is a
+ * power of 2 and grows as more vnodes are loaded.
+ * The sfs_vnodes themselves come from sfs_vnodecache, which keeps
+ * their sv_lock around between uses.
+ *
+ * Locking: sfs_vnlock protects the vnode table; sfs_freemaplock
+ * protects the freemap and the superblock. The volume name and the
+ * block count in the superblock don't change after mount and can be
+ * read without locking.
+ *
+ * While sfs_vnodes_walkers is nonzero the table isn't grown, so the
+ * chains stay put for anyone walking them with the lock dropped.
+ *
+ * A vnode being reclaimed stays in the table, marked sv_reclaiming,
+ * until it's been completely written out, so sfs_unmount sees it and
+ * refuses. A vnode being loaded is put in the table, marked
+ * sv_loading, before its inode is read, so the read happens without
+ * the table locked. sfs_loadvnode waits on sfs_reclaimcv rather than
+ * handing out a vnode in either state.
+ *
+ * Lock ordering: vnode locks (directory before file), then
+ * sfs_vnlock, then sfs_freemaplock. The buffer cache's own lock
+ * comes after all of these.
  */
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct lock *sfs_vnlock;	/* lock for vnode table */
+	struct sfs_vnode **sfs_vnodes;  /* vnodes loaded into memory */
+	unsigned sfs_vnodes_size;	/* number of hash chains */
+	unsigned sfs_vnodes_num;	/* number of vnodes in the table */
+	unsigned sfs_vnodes_walkers;	/* threads walking; don't rehash */
+	struct cv *sfs_reclaimcv;	/* signalled when a load/reclaim ends */
+	struct kmem_cache *sfs_vnodecache; /* where vnodes come from */
+	struct lock *sfs_freemaplock;	/* lock for freemap and superblock */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct spinlock sfs_iobuflock;	/* lock for sfs_iobufs */
+	void *sfs_iobufs;		/* spare sfs_userio buffers */
+	unsigned sfs_niobufs;		/* number of spares */
 };
 
 /*
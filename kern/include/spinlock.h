@@ -46,17 +46,58 @@
 /* Get the machine-dependent bits. */
 #include <machine/spinlock.h>
 
+/*
+ * Kinds of spinlock, which differ in how CPUs wait for them:
+ *
+ *    SPINLOCK_TAS    - test-and-test-and-set on the lock word. Cheapest
+ *                      when there's little contention, but unfair, and
+ *                      all the waiters pound on the same word.
+ *    SPINLOCK_TICKET - take a number and wait for it to come up.
+ *                      First come, first served, but the waiters still
+ *                      all watch the same word.
+ *    SPINLOCK_MCS    - join a queue and wait on a word of one's own,
+ *                      which the CPU ahead clears when it's done. First
+ *                      come, first served, and each waiter spins
+ *                      locally. Costs a bit more when uncontended.
+ *
+ * The kind is picked when the lock is initialized.
+ */
+#define SPINLOCK_TAS		0
+#define SPINLOCK_TICKET		1
+#define SPINLOCK_MCS		2
+
+/*
+ * Queue node for an MCS lock. Each CPU has SPINLOCK_MCSNODES of them
+ * (in struct cpu), so that's how many MCS locks it can hold or be
+ * waiting for at once.
+ */
+#define SPINLOCK_MCSNODES	4
+
+struct spinlock_mcsnode {
+	struct spinlock_mcsnode *volatile mn_next; /* CPU waiting after us */
+	volatile spinlock_data_t mn_wait;	/* Nonzero until our turn */
+	bool mn_inuse;				/* Allocated */
+};
+
 /*
  * Basic spinlock.
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * What's in splk_lock depends on the kind: for SPINLOCK_TAS, whether
+ * the lock is held; for SPINLOCK_TICKET, the next ticket to hand out
+ * (splk_serving has the one whose turn it is); and for SPINLOCK_MCS,
+ * the node at the end of the queue, or 0.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile spinlock_data_t splk_serving; /* Ticket now served. */
+	struct spinlock_mcsnode *splk_mcsnode; /* MCS node of holder. */
+	unsigned splk_kind;		    /* SPINLOCK_* kind. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
 };
@@ -65,16 +106,21 @@ struct spinlock {
  * Initializer for cases where a spinlock needs to be static or global.
  */
 #ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
-				  HANGMAN_LOCKABLE_INITIALIZER }
+#define SPINLOCK_INITIALIZER_KIND(kind) \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL, \
+	  (kind), NULL, HANGMAN_LOCKABLE_INITIALIZER }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER_KIND(kind) \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL, \
+	  (kind), NULL }
 #endif
+#define SPINLOCK_INITIALIZER	SPINLOCK_INITIALIZER_KIND(SPINLOCK_TAS)
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * initkind	Same, but of the given kind; init makes SPINLOCK_TAS.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -84,6 +130,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_initkind(struct spinlock *lk, unsigned kind);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
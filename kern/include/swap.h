@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * The swap device is divided into page-sized slots, each with a
+ * reference count, so a swapped-out page inherited by fork can stay
+ * in one slot until one of the copies is touched. Pages are written in clusters of up to SWAP_CLUSTER pages
+ * to consecutive slots, so that paging out a batch of pages costs one
+ * disk request instead of one per page.
+ *
+ * If there's no swap device, swap_alloc always fails.
+ *
+ * Functions:
+ *
+ * swap_bootstrap - Find a disk to swap on (the first one that isn't in
+ *                  use and has no filesystem) and attach it. Call
+ *                  after devices are probed.
+ * swap_alloc     - Allocate NSLOTS consecutive slots; hands back the
+ *                  first. Returns ENOSPC if there isn't such a run.
+ * swap_share     - Add a reference to slot SLOT.
+ * swap_free      - Drop a reference to slot SLOT, freeing it if that
+ *                  was the last.
+ * swap_read      - Read slot SLOT into the physical page PA.
+ * swap_write     - Write the NPAGES physical pages in PAS to consecutive
+ *                  slots starting at SLOT, in one I/O.
+ */
+
+#define SWAP_CLUSTER	8	/* max pages per write */
+
+void swap_bootstrap(void);
+int swap_alloc(unsigned nslots, uint32_t *ret);
+void swap_share(uint32_t slot);
+void swap_free(uint32_t slot);
+int swap_read(uint32_t slot, paddr_t pa);
+int swap_write(uint32_t slot, const paddr_t *pas, unsigned npages);
+
+
+#endif /* _SWAP_H_ */
@@ -71,12 +71,21 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive: a thread that finds the lock held spins for a
+ * while if the holder is running on another CPU, since it'll likely
+ * let go soon, and only sleeps if the holder isn't running or takes
+ * too long. A lock released while threads are asleep on it is handed
+ * straight to one of them, rather than woken up to compete for it.
  */
 struct lock {
 		char *lk_name;
 		HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
 		struct wchan *lk_wchan;
-		struct thread *lk_thread;
+		struct thread *volatile lk_thread;
+		struct cpu *volatile lk_cpu;	/* Where lk_thread took it */
+		unsigned lk_waiters;		/* Threads asleep on lk_wchan */
+		bool lk_handoff;		/* Being handed to a waiter */
 		struct spinlock lk_spinlock;
 };
 
@@ -89,6 +98,8 @@ void lock_destroy(struct lock *);
  *                   same time.
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
+ *    lock_tryacquire - Get the lock if nobody holds it, without waiting.
+ *                   Returns true if it got it.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
@@ -96,6 +107,7 @@ void lock_destroy(struct lock *);
  */
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
+bool lock_tryacquire(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
 
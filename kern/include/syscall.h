@@ -58,5 +58,12 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_open(userptr_t path, int flags, mode_t mode, int32_t *retval);
+int sys_close(int fd);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags,
+	     userptr_t usersp, int32_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_msync(userptr_t addr, size_t len, int flags);
+int sys_getvmstat(int who, userptr_t buf);
 
 #endif /* _SYSCALL_H_ */
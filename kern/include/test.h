@@ -52,6 +52,7 @@ int arraytest(int, char **);
 int arraytest2(int, char **);
 int bitmaptest(int, char **);
 int threadlisttest(int, char **);
+int callouttest(int, char **);
 
 /* thread tests */
 int threadtest(int, char **);
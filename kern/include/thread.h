@@ -101,6 +101,18 @@ struct thread {
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduler fields, protected by the run queue lock of t_cpu.
+	 * While the thread is running, its CPU also updates t_ticks
+	 * and t_priority without the lock, since no one else looks
+	 * at them then.
+	 */
+	unsigned t_priority;		/* Run queue level; 0 is highest */
+	unsigned t_ticks;		/* Hardclocks used of its quantum */
+	unsigned t_readytime;		/* t_cpu's c_hardclocks when queued */
+	unsigned t_lastran;		/* t_cpu's c_hardclocks at switch out */
+	bool t_background;		/* stays at the lowest level */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -175,15 +187,23 @@ __DEAD void thread_exit(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Make the current thread a background thread: it stays at the lowest
+ * run queue level, even when it wakes up, so it only runs when there
+ * is nothing more important to do.
  */
-void schedule(void);
+void thread_setbackground(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Charge the current thread for a clock tick, and switch threads if
+ * it's used up its quantum or something more important is waiting.
+ * Called from the timer interrupt.
  */
-void thread_consider_migration(void);
+void thread_tick(void);
+
+/*
+ * Reshuffle the run queue. Called from the timer interrupt.
+ */
+void schedule(void);
 
 extern unsigned thread_count;
 void thread_wait_for_count(unsigned);
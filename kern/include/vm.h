@@ -51,6 +51,34 @@ void vm_bootstrap(void);
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/*
+ * Evict some user pages to make room, when the coremap runs out.
+ * Returns the number of pages freed. (Not with dumbvm.)
+ */
+unsigned vm_pageout(void);
+
+/*
+ * TLB and address space ID management. (Not with dumbvm.)
+ *
+ *    vm_tlbflush        - invalidate this CPU's TLB.
+ *    vm_asid_activate   - make AS current on this CPU, giving it an
+ *                         ASID if it needs one.
+ *    vm_asid_release    - forget AS before destroying it.
+ *    vm_shootdown_pages - invalidate NPAGES pages of AS, listed in
+ *                         PAGES, on every CPU, and wait for it.
+ *    vm_shootdown_as    - same, for all of AS's pages.
+ *
+ * The shootdown functions must be called after the page table has
+ * been changed, with AS's as_lock held.
+ */
+struct addrspace;
+void vm_tlbflush(void);
+void vm_asid_activate(struct addrspace *as);
+void vm_asid_release(struct addrspace *as);
+void vm_shootdown_pages(struct addrspace *as, const vaddr_t *pages,
+			unsigned npages);
+void vm_shootdown_as(struct addrspace *as);
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
@@ -64,6 +92,7 @@ unsigned int coremap_used_bytes(void);
 
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
+void vm_tlbshootdown_all(void);
 
 
 #endif /* _VM_H_ */
@@ -43,6 +43,7 @@
 #include <current.h>
 #include <synch.h>
 #include <vm.h>
+#include <coremap.h>
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
@@ -108,6 +109,7 @@ boot(void)
 
 	/* Early initialization. */
 	ram_bootstrap();
+	coremap_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
@@ -126,7 +128,9 @@ boot(void)
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
+	coremap_zero_bootstrap();
 	kprintf_bootstrap();
+	clock_bootstrap();
 	thread_start_cpus();
 	test161_bootstrap();
 
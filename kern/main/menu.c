@@ -40,10 +40,15 @@
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
+#include <buf.h>
+#include <namecache.h>
+#include <disksched.h>
+#include <vmstat.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
 #include <prompt.h>
+#include "opt-dumbvm.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-synchprobs.h"
@@ -516,6 +521,69 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_bufstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	buffer_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_namecachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	namecache_printstats();
+
+	return 0;
+}
+
+#if !OPT_DUMBVM
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vmstat_printstats();
+
+	return 0;
+}
+#endif
+
+/*
+ * Command for showing disk scheduler stats, or choosing the policy.
+ */
+static
+int
+cmd_diskschedstats(int nargs, char **args)
+{
+	int policy;
+
+	if (nargs == 1) {
+		disksched_printstats();
+		return 0;
+	}
+	if (nargs == 2) {
+		for (policy = 0; disksched_policyname(policy); policy++) {
+			if (!strcmp(args[1], disksched_policyname(policy))) {
+				disksched_setpolicy(policy);
+				return 0;
+			}
+		}
+	}
+	kprintf("Usage: ds [fifo|cscan|deadline]\n");
+	return EINVAL;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -578,6 +646,7 @@ static const char *testmenu[] = {
 	"[at2] Large array test              ",
 	"[bt]  Bitmap test                   ",
 	"[tlt] Threadlist test               ",
+	"[cot] Callout test                  ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
@@ -667,6 +736,12 @@ static const char *mainmenu[] = {
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+#if !OPT_DUMBVM
+	"[vmstat] VM stats                   ",
+#endif
+	"[bc] Buffer cache stats             ",
+	"[nc] Name cache stats               ",
+	"[ds] Disk scheduler stats/policy    ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -722,12 +797,19 @@ static struct {
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+#if !OPT_DUMBVM
+	{ "vmstat",     cmd_vmstat },
+#endif
+	{ "bc",         cmd_bufstats },
+	{ "nc",         cmd_namecachestats },
+	{ "ds",         cmd_diskschedstats },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "at2",	arraytest2 },
 	{ "bt",		bitmaptest },
 	{ "tlt",	threadlisttest },
+	{ "cot",	callouttest },
 	{ "km1",	kmalloctest },
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
@@ -48,6 +48,7 @@
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
+#include <openfile.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -62,6 +63,7 @@ struct proc *
 proc_create(const char *name)
 {
 	struct proc *proc;
+	unsigned i;
 
 	proc = kmalloc(sizeof(*proc));
 	if (proc == NULL) {
@@ -81,6 +83,9 @@ proc_create(const char *name)
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+	for (i=0; i<OPEN_MAX; i++) {
+		proc->p_files[i] = NULL;
+	}
 
 	return proc;
 }
@@ -112,6 +117,7 @@ proc_destroy(struct proc *proc)
 	 */
 
 	/* VFS fields */
+	openfile_closeall(proc);
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
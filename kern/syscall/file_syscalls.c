@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * File system calls: just open and close, for mmap. See openfile.h
+ * for what's missing.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <current.h>
+#include <vfs.h>
+#include <openfile.h>
+#include <syscall.h>
+
+int
+openfile_lookup(int fd, struct openfile **ret)
+{
+	if (fd < 0 || fd >= OPEN_MAX || curproc->p_files[fd] == NULL) {
+		return EBADF;
+	}
+	*ret = curproc->p_files[fd];
+	return 0;
+}
+
+void
+openfile_closeall(struct proc *p)
+{
+	unsigned fd;
+
+	for (fd=0; fd<OPEN_MAX; fd++) {
+		if (p->p_files[fd] != NULL) {
+			vfs_close(p->p_files[fd]->of_vnode);
+			kfree(p->p_files[fd]);
+			p->p_files[fd] = NULL;
+		}
+	}
+}
+
+/*
+ * open. The new file gets the lowest free descriptor.
+ */
+int
+sys_open(userptr_t path, int flags, mode_t mode, int32_t *retval)
+{
+	struct openfile *of;
+	char *kpath;
+	int fd, result;
+
+	for (fd=0; fd<OPEN_MAX; fd++) {
+		if (curproc->p_files[fd] == NULL) {
+			break;
+		}
+	}
+	if (fd == OPEN_MAX) {
+		return EMFILE;
+	}
+
+	kpath = kmalloc(PATH_MAX);
+	if (kpath == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr((const_userptr_t)path, kpath, PATH_MAX, NULL);
+	if (result) {
+		kfree(kpath);
+		return result;
+	}
+
+	of = kmalloc(sizeof(*of));
+	if (of == NULL) {
+		kfree(kpath);
+		return ENOMEM;
+	}
+	result = vfs_open(kpath, flags, mode, &of->of_vnode);
+	kfree(kpath);
+	if (result) {
+		kfree(of);
+		return result;
+	}
+	of->of_accmode = flags & O_ACCMODE;
+
+	curproc->p_files[fd] = of;
+	*retval = fd;
+	return 0;
+}
+
+int
+sys_close(int fd)
+{
+	struct openfile *of;
+	int result;
+
+	result = openfile_lookup(fd, &of);
+	if (result) {
+		return result;
+	}
+	curproc->p_files[fd] = NULL;
+	vfs_close(of->of_vnode);
+	kfree(of);
+	return 0;
+}
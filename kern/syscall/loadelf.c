@@ -37,14 +37,16 @@
  *    - then it loads each chunk of the program;
  *    - finally, as_complete_load.
  *
+ * Without dumbvm, "loading" a chunk just records where it is in the
+ * file with as_map_file; vm_fault reads each page in when it's first
+ * touched, so the executable must stay around as long as the address
+ * space does. The address space holds a reference to it for that.
+ *
  * This gives the VM code enough flexibility to deal with even grossly
  * mis-linked executables if that proves desirable. Under normal
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
- * If you wanted to support memory-mapped executables you would need
- * to rearrange this to map each segment.
- *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
  * linker). And you'd have to write a dynamic linker...
@@ -74,6 +76,7 @@
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
  */
+#if OPT_DUMBVM
 static
 int
 load_segment(struct addrspace *as, struct vnode *v,
@@ -144,6 +147,27 @@ load_segment(struct addrspace *as, struct vnode *v,
 
 	return result;
 }
+#else /* !OPT_DUMBVM */
+static
+int
+load_segment(struct addrspace *as, struct vnode *v,
+	     off_t offset, vaddr_t vaddr,
+	     size_t memsize, size_t filesize,
+	     int is_executable)
+{
+	(void)is_executable;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	return as_map_file(as, vaddr, v, offset, filesize);
+}
+#endif /* OPT_DUMBVM */
 
 /*
  * Load an ELF executable user program into the current address space.
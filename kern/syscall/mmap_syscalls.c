@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Memory mapping system calls.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <openfile.h>
+#include <syscall.h>
+
+/*
+ * mmap. The fd and offset arguments don't fit in registers; they're
+ * on the user stack at USERSP+16 and USERSP+24 (the offset is 64-bit
+ * and so aligned).
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, userptr_t usersp,
+	 int32_t *retval)
+{
+	struct addrspace *as;
+	struct openfile *of;
+	struct vnode *v;
+	vaddr_t vaddr;
+	off_t offset;
+	int fd, result;
+
+	result = copyin((const_userptr_t)usersp + 16, &fd, sizeof(fd));
+	if (result) {
+		return result;
+	}
+	result = copyin((const_userptr_t)usersp + 24, &offset, sizeof(offset));
+	if (result) {
+		return result;
+	}
+
+	if ((prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0 ||
+	    (flags & ~(MAP_TYPE | MAP_FIXED | MAP_ANON)) != 0) {
+		return EINVAL;
+	}
+
+	if (flags & MAP_ANON) {
+		v = NULL;
+		offset = 0;
+	}
+	else {
+		result = openfile_lookup(fd, &of);
+		if (result) {
+			return result;
+		}
+		/*
+		 * The file has to be readable, and writeable too if
+		 * writes through the mapping are to reach it.
+		 */
+		if (of->of_accmode == O_WRONLY ||
+		    ((flags & MAP_TYPE) == MAP_SHARED &&
+		     (prot & PROT_WRITE) && of->of_accmode != O_RDWR)) {
+			return EACCES;
+		}
+		v = of->of_vnode;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	vaddr = (vaddr_t)addr;
+	result = as_mmap(as, &vaddr, len, prot & PROT_WRITE, flags, v, offset);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)vaddr;
+	return 0;
+}
+
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return as_munmap(as, (vaddr_t)addr, len);
+}
+
+int
+sys_msync(userptr_t addr, size_t len, int flags)
+{
+	struct addrspace *as;
+
+	if ((flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) != 0 ||
+	    (flags & (MS_ASYNC | MS_SYNC)) == (MS_ASYNC | MS_SYNC)) {
+		return EINVAL;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return as_msync(as, (vaddr_t)addr, len);
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <callout.h>
+#include <synch.h>
+#include <test.h>
+
+#define NCALLOUTS	8
+#define SPACING_NSEC	1500000		/* Less than a tick apart */
+#define SLEEP_NSEC	2500000
+
+static struct callout callouts[NCALLOUTS];
+static uint64_t ran[NCALLOUTS];
+static struct semaphore *donesem;
+
+static
+void
+callouttest_func(void *data)
+{
+	unsigned i = (uintptr_t)data;
+
+	ran[i] = gettime_ns();
+	V(donesem);
+}
+
+static
+void
+callouttest_cancelled(void *data)
+{
+	(void)data;
+	panic("callouttest: cancelled callout ran\n");
+}
+
+int
+callouttest(int nargs, char **args)
+{
+	struct callout extra;
+	struct timespec ts;
+	uint64_t before, after;
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting callout test...\n");
+
+	donesem = sem_create("callouttest", 0);
+	KASSERT(donesem != NULL);
+
+	/* Schedule them in reverse order. */
+	for (i=0; i<NCALLOUTS; i++) {
+		callout_init(&callouts[i], callouttest_func,
+			     (void *)(uintptr_t)i);
+		ts.tv_sec = 0;
+		ts.tv_nsec = (NCALLOUTS - i) * SPACING_NSEC;
+		callout_schedule(&callouts[i], &ts);
+	}
+
+	callout_init(&extra, callouttest_cancelled, NULL);
+	ts.tv_sec = 1;
+	ts.tv_nsec = 0;
+	callout_schedule(&extra, &ts);
+	KASSERT(callout_pending(&extra));
+	KASSERT(callout_cancel(&extra));
+	KASSERT(!callout_pending(&extra));
+	KASSERT(!callout_cancel(&extra));
+
+	for (i=0; i<NCALLOUTS; i++) {
+		P(donesem);
+	}
+	for (i=0; i<NCALLOUTS; i++) {
+		KASSERT(!callout_pending(&callouts[i]));
+		KASSERT(ran[i] >= callouts[i].co_when);
+		kprintf("callout %u: ran %u us late\n", i,
+			(unsigned)((ran[i] - callouts[i].co_when) / 1000));
+	}
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = SLEEP_NSEC;
+	before = gettime_ns();
+	clocknanosleep(&ts);
+	after = gettime_ns();
+	KASSERT(after - before >= SLEEP_NSEC);
+	kprintf("clocknanosleep: slept %u us for %u us\n",
+		(unsigned)((after - before) / 1000), SLEEP_NSEC / 1000);
+
+	sem_destroy(donesem);
+	donesem = NULL;
+
+	kprintf("Callout test complete\n");
+	return 0;
+}
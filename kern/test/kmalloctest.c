@@ -41,8 +41,6 @@
 #include <kern/test161.h>
 #include <mainbus.h>
 
-#include "opt-dumbvm.h"
-
 // from arch/mips/vm/ram.c
 extern vaddr_t firstfree;
 
@@ -389,9 +387,6 @@ kmalloctest4(int nargs, char **args)
 	(void)args;
 
 	kprintf("Starting multipage kmalloc test...\n");
-#if OPT_DUMBVM
-	kprintf("(This test will not work with dumbvm)\n");
-#endif
 
 	sem = sem_create("kmalloctest4", 0);
 	if (sem == NULL) {
@@ -460,10 +455,6 @@ kmalloctest5(int nargs, char **args)
 		}
 	}
 
-#if OPT_DUMBVM
-	kprintf("(This test will not work with dumbvm)\n");
-#endif
-
 	// First, we need to figure out how much memory we're running with and how
 	// much space it will take up if we maintain a pointer to each allocated
 	// page. We do something similar to km3 - for 32 bit systems with
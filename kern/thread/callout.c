@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Callouts and the per-cpu timer wheels that hold them.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <clock.h>
+#include <callout.h>
+
+/*
+ * Number of slots in each wheel, one hardclock tick each. A callout
+ * that's further away than this waits in its slot while the wheel
+ * goes around.
+ */
+#define CALLWHEEL_SLOTS		64
+
+#define CALLWHEEL_TICK(when)	((when) / HARDCLOCK_NSEC)
+#define CALLWHEEL_SLOT(tick)	((unsigned)((tick) % CALLWHEEL_SLOTS))
+
+struct callwheel {
+	struct spinlock cw_lock;
+	struct callout *cw_slots[CALLWHEEL_SLOTS];
+	unsigned cw_count;		/* Callouts on the wheel */
+	uint64_t cw_lastrun;		/* Time of the last callout_run */
+};
+
+/*
+ * Create a wheel.
+ */
+struct callwheel *
+callwheel_create(void)
+{
+	struct callwheel *cw;
+	unsigned i;
+
+	cw = kmalloc(sizeof(*cw));
+	if (cw == NULL) {
+		return NULL;
+	}
+	spinlock_init(&cw->cw_lock);
+	for (i=0; i<CALLWHEEL_SLOTS; i++) {
+		cw->cw_slots[i] = NULL;
+	}
+	cw->cw_count = 0;
+	cw->cw_lastrun = 0;
+	return cw;
+}
+
+/*
+ * Put a callout in its slot. The wheel must be locked.
+ */
+static
+void
+callwheel_insert(struct callwheel *cw, struct callout *co)
+{
+	struct callout **slot;
+
+	KASSERT(spinlock_do_i_hold(&cw->cw_lock));
+	KASSERT(co->co_wheel == NULL);
+
+	slot = &cw->cw_slots[CALLWHEEL_SLOT(CALLWHEEL_TICK(co->co_when))];
+	co->co_next = *slot;
+	if (co->co_next != NULL) {
+		co->co_next->co_pprev = &co->co_next;
+	}
+	co->co_pprev = slot;
+	*slot = co;
+	co->co_wheel = cw;
+	cw->cw_count++;
+}
+
+/*
+ * Take a callout out of its slot. The wheel must be locked.
+ */
+static
+void
+callwheel_remove(struct callwheel *cw, struct callout *co)
+{
+	KASSERT(spinlock_do_i_hold(&cw->cw_lock));
+	KASSERT(co->co_wheel == cw);
+
+	*co->co_pprev = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_pprev = co->co_pprev;
+	}
+	co->co_next = NULL;
+	co->co_pprev = NULL;
+	co->co_wheel = NULL;
+	KASSERT(cw->cw_count > 0);
+	cw->cw_count--;
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+void
+callout_init(struct callout *co, void (*func)(void *), void *data)
+{
+	co->co_when = 0;
+	co->co_func = func;
+	co->co_data = data;
+	co->co_wheel = NULL;
+	co->co_next = NULL;
+	co->co_pprev = NULL;
+}
+
+void
+callout_schedule(struct callout *co, const struct timespec *delay)
+{
+	struct callwheel *cw;
+	int spl;
+
+	KASSERT(co->co_wheel == NULL);
+	KASSERT(delay->tv_sec >= 0);
+	KASSERT(delay->tv_nsec >= 0 && delay->tv_nsec < 1000000000);
+
+	/* Stay on this cpu until its timer has been set. */
+	spl = splhigh();
+
+	co->co_when = gettime_ns() +
+		(uint64_t)delay->tv_sec * 1000000000 + delay->tv_nsec;
+
+	cw = curcpu->c_callwheel;
+	spinlock_acquire(&cw->cw_lock);
+	callwheel_insert(cw, co);
+	spinlock_release(&cw->cw_lock);
+
+	clock_timerdue(co->co_when);
+
+	splx(spl);
+}
+
+bool
+callout_cancel(struct callout *co)
+{
+	struct callwheel *cw;
+
+	/*
+	 * The callout can run (and be rescheduled elsewhere) between
+	 * looking at co_wheel and getting the lock, so check again
+	 * after.
+	 */
+	while (1) {
+		cw = co->co_wheel;
+		if (cw == NULL) {
+			return false;
+		}
+		spinlock_acquire(&cw->cw_lock);
+		if (co->co_wheel == cw) {
+			callwheel_remove(cw, co);
+			spinlock_release(&cw->cw_lock);
+			return true;
+		}
+		spinlock_release(&cw->cw_lock);
+	}
+}
+
+bool
+callout_pending(struct callout *co)
+{
+	return co->co_wheel != NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Clock hooks
+
+/*
+ * Run the callouts that are due. Only the slots for the ticks since
+ * the last run can have any, unless it's been a whole turn of the
+ * wheel since then.
+ *
+ * The wheel is unlocked while each callout runs, so it can schedule
+ * or cancel callouts itself; start the slot over afterwards.
+ */
+void
+callout_run(uint64_t now)
+{
+	struct callwheel *cw;
+	struct callout *co;
+	void (*func)(void *);
+	void *data;
+	uint64_t tick, lasttick;
+	unsigned i, nslots, slot;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	cw = curcpu->c_callwheel;
+	spinlock_acquire(&cw->cw_lock);
+
+	lasttick = CALLWHEEL_TICK(cw->cw_lastrun);
+	tick = CALLWHEEL_TICK(now);
+	if (cw->cw_count == 0) {
+		nslots = 0;
+	}
+	else if (tick - lasttick >= CALLWHEEL_SLOTS) {
+		nslots = CALLWHEEL_SLOTS;
+	}
+	else {
+		nslots = tick - lasttick + 1;
+	}
+
+	for (i=0; i<nslots; i++) {
+		slot = CALLWHEEL_SLOT(lasttick + i);
+		co = cw->cw_slots[slot];
+		while (co != NULL) {
+			if (co->co_when > now) {
+				co = co->co_next;
+				continue;
+			}
+			func = co->co_func;
+			data = co->co_data;
+			callwheel_remove(cw, co);
+
+			spinlock_release(&cw->cw_lock);
+			func(data);
+			spinlock_acquire(&cw->cw_lock);
+
+			co = cw->cw_slots[slot];
+		}
+	}
+	cw->cw_lastrun = now;
+
+	spinlock_release(&cw->cw_lock);
+}
+
+/*
+ * Find when the next callout is due.
+ *
+ * Everything still on the wheel is due after cw_lastrun, so search
+ * forward from there for a slot with a callout due this time around;
+ * the first such slot holds the earliest callout. If there isn't one,
+ * everything is at least a whole turn away, so look at them all.
+ */
+bool
+callout_next(uint64_t *ret)
+{
+	struct callwheel *cw;
+	struct callout *co;
+	uint64_t tick, best;
+	unsigned i;
+	bool found;
+
+	cw = curcpu->c_callwheel;
+	spinlock_acquire(&cw->cw_lock);
+
+	if (cw->cw_count == 0) {
+		spinlock_release(&cw->cw_lock);
+		return false;
+	}
+
+	best = 0;
+	found = false;
+	tick = CALLWHEEL_TICK(cw->cw_lastrun);
+	for (i=0; i<CALLWHEEL_SLOTS && !found; i++) {
+		co = cw->cw_slots[CALLWHEEL_SLOT(tick + i)];
+		for (; co != NULL; co = co->co_next) {
+			if (CALLWHEEL_TICK(co->co_when) > tick + i) {
+				continue;
+			}
+			if (!found || co->co_when < best) {
+				best = co->co_when;
+				found = true;
+			}
+		}
+	}
+	if (!found) {
+		for (i=0; i<CALLWHEEL_SLOTS; i++) {
+			co = cw->cw_slots[i];
+			for (; co != NULL; co = co->co_next) {
+				if (best == 0 || co->co_when < best) {
+					best = co->co_when;
+				}
+			}
+		}
+	}
+	KASSERT(best != 0);
+
+	spinlock_release(&cw->cw_lock);
+	*ret = best;
+	return true;
+}
@@ -30,17 +30,22 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
 #include <wchan.h>
 #include <clock.h>
+#include <callout.h>
+#include <mainbus.h>
 #include <thread.h>
 #include <current.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Each CPU's timer is one-shot: every time it goes off, we run the
+ * callouts that are due, call hardclock if a tick is due, and set it
+ * again for the next of those. So callouts run when they're due
+ * rather than at the next tick, and an idle CPU, which has nothing
+ * for hardclock to do, only wakes up for callouts.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -50,14 +55,30 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	4	/* Age run queues every 4 hardclocks. */
+#define IDLE_MAX_HARDCLOCKS	HZ	/* Idle cpus wake at least every 1s. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Whether the time of day clock is there yet. Until it is, the timer
+ * just goes off every tick.
  */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
+static bool clock_ready;
+
+/*
+ * Threads in clocknanosleep wait on one of these, chosen by hashing
+ * the thread. The callout that wakes a thread up wakes up everyone
+ * else on the same channel too, and they go back to sleep.
+ */
+#define SLEEP_NCHANS	16
+#define SLEEP_CHAN(t)	(((uintptr_t)(t) >> 6) % SLEEP_NCHANS)
+
+static struct wchan *sleep_wchans[SLEEP_NCHANS];
+static struct spinlock sleep_locks[SLEEP_NCHANS];
+
+struct sleeper {
+	unsigned s_chan;
+	bool s_done;
+};
 
 /*
  * Setup.
@@ -65,29 +86,123 @@ static struct spinlock lbolt_lock;
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	unsigned i;
+
+	for (i=0; i<SLEEP_NCHANS; i++) {
+		spinlock_init(&sleep_locks[i]);
+		sleep_wchans[i] = wchan_create("clocksleep");
+		if (sleep_wchans[i] == NULL) {
+			panic("Couldn't create clocksleep wchan\n");
+		}
 	}
 }
 
 /*
- * This is called once per second, on one processor, by the timer
- * code.
+ * Called once the time of day clock has been attached.
  */
 void
-timerclock(void)
+clock_bootstrap(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
+	/* Make sure there is one; gettime panics otherwise. */
+	(void)gettime_ns();
+	clock_ready = true;
+}
+
+/*
+ * Get the time of day in nanoseconds.
+ */
+uint64_t
+gettime_ns(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Get the time, and start the current cpu's ticks from now if they
+ * haven't been started yet.
+ */
+static
+uint64_t
+clock_now(void)
+{
+	uint64_t now;
+
+	now = gettime_ns();
+	if (curcpu->c_nexttick == 0) {
+		curcpu->c_nexttick = now;
+	}
+	return now;
+}
+
+/*
+ * Set the current cpu's timer for the next thing due: the next tick,
+ * unless we're idle, or the next callout, whichever is first.
+ */
+static
+void
+clock_settimer(uint64_t now)
+{
+	uint64_t next, callout;
+
+	if (curcpu->c_tickless) {
+		next = now + (uint64_t)IDLE_MAX_HARDCLOCKS * HARDCLOCK_NSEC;
+	}
+	else {
+		next = curcpu->c_nexttick;
+	}
+	if (callout_next(&callout) && callout < next) {
+		next = callout;
+	}
+	curcpu->c_nexttimer = next;
+	mainbus_settimer(next > now ? (uint32_t)(next - now) : 0);
+}
+
+/*
+ * This is called by the timer interrupt code on each processor when
+ * its timer goes off. Interrupts are off.
+ */
+void
+cpuclock(void)
+{
+	uint64_t now;
+	bool tick;
+
+	if (!clock_ready) {
+		mainbus_settimer(HARDCLOCK_NSEC);
+		hardclock();
+		return;
+	}
+
+	now = clock_now();
+	callout_run(now);
+
+	tick = false;
+	if (!curcpu->c_tickless && now >= curcpu->c_nexttick) {
+		tick = true;
+		curcpu->c_nexttick += HARDCLOCK_NSEC;
+		if (curcpu->c_nexttick <= now) {
+			/* We fell behind; don't try to catch up. */
+			curcpu->c_nexttick = now + HARDCLOCK_NSEC;
+		}
+	}
+
+	/*
+	 * Set the timer before calling hardclock, because hardclock
+	 * may switch threads.
+	 */
+	clock_settimer(now);
+
+	if (tick) {
+		hardclock();
+	}
 }
 
 /*
- * This is called HZ times a second (on each processor) by the timer
- * code.
+ * This is called HZ times a second (on each processor) by cpuclock,
+ * except while the processor is idle.
  */
 void
 hardclock(void)
@@ -97,13 +212,103 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
-	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	thread_tick();
+}
+
+/*
+ * Stop hardclock on the current cpu, which is about to idle.
+ * Interrupts are off.
+ */
+void
+hardclock_suspend(void)
+{
+	if (!clock_ready) {
+		return;
+	}
+	KASSERT(!curcpu->c_tickless);
+	curcpu->c_tickless = true;
+	clock_settimer(clock_now());
+}
+
+/*
+ * Restart hardclock on the current cpu, which has stopped idling.
+ * Count the ticks skipped, so c_hardclocks keeps time. Interrupts
+ * are off.
+ */
+void
+hardclock_resume(void)
+{
+	uint64_t now, skipped;
+
+	if (!clock_ready || !curcpu->c_tickless) {
+		return;
+	}
+	curcpu->c_tickless = false;
+
+	now = clock_now();
+	if (now >= curcpu->c_nexttick) {
+		skipped = (now - curcpu->c_nexttick) / HARDCLOCK_NSEC + 1;
+		curcpu->c_hardclocks += skipped;
+		curcpu->c_nexttick += skipped * HARDCLOCK_NSEC;
+	}
+	clock_settimer(now);
+}
+
+/*
+ * Make sure the current cpu's timer goes off by WHEN.
+ */
+void
+clock_timerdue(uint64_t when)
+{
+	KASSERT(curthread->t_curspl > 0);
+
+	if (clock_ready && when < curcpu->c_nexttimer) {
+		clock_settimer(clock_now());
+	}
+}
+
+/*
+ * Wake up a thread in clocknanosleep.
+ */
+static
+void
+clocknanosleep_wakeup(void *data)
+{
+	struct sleeper *s = data;
+	unsigned chan = s->s_chan;
+
+	spinlock_acquire(&sleep_locks[chan]);
+	s->s_done = true;
+	wchan_wakeall(sleep_wchans[chan], &sleep_locks[chan]);
+	spinlock_release(&sleep_locks[chan]);
+}
+
+/*
+ * Suspend execution for the given time.
+ */
+void
+clocknanosleep(const struct timespec *duration)
+{
+	struct callout co;
+	struct sleeper s;
+
+	if (duration->tv_sec == 0 && duration->tv_nsec == 0) {
+		return;
+	}
+
+	s.s_chan = SLEEP_CHAN(curthread);
+	s.s_done = false;
+	callout_init(&co, clocknanosleep_wakeup, &s);
+	callout_schedule(&co, duration);
+
+	spinlock_acquire(&sleep_locks[s.s_chan]);
+	while (!s.s_done) {
+		wchan_sleep(sleep_wchans[s.s_chan], &sleep_locks[s.s_chan]);
+	}
+	spinlock_release(&sleep_locks[s.s_chan]);
 }
 
 /*
@@ -112,10 +317,12 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	struct timespec ts;
+
+	if (num_secs <= 0) {
+		return;
 	}
-	spinlock_release(&lbolt_lock);
+	ts.tv_sec = num_secs;
+	ts.tv_nsec = 0;
+	clocknanosleep(&ts);
 }
@@ -37,7 +37,8 @@
 #include <spinlock.h>
 #include <hangman.h>
 
-static struct spinlock hangman_lock = SPINLOCK_INITIALIZER;
+static struct spinlock hangman_lock =
+	SPINLOCK_INITIALIZER_KIND(SPINLOCK_MCS);
 
 /*
  * Look for a path through the waits-for graph that goes from START to
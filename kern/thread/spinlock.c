@@ -43,18 +43,35 @@
  * Spinlocks.
  */
 
+/*
+ * MCS queue nodes for use before curcpu exists, when there's only
+ * one cpu running.
+ */
+static struct spinlock_mcsnode spinlock_bootnodes[SPINLOCK_MCSNODES];
 
 /*
  * Initialize spinlock.
  */
 void
-spinlock_init(struct spinlock *splk)
+spinlock_initkind(struct spinlock *splk, unsigned kind)
 {
+	KASSERT(kind == SPINLOCK_TAS || kind == SPINLOCK_TICKET ||
+		kind == SPINLOCK_MCS);
+
 	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_serving, 0);
+	splk->splk_mcsnode = NULL;
+	splk->splk_kind = kind;
 	splk->splk_holder = NULL;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
 }
 
+void
+spinlock_init(struct spinlock *splk)
+{
+	spinlock_initkind(splk, SPINLOCK_TAS);
+}
+
 /*
  * Clean up spinlock.
  */
@@ -62,7 +79,133 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	if (splk->splk_kind == SPINLOCK_TICKET) {
+		KASSERT(spinlock_data_get(&splk->splk_lock) ==
+			spinlock_data_get(&splk->splk_serving));
+	}
+	else {
+		KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	}
+}
+
+/*
+ * Wait for a SPINLOCK_TAS lock.
+ */
+static
+void
+spinlock_tas_wait(struct spinlock *splk)
+{
+	while (1) {
+		/*
+		 * Do test-test-and-set, that is, read first before
+		 * doing test-and-set, to reduce bus contention.
+		 *
+		 * Test-and-set is a machine-level atomic operation
+		 * that writes 1 into the lock word and returns the
+		 * previous value. If that value was 0, the lock was
+		 * previously unheld and we now own it. If it was 1,
+		 * we don't.
+		 */
+		if (spinlock_data_get(&splk->splk_lock) != 0) {
+			continue;
+		}
+		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+			continue;
+		}
+		break;
+	}
+}
+
+/*
+ * Wait for a SPINLOCK_TICKET lock: take the next ticket and wait for
+ * the holder ahead of us to call it.
+ */
+static
+void
+spinlock_ticket_wait(struct spinlock *splk)
+{
+	spinlock_data_t ticket;
+
+	ticket = spinlock_data_fetchadd(&splk->splk_lock, 1);
+	while (spinlock_data_get(&splk->splk_serving) != ticket) {
+		/* spin */
+	}
+}
+
+/*
+ * Get a free MCS queue node from MYCPU.
+ */
+static
+struct spinlock_mcsnode *
+spinlock_mcs_getnode(struct cpu *mycpu)
+{
+	struct spinlock_mcsnode *nodes;
+	unsigned i;
+
+	nodes = mycpu != NULL ? mycpu->c_mcsnodes : spinlock_bootnodes;
+	for (i=0; i<SPINLOCK_MCSNODES; i++) {
+		if (!nodes[i].mn_inuse) {
+			nodes[i].mn_inuse = true;
+			return &nodes[i];
+		}
+	}
+	panic("Too many MCS spinlocks held at once\n");
+}
+
+/*
+ * Wait for a SPINLOCK_MCS lock: put our node at the end of the queue
+ * and, unless the queue was empty, wait for the cpu ahead of us to
+ * clear our mn_wait.
+ */
+static
+void
+spinlock_mcs_wait(struct spinlock *splk, struct cpu *mycpu)
+{
+	struct spinlock_mcsnode *node, *pred;
+
+	node = spinlock_mcs_getnode(mycpu);
+	node->mn_next = NULL;
+	spinlock_data_set(&node->mn_wait, 1);
+	membar_store_store();
+
+	pred = (struct spinlock_mcsnode *)(uintptr_t)
+		spinlock_data_swap(&splk->splk_lock, (uintptr_t)node);
+	if (pred != NULL) {
+		pred->mn_next = node;
+		while (spinlock_data_get(&node->mn_wait) != 0) {
+			/* spin */
+		}
+	}
+	splk->splk_mcsnode = node;
+}
+
+/*
+ * Let go of a SPINLOCK_MCS lock: pass it to the next cpu in the
+ * queue, if any.
+ */
+static
+void
+spinlock_mcs_signal(struct spinlock *splk)
+{
+	struct spinlock_mcsnode *node;
+
+	node = splk->splk_mcsnode;
+	splk->splk_mcsnode = NULL;
+
+	if (node->mn_next == NULL) {
+		/* If we're still the end of the queue, empty it. */
+		if (spinlock_data_cas(&splk->splk_lock, (uintptr_t)node, 0)
+		    == (uintptr_t)node) {
+			node->mn_inuse = false;
+			return;
+		}
+		/* Someone is joining; wait until they've linked up. */
+		while (node->mn_next == NULL) {
+			/* spin */
+		}
+	}
+	spinlock_data_set(&node->mn_next->mn_wait, 0);
+	node->mn_inuse = false;
 }
 
 /*
@@ -93,24 +236,18 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
-		}
+	switch (splk->splk_kind) {
+	    case SPINLOCK_TAS:
+		spinlock_tas_wait(splk);
+		break;
+	    case SPINLOCK_TICKET:
+		spinlock_ticket_wait(splk);
 		break;
+	    case SPINLOCK_MCS:
+		spinlock_mcs_wait(splk, mycpu);
+		break;
+	    default:
+		panic("Spinlock %p has bad kind %u\n", splk, splk->splk_kind);
 	}
 
 	membar_store_any();
@@ -137,7 +274,19 @@ spinlock_release(struct spinlock *splk)
 
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	switch (splk->splk_kind) {
+	    case SPINLOCK_TAS:
+		spinlock_data_set(&splk->splk_lock, 0);
+		break;
+	    case SPINLOCK_TICKET:
+		/* Only the holder changes splk_serving. */
+		spinlock_data_set(&splk->splk_serving,
+				  spinlock_data_get(&splk->splk_serving) + 1);
+		break;
+	    case SPINLOCK_MCS:
+		spinlock_mcs_signal(splk);
+		break;
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
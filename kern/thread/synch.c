@@ -36,10 +36,17 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
 
+/*
+ * Most times lock_acquire will check whether a running holder has
+ * let go before giving up and sleeping.
+ */
+#define LOCK_SPIN_MAX	1000
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -67,7 +74,7 @@ sem_create(const char *name, unsigned initial_count)
 		return NULL;
 	}
 
-	spinlock_init(&sem->sem_lock);
+	spinlock_initkind(&sem->sem_lock, SPINLOCK_TICKET);
 	sem->sem_count = initial_count;
 
 	return sem;
@@ -163,8 +170,11 @@ lock_create(const char *name)
 		return NULL;
 	}
 
-	spinlock_init(&lock->lk_spinlock);
+	spinlock_initkind(&lock->lk_spinlock, SPINLOCK_TICKET);
 	lock->lk_thread = NULL;
+	lock->lk_cpu = NULL;
+	lock->lk_waiters = 0;
+	lock->lk_handoff = false;
 
 	return lock;
 }
@@ -174,6 +184,8 @@ lock_destroy(struct lock *lock)
 {
 	KASSERT(lock != NULL);
 	KASSERT(lock->lk_thread == NULL);
+	KASSERT(lock->lk_waiters == 0);
+	KASSERT(!lock->lk_handoff);
 
 	spinlock_cleanup(&lock->lk_spinlock);
 	wchan_destroy(lock->lk_wchan);
@@ -181,9 +193,31 @@ lock_destroy(struct lock *lock)
 	kfree(lock);
 }
 
+/*
+ * Check if the thread holding a lock is running on some cpu right
+ * now. This is only a hint: we look without any locking, and by then
+ * the thread might have let go of the lock, or even exited. So don't
+ * touch the thread itself, which may have been freed; just check
+ * whether the cpu it took the lock on is still running it. (Cpu
+ * structures are never freed.) A holder that has moved to another
+ * cpu since looks like it isn't running, which only costs a sleep.
+ */
+static
+bool
+lock_holder_running(struct lock *lock, struct thread *holder)
+{
+	struct cpu *c = lock->lk_cpu;
+	volatile struct cpu *vc = c;
+
+	return c != NULL && vc->c_curthread == holder;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+	struct thread *holder;
+	unsigned spins;
+
 	KASSERT(lock != NULL);
 	KASSERT(curthread->t_in_interrupt == false);
 
@@ -192,23 +226,42 @@ lock_acquire(struct lock *lock)
 	/* Use the semaphore spinlock to protect the wchan as well. */
 	spinlock_acquire(&lock->lk_spinlock);
 	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
-	while (lock->lk_thread != NULL) {
+	spins = 0;
+	while (lock->lk_thread != NULL || lock->lk_handoff) {
+		holder = lock->lk_thread;
+		if (holder != NULL && spins < LOCK_SPIN_MAX &&
+		    lock_holder_running(lock, holder)) {
+			/*
+			 * The holder is running elsewhere. Wait for it
+			 * without the spinlock, and without the two
+			 * context switches of sleeping.
+			 */
+			spinlock_release(&lock->lk_spinlock);
+			while (lock->lk_thread == holder &&
+			       spins < LOCK_SPIN_MAX &&
+			       lock_holder_running(lock, holder)) {
+				spins++;
+			}
+			spinlock_acquire(&lock->lk_spinlock);
+			continue;
+		}
+
 		/*
-		 *
-		 * Note that we don't maintain strict FIFO ordering of
-		 * threads going through the semaphore; that is, we
-		 * might "get" it on the first try even if other
-		 * threads are waiting. Apparently according to some
-		 * textbooks semaphores must for some reason have
-		 * strict ordering. Too bad. :-)
-		 *
-		 * Exercise: how would you implement strict FIFO
-		 * ordering?
+		 * Sleep. Only lock_release wakes us, and only to hand
+		 * us the lock; nobody else can take it meanwhile. Of
+		 * the threads waiting, which one gets it is up to
+		 * wchan_wakeone.
 		 */
+		lock->lk_waiters++;
 		wchan_sleep(lock->lk_wchan, &lock->lk_spinlock);
+		lock->lk_waiters--;
+		KASSERT(lock->lk_handoff);
+		lock->lk_handoff = false;
+		break;
 	}
 	KASSERT(lock->lk_thread == NULL);
 	lock->lk_thread = curthread;
+	lock->lk_cpu = curcpu->c_self;
 	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
 	spinlock_release(&lock->lk_spinlock);
 
@@ -224,10 +277,39 @@ lock_release(struct lock *lock)
 	spinlock_acquire(&lock->lk_spinlock);
 
 	lock->lk_thread = NULL;
+	lock->lk_cpu = NULL;
 	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
-	wchan_wakeone(lock->lk_wchan, &lock->lk_spinlock);
+	if (lock->lk_waiters > 0) {
+		/*
+		 * Hand it to a waiter, which otherwise might wake up
+		 * only to find that someone got there first.
+		 */
+		KASSERT(!lock->lk_handoff);
+		lock->lk_handoff = true;
+		wchan_wakeone(lock->lk_wchan, &lock->lk_spinlock);
+	}
+
+	spinlock_release(&lock->lk_spinlock);
+}
 
+bool
+lock_tryacquire(struct lock *lock)
+{
+	bool got;
+
+	KASSERT(lock != NULL);
+
+	spinlock_acquire(&lock->lk_spinlock);
+	got = (lock->lk_thread == NULL && !lock->lk_handoff);
+	if (got) {
+		lock->lk_thread = curthread;
+		lock->lk_cpu = curcpu->c_self;
+		HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+		HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	}
 	spinlock_release(&lock->lk_spinlock);
+
+	return got;
 }
 
 bool
@@ -50,11 +50,27 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
+#include <callout.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Scheduler tuning: the quantum, in hardclocks, of a thread at each
+ * run queue level, and how long a thread can wait at a level before
+ * it's moved up one. See schedule().
+ */
+#define SCHED_QUANTUM(level)	(1U << (level))
+#define SCHED_AGE_HARDCLOCKS	50
+
+/*
+ * A thread that ran this recently (in hardclocks) probably still has
+ * its cache contents, so idle CPUs prefer not to steal it.
+ */
+#define STEAL_HOT_HARDCLOCKS	2
+
 
 
 /* Master array of CPUs. */
@@ -63,6 +79,9 @@ DEFARRAY(cpu, static __UNUSED inline);
 static struct cpuarray allcpus;
 unsigned num_cpus;
 
+/* Cache for thread structures. */
+static struct kmem_cache *thread_cache;
+
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
@@ -71,6 +90,10 @@ unsigned thread_count = 0;
 static struct spinlock thread_count_lock = SPINLOCK_INITIALIZER;
 static struct wchan *thread_count_wchan;
 
+/* Load balancing; see below. */
+static struct thread *thread_steal(void);
+static void thread_poke_idle(struct cpu *c);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -110,6 +133,38 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Constructor and destructor for thread_cache. A thread structure in
+ * the cache keeps its stack, if it had one, for the next thread to
+ * use; and thread_destroy leaves the fields set up here as it found
+ * them.
+ */
+static
+int
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	thread_machdep_init(&thread->t_machdep);
+	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_stack = NULL;
+	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
+	return 0;
+}
+
+static
+void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	if (thread->t_stack != NULL) {
+		kfree(thread->t_stack);
+	}
+	threadlistnode_cleanup(&thread->t_listnode);
+	thread_machdep_cleanup(&thread->t_machdep);
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -125,7 +180,7 @@ thread_create(const char *name)
 		return NULL;
 	}
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
@@ -134,14 +189,17 @@ thread_create(const char *name)
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
-	/* Thread subsystem fields */
-	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
+	/* Thread subsystem fields (the rest are set up by thread_ctor) */
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
-	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
+
+	/* Scheduler fields; new threads start at the top */
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_readytime = 0;
+	thread->t_lastran = 0;
+	thread->t_background = false;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -167,6 +225,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -180,15 +239,35 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_nexttick = 0;
+	c->c_nexttimer = 0;
+	c->c_tickless = false;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
+	spinlock_initkind(&c->c_runqueue_lock, SPINLOCK_TICKET);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_all = false;
+	c->c_shootdown_sent = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
+	for (i=0; i<SPINLOCK_MCSNODES; i++) {
+		c->c_mcsnodes[i].mn_next = NULL;
+		c->c_mcsnodes[i].mn_wait = 0;
+		c->c_mcsnodes[i].mn_inuse = false;
+	}
+
+	c->c_callwheel = callwheel_create();
+	if (c->c_callwheel == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
@@ -211,7 +290,9 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		if (c->c_curthread->t_stack == NULL) {
+			c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		}
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
 		}
@@ -271,18 +352,19 @@ thread_destroy(struct thread *thread)
 	KASSERT(thread != curthread);
 	KASSERT(thread->t_state != S_RUN);
 
-	/* Thread subsystem fields */
+	/*
+	 * Thread subsystem fields. The stack goes back to the cache
+	 * with the thread structure, so check it's still intact.
+	 */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
+	thread_checkstack(thread);
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
 }
 
 /*
@@ -312,6 +394,9 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	struct threadlist *tl;
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -326,9 +411,13 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		tl = &curcpu->c_runqueue[i];
+		tl->tl_count = 0;
+		tl->tl_head.tln_next = &tl->tl_tail;
+		tl->tl_tail.tln_prev = &tl->tl_head;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -371,6 +460,12 @@ thread_bootstrap(void)
 {
 	cpuarray_init(&allcpus);
 
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 thread_ctor, thread_dtor);
+	if (thread_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -451,10 +546,92 @@ thread_start_cpus(void)
 	thread_count = 1;
 }
 
+/*
+ * Run queue operations. Each CPU has a queue for each priority level;
+ * the caller must hold the CPU's run queue lock.
+ */
+
+/*
+ * Put T on the tail of the queue for its level.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_priority < SCHED_NLEVELS);
+
+	t->t_readytime = c->c_hardclocks;
+	threadlist_addtail(&c->c_runqueue[t->t_priority], t);
+	c->c_runcount++;
+}
+
+/*
+ * Get the highest nonempty level, or SCHED_NLEVELS if none.
+ */
+static
+unsigned
+runqueue_best(struct cpu *c)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * Take the next thread to run: the first one at the highest level.
+ */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	unsigned level;
+
+	level = runqueue_best(c);
+	if (level == SCHED_NLEVELS) {
+		return NULL;
+	}
+	c->c_runcount--;
+	return threadlist_remhead(&c->c_runqueue[level]);
+}
+
+/*
+ * Take the thread that would run last: the last one at the lowest
+ * nonempty level.
+ */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=SCHED_NLEVELS; i-- > 0; ) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			c->c_runcount--;
+			return threadlist_remtail(&c->c_runqueue[i]);
+		}
+	}
+	return NULL;
+}
+
 /*
  * Make a thread runnable.
  *
  * targetcpu might be curcpu; it might not be, too.
+ *
+ * A thread that was asleep goes to the top level with a fresh
+ * quantum, so threads that mostly wait for things (I/O, the console,
+ * other threads) get the CPU as soon as they're woken. Background
+ * threads stay where they are.
  */
 static
 void
@@ -473,9 +650,14 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
+	if (target->t_state == S_SLEEP && !target->t_background) {
+		target->t_priority = 0;
+		target->t_ticks = 0;
+	}
+
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -484,6 +666,10 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (!targetcpu->c_isidle) {
+		/* It'll have to wait; maybe someone else can run it. */
+		thread_poke_idle(targetcpu);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -514,11 +700,13 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	/* Allocate a stack, unless the thread structure came with one */
 	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -535,7 +723,7 @@ thread_fork(const char *name,
 	}
 	result = proc_addthread(proc, newthread);
 	if (result) {
-		/* thread_destroy will clean up the stack */
+		/* thread_destroy will take care of the stack */
 		thread_destroy(newthread);
 		return result;
 	}
@@ -575,7 +763,7 @@ static
 void
 thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
-	struct thread *cur, *next;
+	struct thread *cur, *next, *stolen;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -601,13 +789,21 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. When
+	 * yielding, that includes when everything waiting is at a
+	 * lower level; we'd just be picked again.
+	 */
+	if (newstate == S_READY &&
+	    runqueue_best(curcpu) > cur->t_priority) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+	/* Note when it last ran, for thread_steal. */
+	cur->t_lastran = curcpu->c_hardclocks;
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -636,10 +832,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call cpu_idle().
+	 * Get the next thread. While there isn't one, try to steal
+	 * one from another cpu, and failing that call cpu_idle().
 	 * curcpu->c_isidle must be true when cpu_idle is
-	 * called. Unlock the runqueue while idling too, to make sure
-	 * things can be added to it.
+	 * called. Unlock the runqueue while stealing and idling too,
+	 * to avoid lock order trouble with other cpus' runqueues and
+	 * to make sure things can be added to it.
 	 *
 	 * Note that we don't need to unlock the runqueue atomically
 	 * with idling; becoming unidle requires receiving an
@@ -647,6 +845,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * interrupt from another cpu posting a wakeup) and idling
 	 * *is* atomic with respect to re-enabling interrupts.
 	 *
+	 * Hardclock has nothing to do while we're idle, so it's
+	 * suspended, leaving the timer only to callouts.
+	 *
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
@@ -655,11 +856,19 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			stolen = thread_steal();
+			if (stolen == NULL) {
+				hardclock_suspend();
+				cpu_idle();
+				hardclock_resume();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
+			if (stolen != NULL) {
+				runqueue_add(curcpu, stolen);
+			}
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
@@ -843,139 +1052,209 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Each CPU's run queue is a multilevel feedback queue: there are
+ * SCHED_NLEVELS levels, each run round-robin, and a thread only runs
+ * when nothing is waiting at a higher level. A thread's quantum
+ * doubles with each level down. A thread that uses up its whole
+ * quantum is moved down a level, so CPU-bound threads sink; one that
+ * sleeps goes back to the top when it wakes up (see
+ * thread_make_runnable), so interactive and I/O-bound threads stay
+ * near it.
+ *
+ * To keep the CPU-bound threads at the bottom from starving, a thread
+ * that has waited SCHED_AGE_HARDCLOCKS at some level is moved up one.
+ * Background threads (see thread_setbackground) are the exception:
+ * they never leave the bottom level.
  */
 
 void
-schedule(void)
+thread_setbackground(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct thread *cur = curthread;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	cur->t_background = true;
+	cur->t_priority = SCHED_NLEVELS - 1;
+	cur->t_ticks = 0;
+	spinlock_release(&curcpu->c_runqueue_lock);
 }
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * Called on every hardclock: charge the current thread for the tick,
+ * and preempt it if its quantum is up or something at a higher level
+ * is waiting.
  */
 void
-thread_consider_migration(void)
+thread_tick(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	struct thread *cur = curthread;
+	bool preempt;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
-		}
-		spinlock_release(&c->c_runqueue_lock);
+	if (curcpu->c_isidle) {
+		/* Nothing is running to charge. */
+		return;
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
+	cur->t_ticks++;
+	if (cur->t_ticks >= SCHED_QUANTUM(cur->t_priority)) {
+		cur->t_ticks = 0;
+		if (cur->t_priority < SCHED_NLEVELS - 1) {
+			cur->t_priority++;
+		}
+		thread_yield();
 		return;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	preempt = runqueue_best(curcpu) < cur->t_priority;
+	spinlock_release(&curcpu->c_runqueue_lock);
+	if (preempt) {
+		thread_yield();
+	}
+}
+
+/*
+ * This is called periodically from hardclock(). Age the run queue:
+ * move threads that have been waiting too long up a level. Queues are
+ * in order of arrival, so only the front of each needs looking at.
+ */
+void
+schedule(void)
+{
+	struct thread *t;
+	unsigned level, now;
+
+	now = curcpu->c_hardclocks;
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (level = 1; level < SCHED_NLEVELS; level++) {
+		while (!threadlist_isempty(&curcpu->c_runqueue[level])) {
+			t = curcpu->c_runqueue[level].tl_head.tln_next->tln_self;
+			if (now - t->t_readytime < SCHED_AGE_HARDCLOCKS) {
+				break;
+			}
+			threadlist_remhead(&curcpu->c_runqueue[level]);
+			curcpu->c_runcount--;
+			if (!t->t_background) {
+				t->t_priority = level - 1;
+				t->t_ticks = 0;
+			}
+			/* (background threads just go to the back) */
+			runqueue_add(curcpu, t);
+		}
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
+}
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
+/*
+ * Load balancing by work stealing.
+ *
+ * A CPU with nothing to run, before it idles, looks for the peer with
+ * the most threads waiting and takes one from the back of its queue:
+ * the thread at the lowest level that arrived last, which would have
+ * waited longest there. Busy CPUs never spend time on balancing, and
+ * an idle CPU picks up work as soon as there is some, because queueing
+ * a thread on a busy CPU pokes an idle one (thread_poke_idle).
+ *
+ * Moving a thread costs it its cache contents, so threads that ran
+ * within the last STEAL_HOT_HARDCLOCKS ticks are left alone if there
+ * is anything else to take, and even then only if the peer has more
+ * than one thread waiting; a lone hot thread will get its turn there
+ * soon enough. (The hardclock counts of different CPUs are close but
+ * not equal, which is fine for this.)
+ */
+
+/*
+ * Try to steal a thread for the current CPU. Returns it, with t_cpu
+ * already changed, or NULL. The caller must not hold its own run
+ * queue lock.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t, *pick, *fallback;
+	unsigned i, level, numcpus, most, now;
+
+	/*
+	 * Find the busiest peer that isn't about to run its threads
+	 * itself. The counts are only hints.
+	 */
+	victim = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
+		if (c != curcpu->c_self && !c->c_isidle &&
+		    c->c_runcount > most) {
+			victim = c;
+			most = c->c_runcount;
 		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	now = victim->c_hardclocks;
+	pick = fallback = NULL;
+	spinlock_acquire(&victim->c_runqueue_lock);
+	for (level = SCHED_NLEVELS; level-- > 0 && pick == NULL; ) {
+		THREADLIST_FORALL_REV(t, victim->c_runqueue[level]) {
 			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
+			 * The victim's curthread can be on its run
+			 * queue if it went to sleep and was woken up
+			 * while the victim was idle on its stack;
+			 * don't touch it. (See thread_switch.)
 			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
+			if (t == victim->c_curthread) {
 				continue;
 			}
-
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
+			if (now - t->t_lastran >= STEAL_HOT_HARDCLOCKS) {
+				pick = t;
+				break;
+			}
+			if (fallback == NULL) {
+				fallback = t;
 			}
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
+	if (pick == NULL && victim->c_runcount > 1) {
+		pick = fallback;
+	}
+	if (pick != NULL) {
+		threadlist_remove(&victim->c_runqueue[pick->t_priority], pick);
+		victim->c_runcount--;
+		pick->t_cpu = curcpu->c_self;
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u\n",
+		      pick->t_name, victim->c_number, curcpu->c_number);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+	return pick;
+}
+
+/*
+ * A thread was just queued on C, which is busy. Wake up an idle CPU,
+ * if there is one, to come and steal it. C's run queue lock is held.
+ */
+static
+void
+thread_poke_idle(struct cpu *c)
+{
+	struct cpu *other;
+	unsigned i, numcpus;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		other = cpuarray_get(&allcpus, i);
+		/* c_isidle is only a hint without the lock. */
+		if (other != c && other != curcpu->c_self && other->c_isidle) {
+			ipi_send(other, IPI_UNIDLE);
+			return;
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
 	}
-
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
 }
 
 ////////////////////////////////////////////////////////////
@@ -1157,6 +1436,10 @@ ipi_broadcast(int code)
 
 /*
  * Send a TLB shootdown IPI to the specified CPU.
+ *
+ * If the target's queue is full, the queued requests are coalesced
+ * into a flush of its whole TLB, which covers them all. If an IPI is
+ * already on its way there, we don't send another.
  */
 void
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
@@ -1166,29 +1449,54 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_acquire(&target->c_ipi_lock);
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
-		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
+	if (target->c_shootdown_all) {
+		/* Already flushing everything. */
+	}
+	else if (n == TLBSHOOTDOWN_MAX) {
+		target->c_shootdown_all = true;
+		target->c_numshootdown = 0;
 	}
 	else {
 		target->c_shootdown[n] = *mapping;
 		target->c_numshootdown = n+1;
 	}
+	target->c_shootdown_sent++;
 
+	if (target->c_ipi_pending == 0) {
+		mainbus_send_ipi(target);
+	}
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
-	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Wait until the target CPU has done every shootdown sent to it up
+ * to now. Later ones may get done in the same batch, but we don't
+ * wait for them. Shootdowns are quick, so we spin. We must be able to take
+ * interrupts while doing so, or two CPUs shooting each other down
+ * would wait for each other forever.
+ */
+void
+ipi_tlbshootdown_wait(struct cpu *target)
+{
+	unsigned ticket;
+	bool done;
+
+	KASSERT(curthread->t_curspl == 0);
+
+	spinlock_acquire(&target->c_ipi_lock);
+	ticket = target->c_shootdown_sent;
+	spinlock_release(&target->c_ipi_lock);
+
+	do {
+		spinlock_acquire(&target->c_ipi_lock);
+		/* Compare this way so the counters can wrap. */
+		done = (int)(target->c_shootdown_done - ticket) >= 0;
+		spinlock_release(&target->c_ipi_lock);
+	} while (!done);
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -1225,14 +1533,23 @@ interprocessor_interrupt(void)
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
-		 * Note: depending on your VM system locking you might
-		 * need to release the ipi lock while calling
-		 * vm_tlbshootdown.
+		 * Carry out the requests in place, under the ipi
+		 * lock, rather than copying the queue onto the
+		 * interrupt stack. They're quick; senders just spin
+		 * for a moment. Everything sent up to now is in this
+		 * batch.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		if (curcpu->c_shootdown_all) {
+			vm_tlbshootdown_all();
+		}
+		else {
+			for (i=0; i<curcpu->c_numshootdown; i++) {
+				vm_tlbshootdown(&curcpu->c_shootdown[i]);
+			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_all = false;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_sent;
 	}
 
 	curcpu->c_ipi_pending = 0;
@@ -0,0 +1,861 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * File system buffer cache.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <current.h>
+#include <thread.h>
+#include <fs.h>
+#include <buf.h>
+
+/*
+ * Tuning constants.
+ *
+ * BUFFER_MAXBUFS is the most buffers we'll ever allocate; they're
+ * created on demand up to this limit and then recycled.
+ * BUFFER_HASHSIZE is the number of hash chains; it should be a
+ * power of 2. BUFFER_RAQUEUE is the most read-ahead requests that
+ * can be pending at once. BUFFER_RATHREADS is the number of read-ahead
+ * threads, and so the most read-ahead reads that can be in flight at
+ * once; having several lets the disk scheduler sort and merge them.
+ */
+#define BUFFER_MAXBUFS	128
+#define BUFFER_HASHSIZE	64
+#define BUFFER_RAQUEUE	32
+#define BUFFER_RATHREADS 4
+
+/*
+ * One buffer.
+ *
+ * A buffer whose b_fs is NULL doesn't hold any block and isn't on a
+ * hash chain. A buffer is on the LRU list if and only if it is not
+ * busy; the head of the list is the next to be recycled.
+ */
+struct buf {
+	struct fs *b_fs;		/* file system, or NULL */
+	daddr_t b_block;		/* block number on b_fs */
+	void *b_data;			/* BUFFER_SIZE bytes */
+	bool b_valid;			/* b_data holds the block contents */
+	bool b_dirty;			/* b_data needs writing back */
+	bool b_busy;			/* held by some thread */
+	struct thread *b_holder;	/* the thread holding it */
+	struct buf *b_hashnext;		/* next on hash chain */
+	struct buf *b_lruprev;		/* LRU list linkage */
+	struct buf *b_lrunext;
+};
+
+/*
+ * Global state. All of this is protected by buffer_lock. Threads
+ * waiting for a busy buffer, or for any buffer to become free, wait
+ * on buffer_cv.
+ */
+static struct lock *buffer_lock;
+static struct cv *buffer_cv;
+
+static struct buf *buffer_all[BUFFER_MAXBUFS];
+static unsigned buffer_num;
+
+static struct buf *buffer_hash[BUFFER_HASHSIZE];
+static struct buf *buffer_lruhead;
+static struct buf *buffer_lrutail;
+
+/*
+ * Read-ahead requests, in a circular queue, also protected by
+ * buffer_lock. The read-ahead threads wait on buffer_racv for work.
+ * While read-ahead thread N is reading a block it sets buffer_rafs[N],
+ * so unmount can wait for them all to be done with the file system.
+ */
+static struct {
+	struct fs *fs;
+	daddr_t block;
+} buffer_raqueue[BUFFER_RAQUEUE];
+static unsigned buffer_rahead, buffer_racount;
+static struct cv *buffer_racv;
+static struct fs *buffer_rafs[BUFFER_RATHREADS];
+
+static struct {
+	unsigned long hits;		/* found in cache */
+	unsigned long misses;		/* not found in cache */
+	unsigned long reads;		/* device reads */
+	unsigned long writes;		/* device writes */
+	unsigned long evictions;	/* valid buffers recycled */
+	unsigned long raqueued;		/* read-ahead requests queued */
+	unsigned long radone;		/* read-ahead blocks read */
+	unsigned long rafull;		/* read-ahead requests refused */
+} buffer_stats;
+
+static void buffer_readahead_thread(void *, unsigned long);
+
+/*
+ * Setup function.
+ */
+void
+buffer_bootstrap(void)
+{
+	unsigned i;
+	int result;
+
+	buffer_lock = lock_create("buffer cache");
+	if (buffer_lock == NULL) {
+		panic("buffer_bootstrap: Could not create lock\n");
+	}
+	buffer_cv = cv_create("buffer cache");
+	if (buffer_cv == NULL) {
+		panic("buffer_bootstrap: Could not create cv\n");
+	}
+	buffer_racv = cv_create("buffer read-ahead");
+	if (buffer_racv == NULL) {
+		panic("buffer_bootstrap: Could not create cv\n");
+	}
+	for (i=0; i<BUFFER_RATHREADS; i++) {
+		result = thread_fork("buffer read-ahead", NULL,
+				     buffer_readahead_thread, NULL, i);
+		if (result) {
+			panic("buffer_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// hash table and LRU list
+
+static
+unsigned
+buffer_hashfn(struct fs *fs, daddr_t block)
+{
+	uintptr_t val;
+
+	val = ((uintptr_t)fs >> 4) ^ (block * 2654435761U);
+	return (val ^ (val >> 16)) & (BUFFER_HASHSIZE - 1);
+}
+
+static
+struct buf *
+buffer_find(struct fs *fs, daddr_t block)
+{
+	struct buf *b;
+
+	for (b = buffer_hash[buffer_hashfn(fs, block)];
+	     b != NULL;
+	     b = b->b_hashnext) {
+		if (b->b_fs == fs && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+buffer_hash_insert(struct buf *b)
+{
+	unsigned h;
+
+	h = buffer_hashfn(b->b_fs, b->b_block);
+	b->b_hashnext = buffer_hash[h];
+	buffer_hash[h] = b;
+}
+
+static
+void
+buffer_hash_remove(struct buf *b)
+{
+	struct buf **pp;
+
+	pp = &buffer_hash[buffer_hashfn(b->b_fs, b->b_block)];
+	while (*pp != b) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->b_hashnext;
+	}
+	*pp = b->b_hashnext;
+	b->b_hashnext = NULL;
+}
+
+static
+void
+buffer_lru_remove(struct buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		KASSERT(buffer_lruhead == b);
+		buffer_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		KASSERT(buffer_lrutail == b);
+		buffer_lrutail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+/* Put B at the most-recently-used end of the list. */
+static
+void
+buffer_lru_append(struct buf *b)
+{
+	b->b_lrunext = NULL;
+	b->b_lruprev = buffer_lrutail;
+	if (buffer_lrutail != NULL) {
+		buffer_lrutail->b_lrunext = b;
+	}
+	else {
+		buffer_lruhead = b;
+	}
+	buffer_lrutail = b;
+}
+
+/* Put B at the recycle-next end of the list. */
+static
+void
+buffer_lru_prepend(struct buf *b)
+{
+	b->b_lruprev = NULL;
+	b->b_lrunext = buffer_lruhead;
+	if (buffer_lruhead != NULL) {
+		buffer_lruhead->b_lruprev = b;
+	}
+	else {
+		buffer_lrutail = b;
+	}
+	buffer_lruhead = b;
+}
+
+/*
+ * Forget what block B holds. It must not be busy, or be busy and
+ * held by us.
+ */
+static
+void
+buffer_detach(struct buf *b)
+{
+	if (b->b_fs != NULL) {
+		buffer_hash_remove(b);
+		b->b_fs = NULL;
+	}
+	b->b_block = 0;
+	b->b_valid = false;
+	b->b_dirty = false;
+}
+
+////////////////////////////////////////////////////////////
+// getting and releasing buffers
+
+/*
+ * Mark B busy and held by the current thread. It must be on the LRU
+ * list.
+ */
+static
+void
+buffer_mark_busy(struct buf *b)
+{
+	KASSERT(lock_do_i_hold(buffer_lock));
+	KASSERT(!b->b_busy);
+
+	buffer_lru_remove(b);
+	b->b_busy = true;
+	b->b_holder = curthread;
+}
+
+/*
+ * Write a busy buffer back to disk. Must be called without
+ * buffer_lock held, as we sleep for the I/O.
+ */
+static
+int
+buffer_writeout(struct buf *b)
+{
+	int result;
+
+	KASSERT(b->b_busy);
+	KASSERT(b->b_holder == curthread);
+	KASSERT(b->b_fs != NULL);
+	KASSERT(b->b_valid);
+	KASSERT(b->b_dirty);
+
+	result = FSOP_WRITEBLOCK(b->b_fs, b->b_block, b->b_data, BUFFER_SIZE);
+	if (result) {
+		return result;
+	}
+	b->b_dirty = false;
+	return 0;
+}
+
+/*
+ * Allocate a new buffer, if we haven't hit the limit yet.
+ */
+static
+struct buf *
+buffer_create(void)
+{
+	struct buf *b;
+
+	if (buffer_num >= BUFFER_MAXBUFS) {
+		return NULL;
+	}
+
+	b = kmalloc(sizeof(*b));
+	if (b == NULL) {
+		return NULL;
+	}
+	b->b_data = kmalloc(BUFFER_SIZE);
+	if (b->b_data == NULL) {
+		kfree(b);
+		return NULL;
+	}
+	b->b_fs = NULL;
+	b->b_block = 0;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_busy = false;
+	b->b_holder = NULL;
+	b->b_hashnext = NULL;
+	b->b_lruprev = b->b_lrunext = NULL;
+
+	buffer_all[buffer_num++] = b;
+	return b;
+}
+
+/*
+ * Get a buffer to reuse. Returns it busy, held by us, and not
+ * holding any block. May sleep (and release buffer_lock) to write
+ * back a dirty buffer or to wait for a buffer to come free.
+ */
+static
+int
+buffer_getfree(struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	while (1) {
+		/* Use an unused buffer first, then try making a new one. */
+		b = buffer_lruhead;
+		if (b == NULL || b->b_fs != NULL) {
+			b = buffer_create();
+			if (b != NULL) {
+				b->b_busy = true;
+				b->b_holder = curthread;
+				*ret = b;
+				return 0;
+			}
+			b = buffer_lruhead;
+		}
+		if (b == NULL) {
+			/* Everything is in use; wait. */
+			cv_wait(buffer_cv, buffer_lock);
+			continue;
+		}
+
+		buffer_mark_busy(b);
+
+		if (b->b_dirty) {
+			lock_release(buffer_lock);
+			result = buffer_writeout(b);
+			lock_acquire(buffer_lock);
+			buffer_stats.writes++;
+			if (result) {
+				/* Leave it dirty and let the caller fail. */
+				b->b_busy = false;
+				b->b_holder = NULL;
+				buffer_lru_append(b);
+				cv_broadcast(buffer_cv, buffer_lock);
+				return result;
+			}
+		}
+
+		if (b->b_fs != NULL) {
+			buffer_stats.evictions++;
+		}
+		buffer_detach(b);
+
+		/* Anyone who was waiting for the old block must look again. */
+		cv_broadcast(buffer_cv, buffer_lock);
+
+		*ret = b;
+		return 0;
+	}
+}
+
+/*
+ * Common code for buffer_read and buffer_get.
+ */
+static
+int
+buffer_acquire(struct fs *fs, daddr_t block, bool doread, struct buf **ret)
+{
+	struct buf *b;
+	int result;
+
+	KASSERT(fs != NULL);
+
+	lock_acquire(buffer_lock);
+ again:
+	b = buffer_find(fs, block);
+	if (b != NULL) {
+		if (b->b_busy) {
+			KASSERT(b->b_holder != curthread);
+			cv_wait(buffer_cv, buffer_lock);
+			goto again;
+		}
+		buffer_mark_busy(b);
+		buffer_stats.hits++;
+	}
+	else {
+		result = buffer_getfree(&b);
+		if (result) {
+			lock_release(buffer_lock);
+			return result;
+		}
+
+		/*
+		 * We may have slept; if someone else loaded the block
+		 * meanwhile, give our buffer back and use theirs.
+		 */
+		if (buffer_find(fs, block) != NULL) {
+			b->b_busy = false;
+			b->b_holder = NULL;
+			buffer_lru_prepend(b);
+			goto again;
+		}
+
+		b->b_fs = fs;
+		b->b_block = block;
+		buffer_hash_insert(b);
+		buffer_stats.misses++;
+	}
+
+	if (doread && !b->b_valid) {
+		buffer_stats.reads++;
+	}
+	lock_release(buffer_lock);
+
+	if (doread && !b->b_valid) {
+		result = FSOP_READBLOCK(fs, block, b->b_data, BUFFER_SIZE);
+		if (result) {
+			buffer_release_and_invalidate(b);
+			return result;
+		}
+		b->b_valid = true;
+	}
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get a buffer and make sure it holds the block's contents.
+ */
+int
+buffer_read(struct fs *fs, daddr_t block, struct buf **ret)
+{
+	return buffer_acquire(fs, block, true, ret);
+}
+
+/*
+ * Get a buffer, for the purpose of overwriting all of it.
+ */
+int
+buffer_get(struct fs *fs, daddr_t block, struct buf **ret)
+{
+	return buffer_acquire(fs, block, false, ret);
+}
+
+void *
+buffer_map(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_data;
+}
+
+bool
+buffer_is_valid(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	return b->b_valid;
+}
+
+void
+buffer_mark_valid(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	b->b_valid = true;
+}
+
+void
+buffer_mark_dirty(struct buf *b)
+{
+	KASSERT(b->b_busy);
+	b->b_valid = true;
+	b->b_dirty = true;
+}
+
+/*
+ * Give a buffer back. Valid buffers go on the recently-used end of
+ * the LRU list; buffers whose contents were never filled in are
+ * forgotten and queued for immediate reuse.
+ */
+void
+buffer_release(struct buf *b)
+{
+	lock_acquire(buffer_lock);
+
+	KASSERT(b->b_busy);
+	KASSERT(b->b_holder == curthread);
+
+	b->b_busy = false;
+	b->b_holder = NULL;
+	if (b->b_valid) {
+		buffer_lru_append(b);
+	}
+	else {
+		buffer_detach(b);
+		buffer_lru_prepend(b);
+	}
+	cv_broadcast(buffer_cv, buffer_lock);
+
+	lock_release(buffer_lock);
+}
+
+void
+buffer_release_and_invalidate(struct buf *b)
+{
+	KASSERT(b->b_busy);
+
+	b->b_valid = false;
+	b->b_dirty = false;
+	buffer_release(b);
+}
+
+////////////////////////////////////////////////////////////
+// read-ahead
+
+/*
+ * Queue a block to be read in the background. Requests for blocks
+ * that are already cached or already queued are dropped.
+ */
+bool
+buffer_readahead(struct fs *fs, daddr_t block)
+{
+	unsigned i;
+	bool ret = true;
+
+	KASSERT(fs != NULL);
+
+	lock_acquire(buffer_lock);
+	if (buffer_find(fs, block) != NULL) {
+		goto done;
+	}
+	for (i=0; i<buffer_racount; i++) {
+		unsigned pos = (buffer_rahead + i) % BUFFER_RAQUEUE;
+		if (buffer_raqueue[pos].fs == fs &&
+		    buffer_raqueue[pos].block == block) {
+			goto done;
+		}
+	}
+	if (buffer_racount == BUFFER_RAQUEUE) {
+		buffer_stats.rafull++;
+		ret = false;
+		goto done;
+	}
+	i = (buffer_rahead + buffer_racount) % BUFFER_RAQUEUE;
+	buffer_raqueue[i].fs = fs;
+	buffer_raqueue[i].block = block;
+	buffer_racount++;
+	buffer_stats.raqueued++;
+	cv_signal(buffer_racv, buffer_lock);
+ done:
+	lock_release(buffer_lock);
+	return ret;
+}
+
+/*
+ * A read-ahead thread; DATA2 is its number. Takes blocks off the
+ * queue and loads them into the cache like any other read, then lets
+ * them go. Errors are ignored; whoever actually wants the block will
+ * get them.
+ */
+static
+void
+buffer_readahead_thread(void *data1, unsigned long data2)
+{
+	unsigned me = data2;
+	struct fs *fs;
+	daddr_t block;
+	struct buf *b;
+	int result;
+
+	(void)data1;
+	KASSERT(me < BUFFER_RATHREADS);
+
+	lock_acquire(buffer_lock);
+	while (1) {
+		while (buffer_racount == 0) {
+			cv_wait(buffer_racv, buffer_lock);
+		}
+		fs = buffer_raqueue[buffer_rahead].fs;
+		block = buffer_raqueue[buffer_rahead].block;
+		buffer_rahead = (buffer_rahead + 1) % BUFFER_RAQUEUE;
+		buffer_racount--;
+
+		if (buffer_find(fs, block) != NULL) {
+			continue;
+		}
+
+		buffer_rafs[me] = fs;
+		lock_release(buffer_lock);
+
+		result = buffer_read(fs, block, &b);
+		if (result == 0) {
+			buffer_release(b);
+		}
+
+		lock_acquire(buffer_lock);
+		if (result == 0) {
+			buffer_stats.radone++;
+		}
+		buffer_rafs[me] = NULL;
+		cv_broadcast(buffer_cv, buffer_lock);
+	}
+}
+
+/*
+ * Drop pending read-ahead for FS, and wait until none of the
+ * read-ahead threads are working on it.
+ */
+static
+void
+buffer_readahead_cancel(struct fs *fs)
+{
+	unsigned i, n, from, to;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+
+	n = buffer_racount;
+	for (i=0, to=0; i<n; i++) {
+		from = (buffer_rahead + i) % BUFFER_RAQUEUE;
+		if (buffer_raqueue[from].fs == fs) {
+			buffer_racount--;
+			continue;
+		}
+		buffer_raqueue[(buffer_rahead + to) % BUFFER_RAQUEUE] =
+			buffer_raqueue[from];
+		to++;
+	}
+
+	for (i=0; i<BUFFER_RATHREADS; i++) {
+		while (buffer_rafs[i] == fs) {
+			cv_wait(buffer_cv, buffer_lock);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// whole-cache operations
+
+/*
+ * Discard the cached copy of a block, if any, without writing it.
+ */
+void
+buffer_drop(struct fs *fs, daddr_t block)
+{
+	struct buf *b;
+
+	lock_acquire(buffer_lock);
+	while (1) {
+		b = buffer_find(fs, block);
+		if (b == NULL) {
+			break;
+		}
+		if (b->b_busy) {
+			KASSERT(b->b_holder != curthread);
+			cv_wait(buffer_cv, buffer_lock);
+			continue;
+		}
+		buffer_lru_remove(b);
+		buffer_detach(b);
+		buffer_lru_prepend(b);
+		break;
+	}
+	lock_release(buffer_lock);
+}
+
+/*
+ * Write back B, which is dirty and not busy. Called with buffer_lock
+ * held; releases it during the I/O.
+ */
+static
+int
+buffer_syncone(struct buf *b)
+{
+	int result;
+
+	KASSERT(lock_do_i_hold(buffer_lock));
+	KASSERT(b->b_dirty);
+
+	buffer_mark_busy(b);
+	lock_release(buffer_lock);
+
+	result = buffer_writeout(b);
+
+	lock_acquire(buffer_lock);
+	buffer_stats.writes++;
+	b->b_busy = false;
+	b->b_holder = NULL;
+	buffer_lru_append(b);
+	cv_broadcast(buffer_cv, buffer_lock);
+
+	return result;
+}
+
+/*
+ * Write back the cached copy of a block, if it's dirty. If someone
+ * is using it, wait until they're done, since they may be changing
+ * it.
+ */
+int
+buffer_sync(struct fs *fs, daddr_t block)
+{
+	struct buf *b;
+	int result = 0;
+
+	lock_acquire(buffer_lock);
+	while (1) {
+		b = buffer_find(fs, block);
+		if (b == NULL || !b->b_busy) {
+			break;
+		}
+		KASSERT(b->b_holder != curthread);
+		cv_wait(buffer_cv, buffer_lock);
+	}
+	if (b != NULL && b->b_dirty) {
+		result = buffer_syncone(b);
+	}
+	lock_release(buffer_lock);
+
+	return result;
+}
+
+/*
+ * Write back all dirty buffers for FS. Buffers that are busy are
+ * waited for, since whoever holds them may be about to dirty them,
+ * except for any the current thread holds itself.
+ */
+int
+sync_fs_buffers(struct fs *fs)
+{
+	struct buf *b;
+	unsigned i;
+	int result, ret = 0;
+
+	lock_acquire(buffer_lock);
+	for (i=0; i<buffer_num; i++) {
+		b = buffer_all[i];
+		while (b->b_fs == fs && b->b_busy &&
+		       b->b_holder != curthread) {
+			cv_wait(buffer_cv, buffer_lock);
+		}
+		if (b->b_fs != fs || !b->b_dirty || b->b_busy) {
+			continue;
+		}
+		result = buffer_syncone(b);
+		if (result && ret == 0) {
+			ret = result;
+		}
+	}
+	lock_release(buffer_lock);
+
+	return ret;
+}
+
+/*
+ * Forget all buffers for FS. It should have been synced already.
+ */
+void
+drop_fs_buffers(struct fs *fs)
+{
+	struct buf *b;
+	unsigned i;
+
+	lock_acquire(buffer_lock);
+	buffer_readahead_cancel(fs);
+	for (i=0; i<buffer_num; i++) {
+		b = buffer_all[i];
+		if (b->b_fs != fs) {
+			continue;
+		}
+		KASSERT(!b->b_busy);
+		KASSERT(!b->b_dirty);
+		buffer_lru_remove(b);
+		buffer_detach(b);
+		buffer_lru_prepend(b);
+	}
+	lock_release(buffer_lock);
+}
+
+/*
+ * Print statistics.
+ */
+void
+buffer_printstats(void)
+{
+	unsigned i, nvalid = 0, ndirty = 0;
+
+	lock_acquire(buffer_lock);
+	for (i=0; i<buffer_num; i++) {
+		if (buffer_all[i]->b_valid) {
+			nvalid++;
+		}
+		if (buffer_all[i]->b_dirty) {
+			ndirty++;
+		}
+	}
+	kprintf("Buffer cache: %u/%u buffers, %u valid, %u dirty\n",
+		buffer_num, BUFFER_MAXBUFS, nvalid, ndirty);
+	kprintf("    %lu hits, %lu misses, %lu evictions\n",
+		buffer_stats.hits, buffer_stats.misses,
+		buffer_stats.evictions);
+	kprintf("    %lu device reads, %lu device writes\n",
+		buffer_stats.reads, buffer_stats.writes);
+	kprintf("    %lu read-ahead queued, %lu read, %lu refused\n",
+		buffer_stats.raqueued, buffer_stats.radone,
+		buffer_stats.rafull);
+	lock_release(buffer_lock);
+}
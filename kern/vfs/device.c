@@ -40,6 +40,7 @@
 #include <lib.h>
 #include <uio.h>
 #include <synch.h>
+#include <vm.h>
 #include <vnode.h>
 #include <device.h>
 
@@ -237,15 +238,19 @@ null_fsync(struct vnode *v)
 }
 
 /*
- * For mmap. If you want this to do anything, you have to write it
- * yourself. Some devices may not make sense to map. Others do.
+ * For mmap. Block devices whose blocks fit evenly in a page can be
+ * mapped like files; character devices can't.
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v)
 {
-	(void)v;
-	return ENOSYS;
+	struct device *d = v->vn_data;
+
+	if (d->d_blocks == 0 || PAGE_SIZE % d->d_blocksize != 0) {
+		return ENODEV;
+	}
+	return 0;
 }
 
 /*
@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Disk request scheduler.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <disksched.h>
+
+/*
+ * Tuning constants.
+ *
+ * DISKSCHED_MAXRUN is the most sectors we'll merge into one run, so a
+ * long sequential stream can't hold the disk forever. The deadlines
+ * are how long (in milliseconds) a request may wait under the
+ * deadline policy before it jumps the queue.
+ */
+#define DISKSCHED_MAXRUN	128
+#define DISKSCHED_READ_MS	100
+#define DISKSCHED_WRITE_MS	1000
+
+/*
+ * One scheduler. Each pending run is on two doubly-linked lists: one
+ * sorted by starting sector and one in arrival order. Requests merged
+ * onto a run are on neither; they hang off the run's dr_mergenext.
+ *
+ * The statistics are read without the driver's lock when printed,
+ * so they may be slightly off.
+ */
+struct disksched {
+	char *ds_name;
+	struct dsreq *ds_sorthead;	/* Sector-order list */
+	struct dsreq *ds_sorttail;
+	struct dsreq *ds_fifohead;	/* Arrival-order list */
+	struct dsreq *ds_fifotail;
+	uint32_t ds_headpos;		/* Sector after the last run */
+	struct disksched *ds_next;	/* List of all schedulers */
+
+	/* Statistics */
+	unsigned long ds_nreqs;		/* Requests added */
+	unsigned long ds_nmerged;	/* ...of which merged into a run */
+	unsigned long ds_nruns;		/* Runs dispatched */
+	unsigned long ds_nexpired;	/* ...of which past their deadline */
+	uint64_t ds_seekdist;		/* Total sectors moved between runs */
+};
+
+/*
+ * Global state: the current policy and the list of all schedulers.
+ */
+static int disksched_policy = DISKSCHED_DEADLINE;
+static struct spinlock disksched_listlock = SPINLOCK_INITIALIZER;
+static struct disksched *disksched_list;
+
+////////////////////////////////////////////////////////////
+// List handling
+
+static
+void
+ds_sort_insert(struct disksched *ds, struct dsreq *prev, struct dsreq *dr)
+{
+	dr->dr_sortprev = prev;
+	dr->dr_sortnext = prev ? prev->dr_sortnext : ds->ds_sorthead;
+	if (dr->dr_sortprev != NULL) {
+		dr->dr_sortprev->dr_sortnext = dr;
+	}
+	else {
+		ds->ds_sorthead = dr;
+	}
+	if (dr->dr_sortnext != NULL) {
+		dr->dr_sortnext->dr_sortprev = dr;
+	}
+	else {
+		ds->ds_sorttail = dr;
+	}
+}
+
+static
+void
+ds_sort_remove(struct disksched *ds, struct dsreq *dr)
+{
+	if (dr->dr_sortprev != NULL) {
+		dr->dr_sortprev->dr_sortnext = dr->dr_sortnext;
+	}
+	else {
+		ds->ds_sorthead = dr->dr_sortnext;
+	}
+	if (dr->dr_sortnext != NULL) {
+		dr->dr_sortnext->dr_sortprev = dr->dr_sortprev;
+	}
+	else {
+		ds->ds_sorttail = dr->dr_sortprev;
+	}
+	dr->dr_sortprev = dr->dr_sortnext = NULL;
+}
+
+static
+void
+ds_fifo_insert(struct disksched *ds, struct dsreq *prev, struct dsreq *dr)
+{
+	dr->dr_fifoprev = prev;
+	dr->dr_fifonext = prev ? prev->dr_fifonext : ds->ds_fifohead;
+	if (dr->dr_fifoprev != NULL) {
+		dr->dr_fifoprev->dr_fifonext = dr;
+	}
+	else {
+		ds->ds_fifohead = dr;
+	}
+	if (dr->dr_fifonext != NULL) {
+		dr->dr_fifonext->dr_fifoprev = dr;
+	}
+	else {
+		ds->ds_fifotail = dr;
+	}
+}
+
+static
+void
+ds_fifo_remove(struct disksched *ds, struct dsreq *dr)
+{
+	if (dr->dr_fifoprev != NULL) {
+		dr->dr_fifoprev->dr_fifonext = dr->dr_fifonext;
+	}
+	else {
+		ds->ds_fifohead = dr->dr_fifonext;
+	}
+	if (dr->dr_fifonext != NULL) {
+		dr->dr_fifonext->dr_fifoprev = dr->dr_fifoprev;
+	}
+	else {
+		ds->ds_fifotail = dr->dr_fifoprev;
+	}
+	dr->dr_fifoprev = dr->dr_fifonext = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Merging
+
+/*
+ * Try to add DR to the end of run RUN. Returns true if it worked.
+ */
+static
+bool
+ds_backmerge(struct dsreq *run, struct dsreq *dr)
+{
+	struct dsreq *tail;
+
+	if (run->dr_iswrite != dr->dr_iswrite ||
+	    run->dr_sector + run->dr_runsect != dr->dr_sector ||
+	    run->dr_runsect + dr->dr_nsect > DISKSCHED_MAXRUN) {
+		return false;
+	}
+
+	for (tail = run; tail->dr_mergenext != NULL;
+	     tail = tail->dr_mergenext) {
+		/* nothing */
+	}
+	tail->dr_mergenext = dr;
+	run->dr_runsect += dr->dr_nsect;
+	return true;
+}
+
+/*
+ * Try to put DR in front of run RUN. DR takes RUN's place in the
+ * queues, and keeps RUN's (earlier) deadline. Returns true if it
+ * worked.
+ */
+static
+bool
+ds_frontmerge(struct disksched *ds, struct dsreq *run, struct dsreq *dr)
+{
+	struct dsreq *sortprev, *fifoprev;
+
+	if (run->dr_iswrite != dr->dr_iswrite ||
+	    dr->dr_sector + dr->dr_nsect != run->dr_sector ||
+	    run->dr_runsect + dr->dr_nsect > DISKSCHED_MAXRUN) {
+		return false;
+	}
+
+	sortprev = run->dr_sortprev;
+	fifoprev = run->dr_fifoprev;
+	ds_sort_remove(ds, run);
+	ds_fifo_remove(ds, run);
+
+	dr->dr_mergenext = run;
+	dr->dr_runsect = dr->dr_nsect + run->dr_runsect;
+	dr->dr_deadline = run->dr_deadline;
+	ds_sort_insert(ds, sortprev, dr);
+	ds_fifo_insert(ds, fifoprev, dr);
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+// Picking the next run
+
+/*
+ * Circular scan: the first run at or past the head, or if there is
+ * none, the lowest.
+ */
+static
+struct dsreq *
+ds_pick_cscan(struct disksched *ds)
+{
+	struct dsreq *dr;
+
+	for (dr = ds->ds_sorthead; dr != NULL; dr = dr->dr_sortnext) {
+		if (dr->dr_sector >= ds->ds_headpos) {
+			return dr;
+		}
+	}
+	return ds->ds_sorthead;
+}
+
+static
+bool
+ds_expired(const struct dsreq *dr, const struct timespec *now)
+{
+	if (dr->dr_deadline.tv_sec != now->tv_sec) {
+		return dr->dr_deadline.tv_sec < now->tv_sec;
+	}
+	return dr->dr_deadline.tv_nsec <= now->tv_nsec;
+}
+
+/*
+ * Deadline: the oldest expired run if there is one, else C-SCAN.
+ *
+ * Within each direction, deadlines are in arrival order, so we can
+ * stop looking once we've seen an unexpired read and an unexpired
+ * write.
+ */
+static
+struct dsreq *
+ds_pick_deadline(struct disksched *ds)
+{
+	struct timespec now;
+	struct dsreq *dr;
+	bool readok = false, writeok = false;
+
+	gettime(&now);
+	for (dr = ds->ds_fifohead; dr != NULL; dr = dr->dr_fifonext) {
+		if (ds_expired(dr, &now)) {
+			ds->ds_nexpired++;
+			return dr;
+		}
+		if (dr->dr_iswrite) {
+			writeok = true;
+		}
+		else {
+			readok = true;
+		}
+		if (readok && writeok) {
+			break;
+		}
+	}
+	return ds_pick_cscan(ds);
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+struct disksched *
+disksched_create(const char *name)
+{
+	struct disksched *ds;
+
+	ds = kmalloc(sizeof(*ds));
+	if (ds == NULL) {
+		return NULL;
+	}
+	ds->ds_name = kstrdup(name);
+	if (ds->ds_name == NULL) {
+		kfree(ds);
+		return NULL;
+	}
+	ds->ds_sorthead = ds->ds_sorttail = NULL;
+	ds->ds_fifohead = ds->ds_fifotail = NULL;
+	ds->ds_headpos = 0;
+	ds->ds_nreqs = 0;
+	ds->ds_nmerged = 0;
+	ds->ds_nruns = 0;
+	ds->ds_nexpired = 0;
+	ds->ds_seekdist = 0;
+
+	spinlock_acquire(&disksched_listlock);
+	ds->ds_next = disksched_list;
+	disksched_list = ds;
+	spinlock_release(&disksched_listlock);
+
+	return ds;
+}
+
+void
+disksched_destroy(struct disksched *ds)
+{
+	struct disksched **p;
+
+	KASSERT(ds->ds_sorthead == NULL);
+	KASSERT(ds->ds_fifohead == NULL);
+
+	spinlock_acquire(&disksched_listlock);
+	for (p = &disksched_list; *p != ds; p = &(*p)->ds_next) {
+		KASSERT(*p != NULL);
+	}
+	*p = ds->ds_next;
+	spinlock_release(&disksched_listlock);
+
+	kfree(ds->ds_name);
+	kfree(ds);
+}
+
+void
+disksched_add(struct disksched *ds, struct dsreq *dr)
+{
+	struct dsreq *prev;
+	struct timespec wait;
+
+	KASSERT(dr->dr_nsect > 0);
+
+	dr->dr_mergenext = NULL;
+	dr->dr_sortprev = dr->dr_sortnext = NULL;
+	dr->dr_fifoprev = dr->dr_fifonext = NULL;
+	dr->dr_runsect = dr->dr_nsect;
+	ds->ds_nreqs++;
+
+	/* Find the last run that starts at or before this request. */
+	for (prev = ds->ds_sorttail;
+	     prev != NULL && prev->dr_sector > dr->dr_sector;
+	     prev = prev->dr_sortprev) {
+		/* nothing */
+	}
+
+	/* Try merging onto the end of it, or onto the start of the next. */
+	if (prev != NULL && ds_backmerge(prev, dr)) {
+		ds->ds_nmerged++;
+		return;
+	}
+	if (prev != NULL && prev->dr_sortnext != NULL &&
+	    ds_frontmerge(ds, prev->dr_sortnext, dr)) {
+		ds->ds_nmerged++;
+		return;
+	}
+	if (prev == NULL && ds->ds_sorthead != NULL &&
+	    ds_frontmerge(ds, ds->ds_sorthead, dr)) {
+		ds->ds_nmerged++;
+		return;
+	}
+
+	/* No luck; it's a new run. */
+	gettime(&dr->dr_deadline);
+	wait.tv_sec = 0;
+	wait.tv_nsec = 1000000 *
+		(dr->dr_iswrite ? DISKSCHED_WRITE_MS : DISKSCHED_READ_MS);
+	while (wait.tv_nsec >= 1000000000) {
+		wait.tv_sec++;
+		wait.tv_nsec -= 1000000000;
+	}
+	timespec_add(&dr->dr_deadline, &wait, &dr->dr_deadline);
+
+	ds_sort_insert(ds, prev, dr);
+	ds_fifo_insert(ds, ds->ds_fifotail, dr);
+}
+
+struct dsreq *
+disksched_next(struct disksched *ds)
+{
+	struct dsreq *dr;
+
+	if (ds->ds_sorthead == NULL) {
+		return NULL;
+	}
+
+	switch (disksched_policy) {
+	    case DISKSCHED_FIFO:
+		dr = ds->ds_fifohead;
+		break;
+	    case DISKSCHED_CSCAN:
+		dr = ds_pick_cscan(ds);
+		break;
+	    case DISKSCHED_DEADLINE:
+	    default:
+		dr = ds_pick_deadline(ds);
+		break;
+	}
+	KASSERT(dr != NULL);
+
+	ds_sort_remove(ds, dr);
+	ds_fifo_remove(ds, dr);
+
+	ds->ds_nruns++;
+	if (dr->dr_sector >= ds->ds_headpos) {
+		ds->ds_seekdist += dr->dr_sector - ds->ds_headpos;
+	}
+	else {
+		ds->ds_seekdist += ds->ds_headpos - dr->dr_sector;
+	}
+	ds->ds_headpos = dr->dr_sector + dr->dr_runsect;
+
+	return dr;
+}
+
+bool
+disksched_isempty(struct disksched *ds)
+{
+	return ds->ds_sorthead == NULL;
+}
+
+void
+disksched_setpolicy(int policy)
+{
+	KASSERT(disksched_policyname(policy) != NULL);
+
+	/* An int store is atomic; drivers pick it up on their next run. */
+	disksched_policy = policy;
+}
+
+const char *
+disksched_policyname(int policy)
+{
+	switch (policy) {
+	    case DISKSCHED_FIFO: return "fifo";
+	    case DISKSCHED_CSCAN: return "cscan";
+	    case DISKSCHED_DEADLINE: return "deadline";
+	}
+	return NULL;
+}
+
+void
+disksched_printstats(void)
+{
+	struct disksched *ds;
+
+	kprintf("Disk scheduler policy: %s\n",
+		disksched_policyname(disksched_policy));
+
+	spinlock_acquire(&disksched_listlock);
+	for (ds = disksched_list; ds != NULL; ds = ds->ds_next) {
+		kprintf("%s: %lu requests, %lu merged, %lu runs "
+			"(%lu past deadline), %llu sectors seeked\n",
+			ds->ds_name, ds->ds_nreqs, ds->ds_nmerged,
+			ds->ds_nruns, ds->ds_nexpired,
+			(unsigned long long)ds->ds_seekdist);
+	}
+	spinlock_release(&disksched_listlock);
+}
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Name lookup cache.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <namecache.h>
+
+/*
+ * Tuning constants. NAMECACHE_HASHSIZE should be a power of 2.
+ */
+#define NAMECACHE_SIZE		256
+#define NAMECACHE_HASHSIZE	128
+
+/*
+ * One cache entry. An entry whose nc_dir is NULL is unused and not
+ * on a hash chain. Every entry, used or not, is on the LRU list;
+ * unused entries are kept at the head, so they get used first.
+ */
+struct nc_entry {
+	struct vnode *nc_dir;		/* directory, or NULL if unused */
+	struct vnode *nc_vn;		/* target, or NULL if negative */
+	char nc_name[NAMECACHE_NAMELEN+1];
+	struct nc_entry *nc_hashnext;
+	struct nc_entry *nc_lruprev;
+	struct nc_entry *nc_lrunext;
+};
+
+/*
+ * Global state, all protected by namecache_lock. This is a spinlock
+ * so the cache can be used (and purged) from anywhere.
+ */
+static struct spinlock namecache_lock = SPINLOCK_INITIALIZER;
+static struct nc_entry namecache_entries[NAMECACHE_SIZE];
+static struct nc_entry *namecache_hash[NAMECACHE_HASHSIZE];
+static struct nc_entry *namecache_lruhead;
+static struct nc_entry *namecache_lrutail;
+
+static struct {
+	unsigned long hits;		/* positive hits */
+	unsigned long neghits;		/* negative hits */
+	unsigned long misses;		/* not in cache */
+	unsigned long toolong;		/* name too long to cache */
+} namecache_stats;
+
+////////////////////////////////////////////////////////////
+// LRU list and hash chains
+
+static
+void
+nc_lru_remove(struct nc_entry *nc)
+{
+	if (nc->nc_lruprev != NULL) {
+		nc->nc_lruprev->nc_lrunext = nc->nc_lrunext;
+	}
+	else {
+		namecache_lruhead = nc->nc_lrunext;
+	}
+	if (nc->nc_lrunext != NULL) {
+		nc->nc_lrunext->nc_lruprev = nc->nc_lruprev;
+	}
+	else {
+		namecache_lrutail = nc->nc_lruprev;
+	}
+	nc->nc_lruprev = nc->nc_lrunext = NULL;
+}
+
+static
+void
+nc_lru_append(struct nc_entry *nc)
+{
+	nc->nc_lrunext = NULL;
+	nc->nc_lruprev = namecache_lrutail;
+	if (namecache_lrutail != NULL) {
+		namecache_lrutail->nc_lrunext = nc;
+	}
+	else {
+		namecache_lruhead = nc;
+	}
+	namecache_lrutail = nc;
+}
+
+static
+void
+nc_lru_prepend(struct nc_entry *nc)
+{
+	nc->nc_lruprev = NULL;
+	nc->nc_lrunext = namecache_lruhead;
+	if (namecache_lruhead != NULL) {
+		namecache_lruhead->nc_lruprev = nc;
+	}
+	else {
+		namecache_lrutail = nc;
+	}
+	namecache_lruhead = nc;
+}
+
+/*
+ * Hash a (directory, name) pair. This is the usual string hash with
+ * the directory's address folded in.
+ */
+static
+unsigned
+nc_hashfn(struct vnode *dir, const char *name)
+{
+	unsigned val;
+
+	val = (unsigned)((uintptr_t)dir >> 4);
+	while (*name) {
+		val = val * 33 + (unsigned char)*name;
+		name++;
+	}
+	return (val ^ (val >> 16)) & (NAMECACHE_HASHSIZE - 1);
+}
+
+static
+struct nc_entry *
+nc_find(struct vnode *dir, const char *name)
+{
+	struct nc_entry *nc;
+
+	for (nc = namecache_hash[nc_hashfn(dir, name)];
+	     nc != NULL;
+	     nc = nc->nc_hashnext) {
+		if (nc->nc_dir == dir && !strcmp(nc->nc_name, name)) {
+			return nc;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take an entry off its hash chain and put it on the head of the
+ * LRU list for reuse.
+ */
+static
+void
+nc_free(struct nc_entry *nc)
+{
+	struct nc_entry **pp;
+
+	KASSERT(nc->nc_dir != NULL);
+
+	pp = &namecache_hash[nc_hashfn(nc->nc_dir, nc->nc_name)];
+	while (*pp != nc) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->nc_hashnext;
+	}
+	*pp = nc->nc_hashnext;
+
+	nc->nc_hashnext = NULL;
+	nc->nc_dir = NULL;
+	nc->nc_vn = NULL;
+	nc->nc_name[0] = 0;
+
+	nc_lru_remove(nc);
+	nc_lru_prepend(nc);
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+/*
+ * Setup function.
+ */
+void
+namecache_bootstrap(void)
+{
+	unsigned i;
+
+	spinlock_acquire(&namecache_lock);
+	for (i=0; i<NAMECACHE_SIZE; i++) {
+		namecache_entries[i].nc_dir = NULL;
+		namecache_entries[i].nc_vn = NULL;
+		namecache_entries[i].nc_hashnext = NULL;
+		nc_lru_append(&namecache_entries[i]);
+	}
+	spinlock_release(&namecache_lock);
+}
+
+bool
+namecache_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct nc_entry *nc;
+
+	if (strlen(name) > NAMECACHE_NAMELEN) {
+		return false;
+	}
+
+	spinlock_acquire(&namecache_lock);
+	nc = nc_find(dir, name);
+	if (nc == NULL) {
+		namecache_stats.misses++;
+		spinlock_release(&namecache_lock);
+		return false;
+	}
+
+	/* Mark it recently used. */
+	nc_lru_remove(nc);
+	nc_lru_append(nc);
+
+	/*
+	 * Get the reference while still holding the lock, so that
+	 * namecache_purge can't run first. This is what lets us not
+	 * hold references in the cache itself.
+	 */
+	if (nc->nc_vn != NULL) {
+		VOP_INCREF(nc->nc_vn);
+		namecache_stats.hits++;
+	}
+	else {
+		namecache_stats.neghits++;
+	}
+	*ret = nc->nc_vn;
+	spinlock_release(&namecache_lock);
+	return true;
+}
+
+void
+namecache_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct nc_entry *nc;
+
+	KASSERT(dir != NULL);
+
+	if (strlen(name) > NAMECACHE_NAMELEN) {
+		spinlock_acquire(&namecache_lock);
+		namecache_stats.toolong++;
+		spinlock_release(&namecache_lock);
+		return;
+	}
+
+	spinlock_acquire(&namecache_lock);
+	nc = nc_find(dir, name);
+	if (nc == NULL) {
+		/* Recycle the least recently used entry. */
+		nc = namecache_lruhead;
+		KASSERT(nc != NULL);
+		if (nc->nc_dir != NULL) {
+			nc_free(nc);
+		}
+		nc->nc_dir = dir;
+		strcpy(nc->nc_name, name);
+		nc->nc_hashnext = namecache_hash[nc_hashfn(dir, name)];
+		namecache_hash[nc_hashfn(dir, name)] = nc;
+	}
+	nc->nc_vn = vn;
+	nc_lru_remove(nc);
+	nc_lru_append(nc);
+	spinlock_release(&namecache_lock);
+}
+
+void
+namecache_remove(struct vnode *dir, const char *name)
+{
+	struct nc_entry *nc;
+
+	if (strlen(name) > NAMECACHE_NAMELEN) {
+		return;
+	}
+
+	spinlock_acquire(&namecache_lock);
+	nc = nc_find(dir, name);
+	if (nc != NULL) {
+		nc_free(nc);
+	}
+	spinlock_release(&namecache_lock);
+}
+
+void
+namecache_purge(struct vnode *vn)
+{
+	unsigned i;
+	struct nc_entry *nc;
+
+	spinlock_acquire(&namecache_lock);
+	for (i=0; i<NAMECACHE_SIZE; i++) {
+		nc = &namecache_entries[i];
+		if (nc->nc_dir == NULL) {
+			continue;
+		}
+		if (nc->nc_dir == vn || nc->nc_vn == vn) {
+			nc_free(nc);
+		}
+	}
+	spinlock_release(&namecache_lock);
+}
+
+void
+namecache_printstats(void)
+{
+	unsigned long hits, neghits, misses, toolong;
+
+	spinlock_acquire(&namecache_lock);
+	hits = namecache_stats.hits;
+	neghits = namecache_stats.neghits;
+	misses = namecache_stats.misses;
+	toolong = namecache_stats.toolong;
+	spinlock_release(&namecache_lock);
+
+	kprintf("Name cache: %lu hits, %lu negative hits, %lu misses, "
+		"%lu names too long\n", hits, neghits, misses, toolong);
+}
@@ -83,21 +83,21 @@ vopfail_uio_nosys(struct vnode *vn, struct uio *uio)
 // mmap
 
 int
-vopfail_mmap_isdir(struct vnode *vn /*add stuff */)
+vopfail_mmap_isdir(struct vnode *vn)
 {
 	(void)vn;
 	return EISDIR;
 }
 
 int
-vopfail_mmap_perm(struct vnode *vn /*add stuff */)
+vopfail_mmap_perm(struct vnode *vn)
 {
 	(void)vn;
 	return EPERM;
 }
 
 int
-vopfail_mmap_nosys(struct vnode *vn /*add stuff */)
+vopfail_mmap_nosys(struct vnode *vn)
 {
 	(void)vn;
 	return ENOSYS;
@@ -43,6 +43,8 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <buf.h>
+#include <namecache.h>
 
 /*
  * Structure for a single named device.
@@ -112,6 +114,9 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	buffer_bootstrap();
+	namecache_bootstrap();
+
 	devnull_create();
 	semfs_bootstrap();
 }
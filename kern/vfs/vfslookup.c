@@ -246,11 +246,16 @@ vfs_lookparent(char *path, struct vnode **retval,
 	struct vnode *startvn;
 	int result;
 
+	/*
+	 * The big lock covers the device list and bootfs_vnode, which
+	 * getdevice looks at. The lookup itself is the filesystem's
+	 * business; we hold a reference to startvn, so it's safe to
+	 * let go of the lock first.
+	 */
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -268,7 +273,6 @@ vfs_lookparent(char *path, struct vnode **retval,
 
 	VOP_DECREF(startvn);
 
-	vfs_biglock_release();
 	return result;
 }
 
@@ -278,23 +282,21 @@ vfs_lookup(char *path, struct vnode **retval)
 	struct vnode *startvn;
 	int result;
 
+	/* See vfs_lookparent for why the big lock isn't held longer. */
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (strlen(path)==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
 	result = VOP_LOOKUP(startvn, path, retval);
 
 	VOP_DECREF(startvn);
-	vfs_biglock_release();
 	return result;
 }
@@ -52,6 +52,7 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	spinlock_init(&vn->vn_countlock);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
+	vn->vn_pagecache = NULL;
 	return 0;
 }
 
@@ -62,6 +63,7 @@ void
 vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
+	KASSERT(vn->vn_pagecache == NULL);
 
 	spinlock_cleanup(&vn->vn_countlock);
 
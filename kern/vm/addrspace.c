@@ -27,32 +27,277 @@
  * SUCH DAMAGE.
  */
 
+
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
+#include <synch.h>
+#include <vnode.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <vmstat.h>
+#include <swap.h>
 #include <proc.h>
 
 /*
- * Note! If OPT_DUMBVM is set, as is the case until you start the VM
- * assignment, this file is not compiled or linked or in any way
- * used. The cheesy hack versions in dumbvm.c are used instead.
+ * Note! If OPT_DUMBVM is set, this file is not compiled or linked or
+ * in any way used. The cheesy hack versions in dumbvm.c are used
+ * instead.
+ *
+ * An address space is a list of regions and a page table. Nothing is
+ * allocated for a region when it's defined; vm_fault fills in pages
+ * as they're touched, either with zeros or from the region's backing
+ * file. So loading a program costs only as much as the parts of it
+ * that actually get used.
+ *
+ * as_copy doesn't copy pages either. It shares them copy-on-write, so
+ * forking costs about as much as copying the page table, and a child
+ * that goes on to exec never copies anything. Pages that are out in
+ * swap are shared by their swap slot, and read in separately by each
+ * address space that touches them.
+ *
+ * Regions made by mmap can also be removed again with as_munmap. A
+ * file mapping gets its pages from the file's page cache, so every
+ * mapping of the file shares them; in a shared mapping, writes go to
+ * the cached pages and are written back to the file by as_msync,
+ * as_munmap, or when the last mapping goes away.
+ */
+
+/*
+ * Size of the user stack. None of it is allocated until used, so
+ * this can be generous.
+ */
+#define VM_STACKPAGES	1024
+
+/* See addrspace.h. */
+struct lock *as_listlock;
+struct addrspace *as_list;
+
+/*
+ * Free all the pages and swap slots of an address space and clear
+ * their page table entries.
+ */
+static
+void
+as_freepages(struct addrspace *as)
+{
+	struct pagetable *pt = as->as_pt;
+	unsigned i, j;
+	pte_t *l2;
+
+	for (i=0; i<PT_L1ENTRIES; i++) {
+		l2 = pt->pt_l2[i];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2ENTRIES; j++) {
+			if (l2[j] & PTE_VALID) {
+				coremap_release(l2[j] & PTE_FRAME, as);
+			}
+			else if (l2[j] & PTE_SWAPPED) {
+				swap_free(PTE_SLOT(l2[j]));
+			}
+			l2[j] = 0;
+		}
+	}
+}
+
+static
+void
+as_freeregion(struct vm_region *vr)
+{
+	if (vr->vr_vnode != NULL) {
+		VOP_DECREF(vr->vr_vnode);
+	}
+	if (vr->vr_cache != NULL) {
+		pagecache_decref(vr->vr_cache);
+	}
+	kfree(vr);
+}
+
+/*
+ * Tell the page cache of shared mapping VR which of its pages from
+ * START to END we've written. If CLEAN is set, also mark our page
+ * table entries clean again, so the next write will be noticed; the
+ * caller has to shoot down the old translations.
+ */
+static
+void
+as_syncdirty(struct addrspace *as, struct vm_region *vr,
+	     vaddr_t start, vaddr_t end, bool clean)
+{
+	vaddr_t va;
+	pte_t *pte;
+
+	KASSERT(vr->vr_flags & VR_SHARED);
+
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL || (*pte & (PTE_VALID | PTE_DIRTY)) !=
+		    (PTE_VALID | PTE_DIRTY)) {
+			continue;
+		}
+		pagecache_markdirty(vr->vr_cache,
+				    vr->vr_cacheoffset + (va - vr->vr_base));
+		if (clean) {
+			*pte &= ~PTE_DIRTY;
+		}
+	}
+}
+
+/*
+ * Add a region, keeping the list sorted. Fails if it overlaps an
+ * existing region.
+ */
+static
+int
+as_addregion(struct addrspace *as, struct vm_region *vr)
+{
+	struct vm_region **pp;
+	vaddr_t top;
+
+	top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	for (pp = &as->as_regions; *pp != NULL; pp = &(*pp)->vr_next) {
+		if ((*pp)->vr_base >= top) {
+			break;
+		}
+		if ((*pp)->vr_base + (*pp)->vr_npages * PAGE_SIZE >
+		    vr->vr_base) {
+			return EINVAL;
+		}
+	}
+	vr->vr_next = *pp;
+	*pp = vr;
+	return 0;
+}
+
+/*
+ * Merge into VR, which is about to be added, any regions it shares
+ * pages with. Program segments can share a page at their ends, and a
+ * page can only belong to one region, so they become a single region
+ * covering them all. It's writeable if any of them were; the MIPS
+ * can't refuse reads or instruction fetches anyway. Regions made by
+ * mmap are never merged.
  */
+static
+int
+as_mergeregions(struct addrspace *as, struct vm_region *vr)
+{
+	struct vm_region **pp, *old;
+	vaddr_t top, oldtop;
+	unsigned i, nfilemaps;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT(vr->vr_flags == 0 && vr->vr_cache == NULL);
+
+	/* First make sure we can merge everything, so we don't fail midway */
+	top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	nfilemaps = vr->vr_nfilemaps;
+	for (old = as->as_regions; old != NULL; old = old->vr_next) {
+		oldtop = old->vr_base + old->vr_npages * PAGE_SIZE;
+		if (old->vr_base >= top) {
+			break;
+		}
+		if (oldtop <= vr->vr_base) {
+			continue;
+		}
+		if (old->vr_flags & VR_MMAP) {
+			return EINVAL;
+		}
+		if (old->vr_vnode != NULL && vr->vr_vnode != NULL &&
+		    old->vr_vnode != vr->vr_vnode) {
+			return EINVAL;
+		}
+		nfilemaps += old->vr_nfilemaps;
+		if (nfilemaps > VR_MAXFILEMAPS) {
+			return EINVAL;
+		}
+	}
+
+	pp = &as->as_regions;
+	while (*pp != NULL) {
+		old = *pp;
+		oldtop = old->vr_base + old->vr_npages * PAGE_SIZE;
+		if (old->vr_base >= top) {
+			break;
+		}
+		if (oldtop <= vr->vr_base) {
+			pp = &old->vr_next;
+			continue;
+		}
+
+		if (old->vr_base < vr->vr_base) {
+			vr->vr_base = old->vr_base;
+		}
+		if (oldtop > top) {
+			top = oldtop;
+		}
+		vr->vr_npages = (top - vr->vr_base) / PAGE_SIZE;
+		vr->vr_writeable = vr->vr_writeable || old->vr_writeable;
+		for (i=0; i<old->vr_nfilemaps; i++) {
+			vr->vr_filemaps[vr->vr_nfilemaps++] =
+				old->vr_filemaps[i];
+		}
+		if (vr->vr_vnode == NULL) {
+			/* Take over its reference */
+			vr->vr_vnode = old->vr_vnode;
+			old->vr_vnode = NULL;
+		}
+
+		*pp = old->vr_next;
+		as_freeregion(old);
+	}
+	return 0;
+}
+
+void
+as_bootstrap(void)
+{
+	as_listlock = lock_create("aslist");
+	if (as_listlock == NULL) {
+		panic("as_bootstrap: Out of memory\n");
+	}
+	as_list = NULL;
+}
 
 struct addrspace *
 as_create(void)
 {
 	struct addrspace *as;
+	unsigned i;
 
 	as = kmalloc(sizeof(struct addrspace));
 	if (as == NULL) {
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_regions = NULL;
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		pt_destroy(as->as_pt);
+		kfree(as);
+		return NULL;
+	}
+	for (i=0; i<MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+	}
+	for (i=0; i<VMSTAT_NCOUNTERS; i++) {
+		as->as_vmstat[i] = 0;
+	}
+
+	lock_acquire(as_listlock);
+	as->as_next = as_list;
+	as_list = as;
+	lock_release(as_listlock);
 
 	return as;
 }
@@ -61,29 +306,139 @@ int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct vm_region *vr, *newvr, **tail;
+	unsigned i, j;
+	pte_t *l2, *newpte;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
+	lock_acquire(old->as_lock);
+	lock_acquire(newas->as_lock);
+
+	tail = &newas->as_regions;
+	for (vr = old->as_regions; vr != NULL; vr = vr->vr_next) {
+		newvr = kmalloc(sizeof(*newvr));
+		if (newvr == NULL) {
+			result = ENOMEM;
+			goto fail;
+		}
+		*newvr = *vr;
+		newvr->vr_next = NULL;
+		if (newvr->vr_vnode != NULL) {
+			VOP_INCREF(newvr->vr_vnode);
+		}
+		if (newvr->vr_cache != NULL) {
+			pagecache_incref(newvr->vr_cache);
+		}
+		*tail = newvr;
+		tail = &newvr->vr_next;
+	}
+
+	for (i=0; i<PT_L1ENTRIES; i++) {
+		l2 = old->as_pt->pt_l2[i];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2ENTRIES; j++) {
+			if ((l2[j] & (PTE_VALID | PTE_SWAPPED)) == 0) {
+				continue;
+			}
+			newpte = pt_lookup(newas->as_pt, PT_VADDR(i, j), true);
+			if (newpte == NULL) {
+				result = ENOMEM;
+				goto fail;
+			}
+
+			/* Getting the table may have paged this one out. */
+			if (l2[j] & PTE_VALID) {
+				/* Share it. */
+				coremap_share(l2[j] & PTE_FRAME);
+				vr = as_findregion(old, PT_VADDR(i, j));
+				KASSERT(vr != NULL);
+				if (vr->vr_flags & VR_SHARED) {
+					/*
+					 * Really shared; the child's
+					 * first write has to be seen.
+					 */
+					*newpte = l2[j] & ~PTE_DIRTY;
+				}
+				else {
+					l2[j] |= PTE_COW;
+					*newpte = l2[j];
+				}
+			}
+			else if (l2[j] & PTE_SWAPPED) {
+				/*
+				 * Share the slot; each of us reads it
+				 * in when it's next touched.
+				 */
+				swap_share(PTE_SLOT(l2[j]));
+				*newpte = l2[j];
+			}
+			/* else it was dropped clean; refill it on demand. */
+		}
+	}
+
 	/*
-	 * Write this.
+	 * TLBs may still let the old address space write to pages
+	 * that are now shared.
 	 */
+	vm_shootdown_as(old);
 
-	(void)old;
+	lock_release(newas->as_lock);
+	lock_release(old->as_lock);
 
 	*ret = newas;
 	return 0;
+
+ fail:
+	lock_release(newas->as_lock);
+	lock_release(old->as_lock);
+	as_destroy(newas);
+	return result;
 }
 
 void
 as_destroy(struct addrspace *as)
 {
+	struct addrspace **pp;
+	struct vm_region *vr;
+
+	lock_acquire(as_listlock);
+	for (pp = &as_list; *pp != as; pp = &(*pp)->as_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = as->as_next;
+	lock_release(as_listlock);
+
 	/*
-	 * Clean up as needed.
+	 * Hold the lock while freeing the pages, so the pageout code
+	 * is either done with them or won't start. Shared mappings'
+	 * changes go back to their page caches first.
 	 */
+	lock_acquire(as->as_lock);
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vr->vr_flags & VR_SHARED) {
+			as_syncdirty(as, vr, vr->vr_base,
+				     vr->vr_base + vr->vr_npages * PAGE_SIZE,
+				     false);
+		}
+	}
+	as_freepages(as);
+	lock_release(as->as_lock);
 
+	vm_asid_release(as);
+	pt_destroy(as->as_pt);
+	while (as->as_regions != NULL) {
+		vr = as->as_regions;
+		as->as_regions = vr->vr_next;
+		as_freeregion(vr);
+	}
+	lock_destroy(as->as_lock);
 	kfree(as);
 }
 
@@ -102,18 +457,16 @@ as_activate(void)
 	}
 
 	/*
-	 * Write this.
+	 * TLB entries are tagged with an ASID, so there's no need to
+	 * flush; other address spaces' translations can stay.
 	 */
+	vm_asid_activate(as);
 }
 
 void
 as_deactivate(void)
 {
-	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
-	 */
+	/* Nothing to do; the next as_activate switches ASIDs. */
 }
 
 /*
@@ -121,46 +474,444 @@ as_deactivate(void)
  * segment in memory extends from VADDR up to (but not including)
  * VADDR+MEMSIZE.
  *
- * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * The MIPS can't refuse reads or instruction fetches from a mapped
+ * page, so only WRITEABLE is enforced.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	struct vm_region *vr;
+	int result;
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
 	(void)readable;
-	(void)writeable;
 	(void)executable;
-	return ENOSYS;
+
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	if (memsize == 0 || vaddr >= USERSPACETOP ||
+	    memsize > USERSPACETOP - vaddr) {
+		return EFAULT;
+	}
+
+	vr = kmalloc(sizeof(*vr));
+	if (vr == NULL) {
+		return ENOMEM;
+	}
+	vr->vr_base = vaddr;
+	vr->vr_npages = memsize / PAGE_SIZE;
+	vr->vr_writeable = writeable != 0;
+	vr->vr_flags = 0;
+	vr->vr_vnode = NULL;
+	vr->vr_nfilemaps = 0;
+	vr->vr_cache = NULL;
+	vr->vr_cacheoffset = 0;
+
+	lock_acquire(as->as_lock);
+	result = as_mergeregions(as, vr);
+	if (result == 0) {
+		result = as_addregion(as, vr);
+	}
+	lock_release(as->as_lock);
+	if (result) {
+		kfree(vr);
+		return result;
+	}
+	return 0;
 }
 
 int
-as_prepare_load(struct addrspace *as)
+as_map_file(struct addrspace *as, vaddr_t vaddr,
+	    struct vnode *v, off_t offset, size_t filesize)
+{
+	struct vm_region *vr;
+	struct vm_filemap *fm;
+
+	if (filesize == 0) {
+		return 0;
+	}
+
+	lock_acquire(as->as_lock);
+	vr = as_findregion(as, vaddr);
+	if (vr == NULL || (vr->vr_vnode != NULL && vr->vr_vnode != v) ||
+	    vr->vr_nfilemaps == VR_MAXFILEMAPS ||
+	    filesize > vr->vr_base + vr->vr_npages * PAGE_SIZE - vaddr) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+	if (vr->vr_vnode == NULL) {
+		VOP_INCREF(v);
+		vr->vr_vnode = v;
+	}
+	fm = &vr->vr_filemaps[vr->vr_nfilemaps++];
+	fm->fm_vaddr = vaddr;
+	fm->fm_offset = offset;
+	fm->fm_size = filesize;
+	lock_release(as->as_lock);
+
+	return 0;
+}
+
+struct vm_region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct vm_region *vr;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vaddr < vr->vr_base) {
+			break;
+		}
+		if (vaddr - vr->vr_base < vr->vr_npages * PAGE_SIZE) {
+			return vr;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find room for NPAGES pages of mmap: the highest gap between
+ * regions that's big enough, to stay out of the way of whatever is
+ * below. Page 0 is never used. Returns 0 if there's no room.
+ */
+static
+vaddr_t
+as_findgap(struct addrspace *as, unsigned npages)
+{
+	struct vm_region *vr;
+	vaddr_t lo, hi, ret;
+	size_t len;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	len = npages * PAGE_SIZE;
+	ret = 0;
+	lo = PAGE_SIZE;
+	for (vr = as->as_regions; ; vr = vr->vr_next) {
+		hi = (vr == NULL) ? USERSPACETOP : vr->vr_base;
+		if (hi > lo && hi - lo >= len) {
+			ret = hi - len;
+		}
+		if (vr == NULL) {
+			break;
+		}
+		lo = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	}
+	return ret;
+}
+
+int
+as_mmap(struct addrspace *as, vaddr_t *vaddr, size_t len, int writeable,
+	int flags, struct vnode *v, off_t offset)
 {
+	struct vm_region *vr;
+	struct pagecache *pc;
+	vaddr_t base;
+	int result;
+
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if ((flags & MAP_TYPE) != MAP_SHARED &&
+	    (flags & MAP_TYPE) != MAP_PRIVATE) {
+		return EINVAL;
+	}
+	if (len > USERSPACETOP) {
+		return ENOMEM;
+	}
+	len = (len + PAGE_SIZE - 1) & PAGE_FRAME;
+
 	/*
-	 * Write this.
+	 * Files go through their page cache. So do shared anonymous
+	 * mappings, so that forked children share the pages; private
+	 * ones are just zero-filled memory.
 	 */
+	pc = NULL;
+	if (v != NULL) {
+		result = VOP_MMAP(v);
+		if (result) {
+			return result;
+		}
+		pc = pagecache_get(v);
+		if (pc == NULL) {
+			return ENOMEM;
+		}
+	}
+	else if ((flags & MAP_TYPE) == MAP_SHARED) {
+		pc = pagecache_get(NULL);
+		if (pc == NULL) {
+			return ENOMEM;
+		}
+	}
 
-	(void)as;
+	vr = kmalloc(sizeof(*vr));
+	if (vr == NULL) {
+		if (pc != NULL) {
+			pagecache_decref(pc);
+		}
+		return ENOMEM;
+	}
+	vr->vr_npages = len / PAGE_SIZE;
+	vr->vr_writeable = writeable != 0;
+	vr->vr_flags = VR_MMAP;
+	if ((flags & MAP_TYPE) == MAP_SHARED) {
+		vr->vr_flags |= VR_SHARED;
+	}
+	vr->vr_vnode = NULL;
+	vr->vr_nfilemaps = 0;
+	vr->vr_cache = pc;
+	vr->vr_cacheoffset = offset;
+
+	lock_acquire(as->as_lock);
+	if (flags & MAP_FIXED) {
+		base = *vaddr;
+		if (base % PAGE_SIZE != 0 || base == 0 ||
+		    base >= USERSPACETOP || len > USERSPACETOP - base) {
+			result = EINVAL;
+			goto fail;
+		}
+	}
+	else {
+		base = as_findgap(as, vr->vr_npages);
+		if (base == 0) {
+			result = ENOMEM;
+			goto fail;
+		}
+	}
+	vr->vr_base = base;
+	result = as_addregion(as, vr);
+	if (result) {
+		goto fail;
+	}
+	lock_release(as->as_lock);
+
+	*vaddr = base;
 	return 0;
+
+ fail:
+	lock_release(as->as_lock);
+	as_freeregion(vr);
+	return result;
 }
 
 int
-as_complete_load(struct addrspace *as)
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
 {
+	struct vm_region *vr, *newvr, *dead, **pp;
+	vaddr_t start, end, base, top, va;
+	vaddr_t pages[TLBSHOOTDOWN_PAGES];
+	unsigned npages, i;
+	pte_t *pte;
+
+	if (vaddr % PAGE_SIZE != 0 || len == 0 || vaddr >= USERSPACETOP ||
+	    len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	start = vaddr;
+	end = start + ((len + PAGE_SIZE - 1) & PAGE_FRAME);
+	npages = (end - start) / PAGE_SIZE;
+
+	lock_acquire(as->as_lock);
+
+	/*
+	 * Only mmap regions can be unmapped. If the range is in the
+	 * middle of one, it gets split, so get the memory for that now.
+	 */
+	newvr = NULL;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		base = vr->vr_base;
+		top = base + vr->vr_npages * PAGE_SIZE;
+		if (top <= start || base >= end) {
+			continue;
+		}
+		if ((vr->vr_flags & VR_MMAP) == 0) {
+			lock_release(as->as_lock);
+			return EINVAL;
+		}
+		if (base < start && top > end) {
+			newvr = kmalloc(sizeof(*newvr));
+			if (newvr == NULL) {
+				lock_release(as->as_lock);
+				return ENOMEM;
+			}
+		}
+	}
+
 	/*
-	 * Write this.
+	 * Pass on what we've written, and take away the mappings;
+	 * but keep the page frames until the TLBs are done with them.
 	 */
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		base = vr->vr_base;
+		top = base + vr->vr_npages * PAGE_SIZE;
+		if (top <= start || base >= end) {
+			continue;
+		}
+		if (vr->vr_flags & VR_SHARED) {
+			as_syncdirty(as, vr, base < start ? start : base,
+				     top > end ? end : top, false);
+		}
+	}
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte != NULL) {
+			*pte &= ~PTE_VALID;
+		}
+	}
+
+	/* Cut the range out of the regions. */
+	dead = NULL;
+	pp = &as->as_regions;
+	while ((vr = *pp) != NULL) {
+		base = vr->vr_base;
+		top = base + vr->vr_npages * PAGE_SIZE;
+		if (top <= start || base >= end) {
+			pp = &vr->vr_next;
+			continue;
+		}
+		if (base >= start && top <= end) {
+			/* All of it. */
+			*pp = vr->vr_next;
+			vr->vr_next = dead;
+			dead = vr;
+			continue;
+		}
+		if (base < start && top > end) {
+			/* The middle of it; split it. */
+			KASSERT(newvr != NULL);
+			*newvr = *vr;
+			newvr->vr_base = end;
+			newvr->vr_npages = (top - end) / PAGE_SIZE;
+			newvr->vr_cacheoffset += end - base;
+			if (newvr->vr_cache != NULL) {
+				pagecache_incref(newvr->vr_cache);
+			}
+			vr->vr_npages = (start - base) / PAGE_SIZE;
+			vr->vr_next = newvr;
+			newvr = NULL;
+		}
+		else if (base < start) {
+			/* The end of it. */
+			vr->vr_npages = (start - base) / PAGE_SIZE;
+		}
+		else {
+			/* The beginning of it. */
+			vr->vr_base = end;
+			vr->vr_npages = (top - end) / PAGE_SIZE;
+			vr->vr_cacheoffset += end - base;
+		}
+		pp = &vr->vr_next;
+	}
+	KASSERT(newvr == NULL);
+
+	if (npages <= TLBSHOOTDOWN_PAGES) {
+		for (i=0; i<npages; i++) {
+			pages[i] = start + i * PAGE_SIZE;
+		}
+		vm_shootdown_pages(as, pages, npages);
+	}
+	else {
+		vm_shootdown_as(as);
+	}
+
+	/* Now the pages can go. */
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL || *pte == 0) {
+			continue;
+		}
+		if (*pte & PTE_SWAPPED) {
+			swap_free(PTE_SLOT(*pte));
+		}
+		else {
+			coremap_release(*pte & PTE_FRAME, as);
+		}
+		*pte = 0;
+	}
+
+	/* This may write back to files, so do it last. */
+	while (dead != NULL) {
+		vr = dead;
+		dead = vr->vr_next;
+		as_freeregion(vr);
+	}
+
+	lock_release(as->as_lock);
+	return 0;
+}
+
+int
+as_msync(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct vm_region *vr;
+	vaddr_t start, end, base, top;
+	int result, ret;
 
+	if (vaddr % PAGE_SIZE != 0 || vaddr >= USERSPACETOP ||
+	    len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	start = vaddr;
+	end = start + ((len + PAGE_SIZE - 1) & PAGE_FRAME);
+
+	lock_acquire(as->as_lock);
+
+	/* Collect what's been written, and notice the next write. */
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		base = vr->vr_base;
+		top = base + vr->vr_npages * PAGE_SIZE;
+		if (top <= start || base >= end ||
+		    (vr->vr_flags & VR_SHARED) == 0) {
+			continue;
+		}
+		as_syncdirty(as, vr, base < start ? start : base,
+			     top > end ? end : top, true);
+	}
+	vm_shootdown_as(as);
+
+	ret = 0;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		base = vr->vr_base;
+		top = base + vr->vr_npages * PAGE_SIZE;
+		if (top <= start || base >= end ||
+		    (vr->vr_flags & VR_SHARED) == 0) {
+			continue;
+		}
+		if (base < start) {
+			base = start;
+		}
+		if (top > end) {
+			top = end;
+		}
+		result = pagecache_flush(vr->vr_cache,
+				vr->vr_cacheoffset + (base - vr->vr_base),
+				top - base);
+		if (result && ret == 0) {
+			ret = result;
+		}
+	}
+
+	lock_release(as->as_lock);
+	return ret;
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+	/* Nothing to do; pages are loaded when they're touched. */
+	(void)as;
+	return 0;
+}
+
+int
+as_complete_load(struct addrspace *as)
+{
 	(void)as;
 	return 0;
 }
@@ -168,15 +919,16 @@ as_complete_load(struct addrspace *as)
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	result = as_define_region(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+				  VM_STACKPAGES * PAGE_SIZE, 1, 1, 0);
+	if (result) {
+		return result;
+	}
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
 
 	return 0;
 }
-
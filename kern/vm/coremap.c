@@ -0,0 +1,811 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Coremap and physical page allocator.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <wchan.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include "opt-dumbvm.h"
+
+/*
+ * Page states.
+ */
+#define CME_FIXED	0	/* not managed (kernel image, coremap) */
+#define CME_FREE	1	/* on the free list */
+#define CME_KERNEL	2	/* allocated by alloc_kpages */
+#define CME_USER	3	/* allocated for user memory */
+#define CME_ZEROING	4	/* being zeroed */
+
+/*
+ * Most pages to keep zeroed ahead of time, and the fraction of memory
+ * that may go to it.
+ */
+#define COREMAP_ZEROMAX		64
+#define COREMAP_ZEROFRACTION	8
+
+/*
+ * One coremap entry. cme_npages is the length of the block for the
+ * first page of an allocated block, and 0 for the rest of its pages.
+ * cme_next and cme_prev link free pages, by page number.
+ *
+ * Free pages that have been zeroed ahead of time by the page-zeroing
+ * thread have cme_zeroed set. They are kept at the tail of the free
+ * list, and the rest at the head, so allocations that need a zeroed
+ * page take from the tail and everything else from the head.
+ *
+ * Pages of a paged address space have cme_pageable set. cme_as and
+ * cme_vaddr say where such a page is mapped, and cme_slot is the swap slot holding a clean
+ * copy of it, if any. A busy page is pinned by someone filling it in
+ * or paging it out and mustn't be chosen for eviction or freed.
+ *
+ * A page shared copy-on-write is mapped by cme_refcount address
+ * spaces, all at cme_vaddr. cme_as is the one that had it first, or
+ * NULL if that one has since let go; the pageout code has to go
+ * looking for the others.
+ */
+struct coremap_entry {
+	uint8_t cme_state;
+	bool cme_busy;
+	bool cme_zeroed;
+	bool cme_pageable;
+	uint16_t cme_refcount;
+	uint32_t cme_npages;
+	uint32_t cme_next;
+	uint32_t cme_prev;
+	struct addrspace *cme_as;
+	vaddr_t cme_vaddr;
+	uint32_t cme_slot;
+};
+
+/*
+ * Global state, all protected by coremap_lock except for coremap,
+ * coremap_npages, and coremap_firstpage, which are fixed after boot.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+static struct coremap_entry *coremap;
+static unsigned coremap_npages;		/* pages of RAM */
+static unsigned coremap_firstpage;	/* first page we manage */
+static uint32_t coremap_freehead;	/* free list */
+static uint32_t coremap_freetail;
+static unsigned coremap_nfree;		/* pages on free list */
+static uint32_t coremap_zeroing;	/* free page being zeroed, or CM_NONE */
+static unsigned coremap_nzeroed;	/* how many of them are zeroed */
+static unsigned coremap_zerotarget;	/* how many we'd like zeroed */
+static struct wchan *coremap_zerowchan;	/* page-zeroing thread sleeps here */
+static struct wchan *coremap_busywchan;	/* waiting for a page to be unpinned
+					   or zeroed */
+static unsigned coremap_nused;		/* pages allocated */
+static unsigned coremap_clockhand;	/* next page to consider evicting */
+
+/*
+ * The clock algorithm's use bits, one byte per page. These are kept
+ * apart from the coremap, and set without coremap_lock, so the TLB
+ * refill handler (in exception-mips1.S) can set them with a single
+ * byte store. Losing a race with the clock hand just gives a page one
+ * more or one less chance.
+ */
+uint8_t *coremap_usebits;
+
+////////////////////////////////////////////////////////////
+// Free list
+
+static
+void
+coremap_freelist_remove(uint32_t pn)
+{
+	struct coremap_entry *cme = &coremap[pn];
+
+	KASSERT(cme->cme_state == CME_FREE);
+
+	if (cme->cme_prev != CM_NONE) {
+		coremap[cme->cme_prev].cme_next = cme->cme_next;
+	}
+	else {
+		coremap_freehead = cme->cme_next;
+	}
+	if (cme->cme_next != CM_NONE) {
+		coremap[cme->cme_next].cme_prev = cme->cme_prev;
+	}
+	else {
+		coremap_freetail = cme->cme_prev;
+	}
+	cme->cme_next = cme->cme_prev = CM_NONE;
+	coremap_nfree--;
+	if (cme->cme_zeroed) {
+		cme->cme_zeroed = false;
+		coremap_nzeroed--;
+	}
+}
+
+static
+void
+coremap_freelist_add(uint32_t pn)
+{
+	struct coremap_entry *cme = &coremap[pn];
+
+	KASSERT(cme->cme_state == CME_FREE);
+
+	if (cme->cme_zeroed) {
+		/* zeroed pages go at the tail */
+		cme->cme_next = CM_NONE;
+		cme->cme_prev = coremap_freetail;
+		if (coremap_freetail != CM_NONE) {
+			coremap[coremap_freetail].cme_next = pn;
+		}
+		else {
+			coremap_freehead = pn;
+		}
+		coremap_freetail = pn;
+		coremap_nzeroed++;
+	}
+	else {
+		cme->cme_prev = CM_NONE;
+		cme->cme_next = coremap_freehead;
+		if (coremap_freehead != CM_NONE) {
+			coremap[coremap_freehead].cme_prev = pn;
+		}
+		else {
+			coremap_freetail = pn;
+		}
+		coremap_freehead = pn;
+	}
+	coremap_nfree++;
+}
+
+/*
+ * Wake the page-zeroing thread if the pool is short.
+ */
+static
+void
+coremap_zero_poke(void)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if (coremap_zerowchan != NULL &&
+	    coremap_nzeroed < coremap_zerotarget) {
+		wchan_wakeone(coremap_zerowchan, &coremap_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Allocation
+
+/*
+ * Find NPAGES contiguous free pages. A single page comes straight
+ * off the free list: the tail, if ZERO and there's a zeroed page
+ * there, otherwise the head. Larger blocks are found by scanning the
+ * coremap for the lowest run that's long enough.
+ */
+static
+uint32_t
+coremap_findfree(unsigned npages, bool zero)
+{
+	unsigned pn, run;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if (npages > coremap_nfree) {
+		return CM_NONE;
+	}
+	if (npages == 1) {
+		if (zero && coremap[coremap_freetail].cme_zeroed) {
+			return coremap_freetail;
+		}
+		return coremap_freehead;
+	}
+
+	run = 0;
+	for (pn = coremap_firstpage; pn < coremap_npages; pn++) {
+		if (coremap[pn].cme_state != CME_FREE) {
+			run = 0;
+			continue;
+		}
+		run++;
+		if (run == npages) {
+			return pn + 1 - npages;
+		}
+	}
+	return CM_NONE;
+}
+
+/*
+ * Allocate a block of NPAGES pages in state STATE. Returns the first
+ * page number, or CM_NONE. The pages start out busy if AS is set.
+ * If ZERO is set they are zeroed, by the page-zeroing thread if
+ * possible.
+ *
+ * If there isn't room, page out some user pages and try again, for
+ * as long as that makes progress.
+ */
+static
+uint32_t
+coremap_alloc(unsigned npages, uint8_t state,
+	      struct addrspace *as, vaddr_t vaddr, bool zero)
+{
+	uint32_t first, pn;
+	bool zeroed;
+
+	KASSERT(npages > 0);
+
+	spinlock_acquire(&coremap_lock);
+	while ((first = coremap_findfree(npages, zero)) == CM_NONE) {
+		if (coremap_zeroing != CM_NONE &&
+		    npages <= coremap_nfree + 1) {
+			/*
+			 * The page being zeroed may be all we're
+			 * short. It's still free; wait for it to come
+			 * back rather than paging something out.
+			 */
+			wchan_sleep(coremap_busywchan, &coremap_lock);
+			continue;
+		}
+		spinlock_release(&coremap_lock);
+#if OPT_DUMBVM
+		return CM_NONE;
+#else
+		if (vm_pageout() == 0) {
+			return CM_NONE;
+		}
+#endif
+		spinlock_acquire(&coremap_lock);
+	}
+	zeroed = true;
+	for (pn = first; pn < first + npages; pn++) {
+		if (!coremap[pn].cme_zeroed) {
+			zeroed = false;
+		}
+		coremap_freelist_remove(pn);
+		coremap[pn].cme_state = state;
+		coremap[pn].cme_npages = 0;
+		coremap[pn].cme_busy = (as != NULL);
+		coremap[pn].cme_pageable = (as != NULL);
+		coremap_usebits[pn] = 1;
+		coremap[pn].cme_refcount = 1;
+		coremap[pn].cme_as = as;
+		coremap[pn].cme_vaddr = vaddr;
+		coremap[pn].cme_slot = CM_NONE;
+	}
+	coremap[first].cme_npages = npages;
+	coremap_nused += npages;
+	coremap_zero_poke();
+	spinlock_release(&coremap_lock);
+
+	if (zero && !zeroed) {
+		bzero((void *)PADDR_TO_KVADDR((paddr_t)first * PAGE_SIZE),
+		      npages * PAGE_SIZE);
+	}
+
+	return first;
+}
+
+/*
+ * Check if we're in a context that can sleep. Allocating pages may
+ * have to page something out first, which sleeps.
+ */
+static
+void
+coremap_can_sleep(void)
+{
+	if (CURCPU_EXISTS()) {
+		/* must not hold spinlocks */
+		KASSERT(curcpu->c_spinlocks == 0);
+
+		/* must not be in an interrupt handler */
+		KASSERT(curthread->t_in_interrupt == 0);
+	}
+}
+
+/*
+ * Get the entry for the allocated user page at PA.
+ */
+static
+struct coremap_entry *
+coremap_userpage(paddr_t pa)
+{
+	uint32_t pn;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(pa % PAGE_SIZE == 0);
+	pn = pa / PAGE_SIZE;
+	KASSERT(pn >= coremap_firstpage && pn < coremap_npages);
+	KASSERT(coremap[pn].cme_state == CME_USER);
+	return &coremap[pn];
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lastpaddr, firstpaddr, cmpaddr;
+	size_t cmsize;
+	uint32_t pn;
+
+	lastpaddr = ram_getsize();
+	coremap_npages = lastpaddr / PAGE_SIZE;
+
+	/* Take the coremap itself from the unmanaged memory. */
+	cmsize = coremap_npages * sizeof(struct coremap_entry);
+	cmpaddr = ram_stealmem(DIVROUNDUP(cmsize, PAGE_SIZE));
+	if (cmpaddr == 0) {
+		panic("coremap_bootstrap: No memory for the coremap\n");
+	}
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(cmpaddr);
+
+	cmpaddr = ram_stealmem(DIVROUNDUP(coremap_npages, PAGE_SIZE));
+	if (cmpaddr == 0) {
+		panic("coremap_bootstrap: No memory for the coremap\n");
+	}
+	coremap_usebits = (uint8_t *)PADDR_TO_KVADDR(cmpaddr);
+
+	/* After this ram_stealmem no longer works. */
+	firstpaddr = ram_getfirstfree();
+	KASSERT(firstpaddr % PAGE_SIZE == 0);
+	coremap_firstpage = firstpaddr / PAGE_SIZE;
+
+	coremap_freehead = coremap_freetail = CM_NONE;
+	coremap_nfree = 0;
+	coremap_zeroing = CM_NONE;
+	coremap_nzeroed = 0;
+	coremap_zerotarget = (coremap_npages - coremap_firstpage) /
+		COREMAP_ZEROFRACTION;
+	if (coremap_zerotarget > COREMAP_ZEROMAX) {
+		coremap_zerotarget = COREMAP_ZEROMAX;
+	}
+	coremap_nused = 0;
+	coremap_clockhand = coremap_firstpage;
+
+	/*
+	 * Build the free list from the top down, so it comes out
+	 * in address order.
+	 */
+	for (pn = coremap_npages; pn-- > 0; ) {
+		coremap[pn].cme_npages = 0;
+		coremap[pn].cme_next = coremap[pn].cme_prev = CM_NONE;
+		coremap[pn].cme_busy = false;
+		coremap[pn].cme_zeroed = false;
+		coremap[pn].cme_pageable = false;
+		coremap_usebits[pn] = 0;
+		coremap[pn].cme_refcount = 0;
+		coremap[pn].cme_as = NULL;
+		coremap[pn].cme_vaddr = 0;
+		coremap[pn].cme_slot = CM_NONE;
+		if (pn < coremap_firstpage) {
+			coremap[pn].cme_state = CME_FIXED;
+		}
+		else {
+			coremap[pn].cme_state = CME_FREE;
+			coremap_freelist_add(pn);
+		}
+	}
+}
+
+/*
+ * The page-zeroing thread. Zero free pages until there are
+ * coremap_zerotarget of them, then sleep until some get used. It's a
+ * background thread, so it only gets the CPU when nothing else wants
+ * it, and it yields after each page in case something does by then.
+ *
+ * The page being zeroed has to come off the free list so nobody
+ * allocates it halfway through, but it's still counted as free:
+ * coremap_alloc waits for it instead of paging out.
+ */
+static
+void
+coremap_zero_thread(void *data1, unsigned long data2)
+{
+	uint32_t pn;
+
+	(void)data1;
+	(void)data2;
+
+	thread_setbackground();
+
+	spinlock_acquire(&coremap_lock);
+	while (1) {
+		pn = coremap_freehead;
+		if (coremap_nzeroed >= coremap_zerotarget ||
+		    pn == CM_NONE || coremap[pn].cme_zeroed) {
+			/* Enough, or nothing left to zero. */
+			wchan_sleep(coremap_zerowchan, &coremap_lock);
+			continue;
+		}
+
+		coremap_freelist_remove(pn);
+		coremap[pn].cme_state = CME_ZEROING;
+		coremap_zeroing = pn;
+		spinlock_release(&coremap_lock);
+
+		bzero((void *)PADDR_TO_KVADDR((paddr_t)pn * PAGE_SIZE),
+		      PAGE_SIZE);
+
+		spinlock_acquire(&coremap_lock);
+		coremap[pn].cme_state = CME_FREE;
+		coremap[pn].cme_zeroed = true;
+		coremap_freelist_add(pn);
+		coremap_zeroing = CM_NONE;
+		wchan_wakeall(coremap_busywchan, &coremap_lock);
+		spinlock_release(&coremap_lock);
+
+		thread_yield();
+
+		spinlock_acquire(&coremap_lock);
+	}
+}
+
+void
+coremap_zero_bootstrap(void)
+{
+	int result;
+
+	coremap_zerowchan = wchan_create("pagezero");
+	coremap_busywchan = wchan_create("pagebusy");
+	if (coremap_zerowchan == NULL || coremap_busywchan == NULL) {
+		panic("coremap_zero_bootstrap: Out of memory\n");
+	}
+	result = thread_fork("pagezero", NULL, coremap_zero_thread, NULL, 0);
+	if (result) {
+		panic("coremap_zero_bootstrap: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
+
+paddr_t
+coremap_allocuser(unsigned npages)
+{
+	uint32_t pn;
+
+	coremap_can_sleep();
+	pn = coremap_alloc(npages, CME_USER, NULL, 0, false);
+	if (pn == CM_NONE) {
+		return 0;
+	}
+	return (paddr_t)pn * PAGE_SIZE;
+}
+
+paddr_t
+coremap_allocpage(struct addrspace *as, vaddr_t vaddr, bool zero)
+{
+	uint32_t pn;
+
+	KASSERT(as != NULL);
+	KASSERT(vaddr % PAGE_SIZE == 0);
+
+	coremap_can_sleep();
+	pn = coremap_alloc(1, CME_USER, as, vaddr, zero);
+	if (pn == CM_NONE) {
+		return 0;
+	}
+	return (paddr_t)pn * PAGE_SIZE;
+}
+
+void
+coremap_free(paddr_t pa)
+{
+	uint32_t first, pn, slot;
+	unsigned npages;
+	uint8_t state;
+
+	KASSERT(pa % PAGE_SIZE == 0);
+	first = pa / PAGE_SIZE;
+	KASSERT(first >= coremap_firstpage && first < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	npages = coremap[first].cme_npages;
+	state = coremap[first].cme_state;
+	if (npages == 0 || (state != CME_KERNEL && state != CME_USER)) {
+		panic("coremap_free: 0x%x is not an allocated block\n", pa);
+	}
+	KASSERT(first + npages <= coremap_npages);
+
+	/*
+	 * The pageout code may have just picked this page and not
+	 * yet found that it can't lock the address space. Wait for
+	 * it to let go; coremap_unpin wakes us. (Only user pages go
+	 * busy, and there are none before the wchan exists.)
+	 */
+	while (coremap[first].cme_busy) {
+		KASSERT(coremap_busywchan != NULL);
+		wchan_sleep(coremap_busywchan, &coremap_lock);
+	}
+	KASSERT(coremap[first].cme_refcount == 1);
+	slot = coremap[first].cme_slot;
+
+	for (pn = first; pn < first + npages; pn++) {
+		KASSERT(coremap[pn].cme_state == state);
+		KASSERT(pn == first || coremap[pn].cme_npages == 0);
+		coremap[pn].cme_state = CME_FREE;
+		coremap[pn].cme_npages = 0;
+		coremap[pn].cme_pageable = false;
+		coremap[pn].cme_refcount = 0;
+		coremap[pn].cme_as = NULL;
+		coremap[pn].cme_vaddr = 0;
+		coremap[pn].cme_slot = CM_NONE;
+		coremap_freelist_add(pn);
+	}
+	KASSERT(coremap_nused >= npages);
+	coremap_nused -= npages;
+	coremap_zero_poke();
+	spinlock_release(&coremap_lock);
+
+#if !OPT_DUMBVM
+	/* The swap copy of a clean page goes with it. */
+	if (slot != CM_NONE) {
+		swap_free(slot);
+	}
+#else
+	KASSERT(slot == CM_NONE);
+#endif
+}
+
+void
+coremap_share(paddr_t pa)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+	KASSERT(cme->cme_refcount > 0 && cme->cme_refcount < 0xffff);
+	cme->cme_refcount++;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_refcount(paddr_t pa)
+{
+	struct coremap_entry *cme;
+	unsigned ret;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+	ret = cme->cme_refcount;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+bool
+coremap_isshared(paddr_t pa)
+{
+	struct coremap_entry *cme;
+	bool ret;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+	ret = cme->cme_refcount > 1;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+void
+coremap_release(paddr_t pa, struct addrspace *as)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+
+	/*
+	 * The pageout code may have picked the page and be about to
+	 * lock AS by way of cme_as; wait for it, as coremap_free does.
+	 */
+	while (cme->cme_busy) {
+		KASSERT(coremap_busywchan != NULL);
+		wchan_sleep(coremap_busywchan, &coremap_lock);
+	}
+	if (cme->cme_refcount > 1) {
+		cme->cme_refcount--;
+		if (cme->cme_as == as) {
+			/* Whoever is left will claim it. */
+			cme->cme_as = NULL;
+		}
+		spinlock_release(&coremap_lock);
+		return;
+	}
+	spinlock_release(&coremap_lock);
+
+	coremap_free(pa);
+}
+
+void
+coremap_unpin(paddr_t pa)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+	KASSERT(cme->cme_busy);
+	cme->cme_busy = false;
+	if (coremap_busywchan != NULL) {
+		wchan_wakeall(coremap_busywchan, &coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_reference(paddr_t pa, struct addrspace *as)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+	coremap_usebits[pa / PAGE_SIZE] = 1;
+	if (cme->cme_as == NULL && cme->cme_refcount == 1) {
+		cme->cme_as = as;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+uint32_t
+coremap_getslot(paddr_t pa)
+{
+	struct coremap_entry *cme;
+	uint32_t slot;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+	slot = cme->cme_slot;
+	spinlock_release(&coremap_lock);
+	return slot;
+}
+
+void
+coremap_setslot(paddr_t pa, uint32_t slot)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_userpage(pa);
+	cme->cme_slot = slot;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Clock algorithm: sweep around the coremap looking for a user page
+ * that hasn't been used since the last time around, clearing use
+ * bits on the way. Two full sweeps is enough to find one if there
+ * is one.
+ */
+paddr_t
+coremap_pickvictim(struct addrspace **as, vaddr_t *vaddr)
+{
+	struct coremap_entry *cme;
+	unsigned i, n;
+	uint32_t pn;
+
+	n = 2 * (coremap_npages - coremap_firstpage);
+
+	spinlock_acquire(&coremap_lock);
+	for (i=0; i<n; i++) {
+		pn = coremap_clockhand;
+		coremap_clockhand++;
+		if (coremap_clockhand == coremap_npages) {
+			coremap_clockhand = coremap_firstpage;
+		}
+
+		cme = &coremap[pn];
+		if (cme->cme_state != CME_USER || !cme->cme_pageable ||
+		    cme->cme_busy) {
+			continue;
+		}
+		if (coremap_usebits[pn]) {
+			/* second chance */
+			coremap_usebits[pn] = 0;
+			continue;
+		}
+
+		cme->cme_busy = true;
+		*as = cme->cme_as;
+		*vaddr = cme->cme_vaddr;
+		spinlock_release(&coremap_lock);
+		return (paddr_t)pn * PAGE_SIZE;
+	}
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+unsigned
+coremap_freepages(void)
+{
+	unsigned nfree;
+
+	spinlock_acquire(&coremap_lock);
+	nfree = coremap_nfree;
+	if (coremap_zeroing != CM_NONE) {
+		nfree++;
+	}
+	spinlock_release(&coremap_lock);
+	return nfree;
+}
+
+unsigned
+coremap_userpages(unsigned *recent)
+{
+	unsigned nuser, nrecent;
+	uint32_t pn;
+
+	nuser = nrecent = 0;
+	spinlock_acquire(&coremap_lock);
+	for (pn = coremap_firstpage; pn < coremap_npages; pn++) {
+		if (coremap[pn].cme_state != CME_USER) {
+			continue;
+		}
+		nuser++;
+		if (coremap_usebits[pn]) {
+			nrecent++;
+		}
+	}
+	spinlock_release(&coremap_lock);
+	*recent = nrecent;
+	return nuser;
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	uint32_t pn;
+
+	coremap_can_sleep();
+	pn = coremap_alloc(npages, CME_KERNEL, NULL, 0, false);
+	if (pn == CM_NONE) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR((paddr_t)pn * PAGE_SIZE);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	KASSERT(addr >= PADDR_TO_KVADDR(0));
+	coremap_free(KVADDR_TO_PADDR(addr));
+}
+
+unsigned
+int
+coremap_used_bytes(void)
+{
+	unsigned nused;
+
+	spinlock_acquire(&coremap_lock);
+	nused = coremap_nused;
+	spinlock_release(&coremap_lock);
+
+	return nused * PAGE_SIZE;
+}
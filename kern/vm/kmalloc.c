@@ -30,7 +30,13 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <spl.h>
+#include <thread.h>
+#include <wchan.h>
 #include <vm.h>
+#include <platform/maxcpus.h>
 #include <kern/test161.h>
 #include <test.h>
 
@@ -162,13 +168,14 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the whole heap. Most allocations and frees of
+ * subpage blocks are satisfied from per-cpu magazines (see below)
+ * without touching it. It's an MCS lock, so that when many cpus do
+ * want it they queue up rather than all spinning on one word.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock kmalloc_spinlock =
+	SPINLOCK_INITIALIZER_KIND(SPINLOCK_MCS);
 
 ////////////////////////////////////////
 
@@ -349,6 +356,104 @@ static struct pageref *allbase;
 
 ////////////////////////////////////////
 
+/*
+ * Map from physical page number to the pageref for that page, if
+ * it's a subpage allocator page. Entries are the index of the
+ * pageref in kheaproots plus one, or 0 for pages that aren't ours.
+ *
+ * This lets kfree find the block size for a pointer without taking
+ * kmalloc_spinlock. Entries are written only under the lock, and
+ * only when the page has no blocks allocated on it; so the entry for
+ * a page holding a block that's validly being freed can't change
+ * underneath the caller, and neither can the pageref it points to.
+ *
+ * Like the pageref table, this is statically sized for 16M of RAM.
+ */
+
+#define KHEAP_MAXPAGES ((16*1024*1024) / PAGE_SIZE)
+
+static uint16_t kheap_pagemap[KHEAP_MAXPAGES];
+
+/*
+ * Record that PR's page belongs to the subpage allocator.
+ */
+static
+void
+pagemap_set(struct pageref *pr)
+{
+	unsigned whichroot, ix = 0;
+	struct pagerefpage *page;
+	paddr_t pa;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
+		page = kheaproots[whichroot].page;
+		if (page == NULL) {
+			continue;
+		}
+		/* note: ix is unsigned, don't test < 0 */
+		ix = pr - page->refs;
+		if (ix < NPAGEREFS_PER_PAGE) {
+			break;
+		}
+	}
+	KASSERT(whichroot < NUM_PAGEREFPAGES);
+
+	pa = KVADDR_TO_PADDR(PR_PAGEADDR(pr));
+	KASSERT(pa / PAGE_SIZE < KHEAP_MAXPAGES);
+	KASSERT(kheap_pagemap[pa / PAGE_SIZE] == 0);
+	kheap_pagemap[pa / PAGE_SIZE] =
+		whichroot * NPAGEREFS_PER_PAGE + ix + 1;
+}
+
+/*
+ * Record that the page at PRPAGE no longer belongs to the subpage
+ * allocator.
+ */
+static
+void
+pagemap_clear(vaddr_t prpage)
+{
+	paddr_t pa;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	pa = KVADDR_TO_PADDR(prpage);
+	KASSERT(pa / PAGE_SIZE < KHEAP_MAXPAGES);
+	KASSERT(kheap_pagemap[pa / PAGE_SIZE] != 0);
+	kheap_pagemap[pa / PAGE_SIZE] = 0;
+}
+
+/*
+ * Get the pageref for the subpage allocator page containing ADDR,
+ * or NULL if it isn't one.
+ */
+static
+struct pageref *
+pagemap_lookup(vaddr_t addr)
+{
+	paddr_t pa;
+	unsigned ix;
+
+	if (addr < PADDR_TO_KVADDR(0)) {
+		return NULL;
+	}
+	pa = KVADDR_TO_PADDR(addr);
+	if (pa / PAGE_SIZE >= KHEAP_MAXPAGES) {
+		return NULL;
+	}
+	ix = kheap_pagemap[pa / PAGE_SIZE];
+	if (ix == 0) {
+		return NULL;
+	}
+	ix--;
+	return &kheaproots[ix / NPAGEREFS_PER_PAGE].page->
+		refs[ix % NPAGEREFS_PER_PAGE];
+}
+
+////////////////////////////////////////
+
 #ifdef GUARDS
 
 /* Space returned to the client is filled with GUARD_RETBYTE */
@@ -452,6 +557,90 @@ checkguardband(vaddr_t blockaddr, size_t smallerblocksize, size_t blocksize)
 #endif
 #endif
 
+/*
+ * Per-cpu magazines are turned off with SLOW, which wants to check
+ * every free against the heap, and with LABELS, which wants every
+ * free block to be visibly free in the heap dump.
+ */
+#if !defined(SLOW) && !defined(LABELS)
+#define MAGAZINES
+#endif
+
+#ifdef MAGAZINES
+
+/*
+ * Per-cpu magazines.
+ *
+ * Each cpu keeps, for each block size, a small stack (a "magazine")
+ * of free blocks. kmalloc and kfree use the current cpu's magazine
+ * with interrupts off and no lock; only when it runs empty or full
+ * do they go to the shared heap under kmalloc_spinlock, and then
+ * they move half a magazine's worth of blocks at once.
+ *
+ * Blocks in magazines still count as allocated as far as the heap
+ * pages are concerned, so they're filled with deadbeef on the way in
+ * and subtracted back out in kheap_getused. Large block sizes get
+ * smaller magazines so they don't tie up too much memory: no more
+ * than half a page per cpu per size.
+ *
+ * The magazine array is indexed by cpu number. Magazines are not
+ * used before curcpu exists.
+ */
+
+#define KMAG_ROUNDS 16
+
+struct kmagazine {
+	unsigned km_count;
+	vaddr_t km_rounds[KMAG_ROUNDS];
+};
+
+static struct kmagazine kmagazines[MAXCPUS][NSIZES];
+
+/* Stats, protected by kmalloc_spinlock */
+static unsigned long kmag_refills;
+static unsigned long kmag_drains;
+
+static
+inline
+unsigned
+kmag_limit(unsigned blktype)
+{
+	unsigned n;
+
+	n = PAGE_SIZE / sizes[blktype] / 2;
+	return n < KMAG_ROUNDS ? n : KMAG_ROUNDS;
+}
+
+static
+inline
+unsigned
+kmag_batch(unsigned blktype)
+{
+	return (kmag_limit(blktype) + 1) / 2;
+}
+
+/*
+ * Count the bytes sitting in magazines. This reads other cpus'
+ * magazines without synchronization, so it's only exact when the
+ * system is quiet.
+ */
+static
+unsigned long
+kmag_cachedbytes(void)
+{
+	unsigned long total = 0;
+	unsigned i, j;
+
+	for (i=0; i<MAXCPUS; i++) {
+		for (j=0; j<NSIZES; j++) {
+			total += kmagazines[i][j].km_count * sizes[j];
+		}
+	}
+	return total;
+}
+
+#endif /* MAGAZINES */
+
 #ifdef CHECKBEEF
 /*
  * Check that a (free) block contains deadbeef as it should.
@@ -799,6 +988,11 @@ subpage_stats(struct pageref *pr, bool quiet)
 	return ((unsigned long)sizes[blktype] * (n - (unsigned) pr->nfree));
 }
 
+/* Object cache functions used below; see the end of the file. */
+static void kmem_reapall(void);
+static unsigned long kmem_freebytes(void);
+static void kmem_printstats(void);
+
 /*
  * Print the whole heap.
  */
@@ -807,6 +1001,8 @@ kheap_printstats(void)
 {
 	struct pageref *pr;
 
+	kmem_printstats();
+
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
@@ -816,6 +1012,11 @@ kheap_printstats(void)
 		subpage_stats(pr, false);
 	}
 
+#ifdef MAGAZINES
+	kprintf("Magazines: %lu bytes cached, %lu refills, %lu drains\n",
+		kmag_cachedbytes(), kmag_refills, kmag_drains);
+#endif
+
 	spinlock_release(&kmalloc_spinlock);
 }
 
@@ -837,6 +1038,14 @@ kheap_getused(void) {
 		num_pages++;
 	}
 
+#ifdef MAGAZINES
+	// Blocks cached in magazines aren't in use.
+	total -= kmag_cachedbytes();
+#endif
+
+	// Neither is the free space in object cache slabs.
+	total -= kmem_freebytes();
+
 	coremap_bytes = coremap_used_bytes();
 
 	// Don't double-count the pages we're using for subpage allocation;
@@ -858,6 +1067,10 @@ void
 kheap_printused(void)
 {
 	char total_string[32];
+
+	/* Give back memory the object caches are holding for reuse. */
+	kmem_reapall();
+
 	snprintf(total_string, sizeof(total_string), "%lu", kheap_getused());
 	secprintf(SECRET, total_string, "khu");
 }
@@ -915,18 +1128,16 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Take a block off the freelist of a page of blocks of type BLKTYPE,
+ * getting a fresh page if there are none with free blocks. Returns
+ * the raw block (without guard bands or labels), or NULL if out of
+ * memory. Called with kmalloc_spinlock held, and returns with it
+ * held, but may release it in the middle.
  */
 static
 void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+subpage_allocblock(unsigned blktype)
 {
-	unsigned blktype;	// index into sizes[] that we're using
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
@@ -935,27 +1146,7 @@ subpage_kmalloc(size_t sz
 
 	volatile int i;
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
-
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-#ifdef GUARDS
-	sz = sizes[blktype];
-#endif
-
-	spinlock_acquire(&kmalloc_spinlock);
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	checksubpages();
 
@@ -988,16 +1179,9 @@ subpage_kmalloc(size_t sz
 				KASSERT(pr->nfree == 0);
 				pr->freelist_offset = INVALID_OFFSET;
 			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
 
 			checksubpages();
 
-			spinlock_release(&kmalloc_spinlock);
 			return retptr;
 		}
 	}
@@ -1016,6 +1200,7 @@ subpage_kmalloc(size_t sz
 	if (prpage==0) {
 		/* Out of memory. */
 		silent("kmalloc: Subpage allocator couldn't get a page\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 	KASSERT(prpage % PAGE_SIZE == 0);
@@ -1031,6 +1216,7 @@ subpage_kmalloc(size_t sz
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 
@@ -1061,100 +1247,39 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
+	pagemap_set(pr);
+
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
 
 /*
- * Free a pointer previously returned from subpage_kmalloc. If the
- * pointer is not on any heap page we recognize, return -1.
+ * Put the raw block at PTRADDR back on the freelist of its page PR.
+ * If that makes the whole page free, take the page out of the heap
+ * and return its address, which the caller should pass to
+ * free_kpages after releasing kmalloc_spinlock. Otherwise return 0.
  */
 static
-int
-subpage_kfree(void *ptr)
+vaddr_t
+subpage_freeblock(struct pageref *pr, vaddr_t ptraddr)
 {
 	int blktype;		// index into sizes[] that we're using
-	vaddr_t ptraddr;	// same as ptr
-	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
 	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
-#ifdef GUARDS
-	size_t blocksize, smallerblocksize;
-#endif
-
-	ptraddr = (vaddr_t)ptr;
-#ifdef GUARDS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/*
-		 * With guard bands, all client-facing subpage
-		 * pointers are offset by GUARD_PTROFFSET (which is 4)
-		 * from the underlying blocks and are therefore not
-		 * page-aligned. So a page-aligned pointer is not one
-		 * of ours. Catch this up front, as otherwise
-		 * subtracting GUARD_PTROFFSET could give a pointer on
-		 * a page we *do* own, and then we'll panic because
-		 * it's not a valid one.
-		 */
-		return -1;
-	}
-	ptraddr -= GUARD_PTROFFSET;
-#endif
-#ifdef LABELS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/* ditto */
-		return -1;
-	}
-	ptraddr -= LABEL_PTROFFSET;
-#endif
 
-	spinlock_acquire(&kmalloc_spinlock);
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	checksubpages();
 
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
+	checksubpage(pr);
 
 	offset = ptraddr - prpage;
-
-	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
-		panic("kfree: subpage free of invalid addr %p\n", ptr);
-	}
-
-#ifdef GUARDS
-	blocksize = sizes[blktype];
-	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
-	checkguardband(ptraddr, smallerblocksize, blocksize);
-#endif
-
-	/*
-	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
-	 */
-	fill_deadbeef((void *)ptraddr, sizes[blktype]);
+	KASSERT(offset < PAGE_SIZE && offset % sizes[blktype] == 0);
 
 	/*
 	 * We probably ought to check for free twice by seeing if the block
@@ -1188,50 +1313,322 @@ subpage_kfree(void *ptr)
 	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
+		pagemap_clear(prpage);
 		remove_lists(pr, blktype);
 		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
+		return prpage;
 	}
+	return 0;
+}
+
+////////////////////////////////////////
+
+#ifdef MAGAZINES
+
+/*
+ * Give NUM raw blocks back to the shared heap.
+ */
+static
+void
+kmag_return(vaddr_t *blocks, unsigned num)
+{
+	vaddr_t freepages[KMAG_ROUNDS];
+	unsigned i, nfreepages = 0;
+	vaddr_t page;
+
+	KASSERT(num <= KMAG_ROUNDS);
 
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
 	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
+	for (i=0; i<num; i++) {
+		page = subpage_freeblock(pagemap_lookup(blocks[i]), blocks[i]);
+		if (page != 0) {
+			freepages[nfreepages++] = page;
+		}
+	}
+	kmag_drains++;
 	spinlock_release(&kmalloc_spinlock);
-#endif
 
-	return 0;
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
 }
 
-//
-////////////////////////////////////////////////////////////
-
 /*
- * Allocate a block of size SZ. Redirect either to subpage_kmalloc or
- * alloc_kpages depending on how big SZ is.
+ * Get a raw block of type BLKTYPE from the current cpu's magazine,
+ * refilling it from the shared heap if it's empty.
  */
+static
 void *
-kmalloc(size_t sz)
+kmag_alloc(unsigned blktype)
 {
-	size_t checksz;
-#ifdef LABELS
-	vaddr_t label;
-#endif
-
-#ifdef LABELS
-#ifdef __GNUC__
-	label = (vaddr_t)__builtin_return_address(0);
-#else
-#error "Don't know how to get return address with this compiler"
-#endif /* __GNUC__ */
-#endif /* LABELS */
+	struct kmagazine *mag;
+	vaddr_t blocks[KMAG_ROUNDS];
+	unsigned num, batch;
+	void *ret;
+	int spl;
+
+	spl = splhigh();
+	mag = &kmagazines[curcpu->c_number][blktype];
+	if (mag->km_count > 0) {
+		ret = (void *)mag->km_rounds[--mag->km_count];
+		splx(spl);
+		return ret;
+	}
+	splx(spl);
 
-	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
-	if (checksz >= LARGEST_SUBPAGE_SIZE) {
+	/*
+	 * Empty. Get a batch from the heap. Don't do this with
+	 * interrupts off: the heap may need to call alloc_kpages,
+	 * and we might not be on the same cpu afterwards anyway.
+	 */
+	batch = kmag_batch(blktype);
+	spinlock_acquire(&kmalloc_spinlock);
+	for (num=0; num<batch; num++) {
+		ret = subpage_allocblock(blktype);
+		if (ret == NULL) {
+			break;
+		}
+		blocks[num] = (vaddr_t)ret;
+	}
+	kmag_refills++;
+	spinlock_release(&kmalloc_spinlock);
+
+	if (num == 0) {
+		return NULL;
+	}
+	ret = (void *)blocks[--num];
+
+	/* Load the rest into whatever cpu we're on now. */
+	spl = splhigh();
+	mag = &kmagazines[curcpu->c_number][blktype];
+	while (num > 0 && mag->km_count < kmag_limit(blktype)) {
+		mag->km_rounds[mag->km_count++] = blocks[--num];
+	}
+	splx(spl);
+
+	/* If it filled up in the meantime, return the leftovers. */
+	if (num > 0) {
+		kmag_return(blocks, num);
+	}
+	return ret;
+}
+
+/*
+ * Put a raw block of type BLKTYPE into the current cpu's magazine,
+ * draining a batch to the shared heap if it's full.
+ */
+static
+void
+kmag_free(unsigned blktype, vaddr_t block)
+{
+	struct kmagazine *mag;
+	vaddr_t blocks[KMAG_ROUNDS];
+	unsigned num = 0;
+	int spl;
+
+	spl = splhigh();
+	mag = &kmagazines[curcpu->c_number][blktype];
+	if (mag->km_count == kmag_limit(blktype)) {
+		while (num < kmag_batch(blktype)) {
+			blocks[num++] = mag->km_rounds[--mag->km_count];
+		}
+	}
+	mag->km_rounds[mag->km_count++] = block;
+	splx(spl);
+
+	if (num > 0) {
+		kmag_return(blocks, num);
+	}
+}
+
+#endif /* MAGAZINES */
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+#ifdef GUARDS
+	sz = sizes[blktype];
+#endif
+
+#ifdef MAGAZINES
+	if (CURCPU_EXISTS()) {
+		retptr = kmag_alloc(blktype);
+	}
+	else
+#endif
+	{
+		spinlock_acquire(&kmalloc_spinlock);
+		retptr = subpage_allocblock(blktype);
+		spinlock_release(&kmalloc_spinlock);
+	}
+	if (retptr == NULL) {
+		return NULL;
+	}
+
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+#endif
+	return retptr;
+}
+
+/*
+ * Free a pointer previously returned from subpage_kmalloc. If the
+ * pointer is not on any heap page we recognize, return -1.
+ */
+static
+int
+subpage_kfree(void *ptr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t ptraddr;	// same as ptr
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t offset;		// offset into page
+	vaddr_t freepage;	// page to give back, if any
+#ifdef GUARDS
+	size_t blocksize, smallerblocksize;
+#endif
+
+	ptraddr = (vaddr_t)ptr;
+#ifdef GUARDS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/*
+		 * With guard bands, all client-facing subpage
+		 * pointers are offset by GUARD_PTROFFSET (which is 4)
+		 * from the underlying blocks and are therefore not
+		 * page-aligned. So a page-aligned pointer is not one
+		 * of ours. Catch this up front, as otherwise
+		 * subtracting GUARD_PTROFFSET could give a pointer on
+		 * a page we *do* own, and then we'll panic because
+		 * it's not a valid one.
+		 */
+		return -1;
+	}
+	ptraddr -= GUARD_PTROFFSET;
+#endif
+#ifdef LABELS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/* ditto */
+		return -1;
+	}
+	ptraddr -= LABEL_PTROFFSET;
+#endif
+
+	/*
+	 * Find the page without the lock; see the comment on
+	 * kheap_pagemap for why this is safe.
+	 */
+	pr = pagemap_lookup(ptraddr);
+	if (pr == NULL) {
+		/* Not on any of our pages - not a subpage allocation */
+		return -1;
+	}
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
+
+	offset = ptraddr - prpage;
+
+	/* Check for proper positioning and alignment */
+	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+#ifdef GUARDS
+	blocksize = sizes[blktype];
+	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
+	checkguardband(ptraddr, smallerblocksize, blocksize);
+#endif
+
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef((void *)ptraddr, sizes[blktype]);
+
+#ifdef MAGAZINES
+	if (CURCPU_EXISTS()) {
+		kmag_free(blktype, ptraddr);
+		return 0;
+	}
+#endif
+
+	spinlock_acquire(&kmalloc_spinlock);
+	freepage = subpage_freeblock(pr, ptraddr);
+	spinlock_release(&kmalloc_spinlock);
+
+	if (freepage != 0) {
+		/* Call free_kpages without kmalloc_spinlock. */
+		free_kpages(freepage);
+	}
+
+#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+#endif
+
+	return 0;
+}
+
+//
+////////////////////////////////////////////////////////////
+
+/*
+ * Allocate a block of size SZ. Redirect either to subpage_kmalloc or
+ * alloc_kpages depending on how big SZ is.
+ */
+void *
+kmalloc(size_t sz)
+{
+	size_t checksz;
+#ifdef LABELS
+	vaddr_t label;
+#endif
+
+#ifdef LABELS
+#ifdef __GNUC__
+	label = (vaddr_t)__builtin_return_address(0);
+#else
+#error "Don't know how to get return address with this compiler"
+#endif /* __GNUC__ */
+#endif /* LABELS */
+
+	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
+	if (checksz >= LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
 
@@ -1270,3 +1667,565 @@ kfree(void *ptr)
 	}
 }
 
+
+////////////////////////////////////////////////////////////
+//
+// Object caches.
+//
+// A kmem_cache hands out objects of one exact size, packed into whole
+// pages ("slabs") rather than rounded up to one of the subpage sizes.
+// The objects go at the front of the slab page; at the back is a
+// struct kmem_slab, preceded by a stack of the indexes of the slab's
+// free objects and a flag per object saying whether it's constructed.
+// So the slab an object belongs to can be found from its address,
+// and free objects are never written to by the cache.
+//
+// If the cache has a constructor, an object is constructed the first
+// time it's handed out and is expected to come back in the same
+// state, so the next user of it doesn't have to pay for that again.
+// The destructor is run only when the memory is actually given back,
+// which is when the cache is reaped or destroyed. Constructors and
+// destructors are called without any spinlocks held.
+//
+// Each cache keeps its slabs on three lists: partial, full, and
+// empty. Allocation prefers partial slabs so that empty ones can be
+// given back. Up to KMEM_MAXEMPTY empty slabs are kept around to
+// avoid thrashing; kmem_cache_reap gives back all of them, and
+// destroys all the free constructed objects in other slabs.
+//
+
+#define KMEM_MAXEMPTY	1
+#define KMEM_ALIGN	8
+
+struct kmem_slab {
+	struct kmem_cache *ks_cache;	/* cache this slab belongs to */
+	struct kmem_slab **ks_list;	/* which list it's on */
+	struct kmem_slab *ks_prev;	/* links on that list */
+	struct kmem_slab *ks_next;
+	unsigned ks_inuse;		/* objects handed out */
+	unsigned ks_nfree;		/* entries in ks_free */
+	uint16_t *ks_free;		/* stack of free object indexes */
+	uint8_t *ks_constructed;	/* per-object constructed flags */
+};
+
+struct kmem_cache {
+	const char *kc_name;		/* for printing stats */
+	size_t kc_size;			/* object size, rounded for alignment */
+	unsigned kc_perslab;		/* objects per slab */
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+	struct spinlock kc_lock;	/* protects everything below */
+	struct kmem_slab *kc_partial;	/* slabs with some objects free */
+	struct kmem_slab *kc_full;	/* slabs with no objects free */
+	struct kmem_slab *kc_empty;	/* slabs with all objects free */
+	unsigned kc_nempty;		/* number of slabs on kc_empty */
+	unsigned kc_nslabs;		/* total slabs */
+	unsigned kc_inuse;		/* total objects handed out */
+	unsigned long kc_allocs;	/* stats */
+	unsigned long kc_frees;
+	unsigned long kc_ctors;
+	unsigned long kc_dtors;
+
+	/* Protected by kmem_cachelist_lock */
+	struct kmem_cache *kc_next;	/* all caches */
+	unsigned kc_busy;		/* being reaped; don't destroy */
+	struct wchan *kc_wchan;		/* wait here for kc_busy to drop */
+};
+
+#define KMEM_SLAB(obj) \
+	((struct kmem_slab *)(((vaddr_t)(obj) & PAGE_FRAME) + \
+			      PAGE_SIZE - sizeof(struct kmem_slab)))
+#define KMEM_SLABPAGE(ks) ((vaddr_t)(ks) & PAGE_FRAME)
+#define KMEM_OBJ(ks, ix) \
+	((void *)(KMEM_SLABPAGE(ks) + (ix) * (ks)->ks_cache->kc_size))
+
+static struct spinlock kmem_cachelist_lock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kmem_caches;
+
+/*
+ * Put a slab on the list that matches how many of its objects are in
+ * use, taking it off the one it was on.
+ */
+static
+void
+kmem_slab_relist(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	struct kmem_slab **want;
+
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	if (ks->ks_inuse == 0) {
+		want = &kc->kc_empty;
+	}
+	else if (ks->ks_nfree == 0) {
+		want = &kc->kc_full;
+	}
+	else {
+		want = &kc->kc_partial;
+	}
+	if (ks->ks_list == want) {
+		return;
+	}
+
+	if (ks->ks_list != NULL) {
+		if (ks->ks_prev != NULL) {
+			ks->ks_prev->ks_next = ks->ks_next;
+		}
+		else {
+			*ks->ks_list = ks->ks_next;
+		}
+		if (ks->ks_next != NULL) {
+			ks->ks_next->ks_prev = ks->ks_prev;
+		}
+		if (ks->ks_list == &kc->kc_empty) {
+			KASSERT(kc->kc_nempty > 0);
+			kc->kc_nempty--;
+		}
+	}
+
+	ks->ks_list = want;
+	ks->ks_prev = NULL;
+	ks->ks_next = *want;
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks;
+	}
+	*want = ks;
+	if (want == &kc->kc_empty) {
+		kc->kc_nempty++;
+	}
+}
+
+/*
+ * Take a slab off whatever list it's on, to give it back.
+ */
+static
+void
+kmem_slab_unlist(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+	KASSERT(ks->ks_list == &kc->kc_empty);
+
+	if (ks->ks_prev != NULL) {
+		ks->ks_prev->ks_next = ks->ks_next;
+	}
+	else {
+		kc->kc_empty = ks->ks_next;
+	}
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks->ks_prev;
+	}
+	ks->ks_list = NULL;
+	ks->ks_prev = ks->ks_next = NULL;
+	kc->kc_nempty--;
+	kc->kc_nslabs--;
+}
+
+/*
+ * Make a new slab for KC. Called without the cache lock.
+ */
+static
+struct kmem_slab *
+kmem_slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	vaddr_t page;
+	unsigned i;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+	KASSERT(page % PAGE_SIZE == 0);
+
+	ks = KMEM_SLAB(page);
+	ks->ks_cache = kc;
+	ks->ks_list = NULL;
+	ks->ks_prev = ks->ks_next = NULL;
+	ks->ks_inuse = 0;
+	ks->ks_nfree = kc->kc_perslab;
+	ks->ks_constructed = (uint8_t *)(page + kc->kc_perslab * kc->kc_size);
+	ks->ks_free = (uint16_t *)ks - kc->kc_perslab;
+	KASSERT((vaddr_t)ks->ks_free >=
+		(vaddr_t)(ks->ks_constructed + kc->kc_perslab));
+
+	/* Stack the indexes so that objects get used in address order. */
+	for (i=0; i<kc->kc_perslab; i++) {
+		ks->ks_free[i] = kc->kc_perslab - 1 - i;
+		ks->ks_constructed[i] = 0;
+		if (kc->kc_ctor == NULL) {
+			fill_deadbeef(KMEM_OBJ(ks, i), kc->kc_size);
+		}
+	}
+	return ks;
+}
+
+/*
+ * Give back a slab that's been taken off the lists. Called without
+ * the cache lock.
+ */
+static
+void
+kmem_slab_destroy(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	unsigned i, ndtors = 0;
+
+	KASSERT(ks->ks_cache == kc);
+	KASSERT(ks->ks_inuse == 0);
+	KASSERT(ks->ks_nfree == kc->kc_perslab);
+
+	for (i=0; i<kc->kc_perslab; i++) {
+		if (ks->ks_constructed[i] && kc->kc_dtor != NULL) {
+			kc->kc_dtor(KMEM_OBJ(ks, i));
+			ndtors++;
+		}
+	}
+	free_kpages(KMEM_SLABPAGE(ks));
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_dtors += ndtors;
+	spinlock_release(&kc->kc_lock);
+}
+
+/*
+ * Take the free object at position POS of the free stack of KS.
+ */
+static
+unsigned
+kmem_slab_take(struct kmem_cache *kc, struct kmem_slab *ks, unsigned pos)
+{
+	unsigned ix;
+
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+	KASSERT(pos < ks->ks_nfree);
+
+	ix = ks->ks_free[pos];
+	ks->ks_free[pos] = ks->ks_free[--ks->ks_nfree];
+	ks->ks_inuse++;
+	kc->kc_inuse++;
+	kmem_slab_relist(kc, ks);
+	return ix;
+}
+
+/*
+ * Return object IX to the free stack of KS. If that leaves one
+ * empty slab too many, take it off the lists and return it; the
+ * caller should pass it to kmem_slab_destroy after releasing the
+ * cache lock.
+ */
+static
+struct kmem_slab *
+kmem_slab_put(struct kmem_cache *kc, struct kmem_slab *ks, unsigned ix)
+{
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+	KASSERT(ks->ks_inuse > 0);
+	KASSERT(ks->ks_nfree < kc->kc_perslab);
+#ifdef SLOW
+	{
+		unsigned i;
+
+		for (i=0; i<ks->ks_nfree; i++) {
+			KASSERT(ks->ks_free[i] != ix);
+		}
+	}
+#endif
+
+	ks->ks_free[ks->ks_nfree++] = ix;
+	ks->ks_inuse--;
+	kc->kc_inuse--;
+	kmem_slab_relist(kc, ks);
+
+	if (ks->ks_inuse == 0 && kc->kc_nempty > KMEM_MAXEMPTY) {
+		kmem_slab_unlist(kc, ks);
+		return ks;
+	}
+	return NULL;
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	KASSERT(size > 0);
+	size = ROUNDUP(size, KMEM_ALIGN);
+	KASSERT(size <= PAGE_SIZE / 4);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_wchan = wchan_create(name);
+	if (kc->kc_wchan == NULL) {
+		kfree(kc);
+		return NULL;
+	}
+	kc->kc_name = name;
+	kc->kc_size = size;
+	/* Each object also needs a free stack entry and a flag. */
+	kc->kc_perslab = (PAGE_SIZE - sizeof(struct kmem_slab)) /
+		(size + sizeof(uint16_t) + sizeof(uint8_t));
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_partial = kc->kc_full = kc->kc_empty = NULL;
+	kc->kc_nempty = 0;
+	kc->kc_nslabs = 0;
+	kc->kc_inuse = 0;
+	kc->kc_allocs = kc->kc_frees = 0;
+	kc->kc_ctors = kc->kc_dtors = 0;
+	kc->kc_busy = 0;
+
+	spinlock_acquire(&kmem_cachelist_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmem_cachelist_lock);
+
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **pp;
+
+	spinlock_acquire(&kmem_cachelist_lock);
+	while (kc->kc_busy > 0) {
+		/* kheap_printused is reaping it; wait for that */
+		wchan_sleep(kc->kc_wchan, &kmem_cachelist_lock);
+	}
+	for (pp = &kmem_caches; *pp != kc; pp = &(*pp)->kc_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = kc->kc_next;
+	spinlock_release(&kmem_cachelist_lock);
+
+	kmem_cache_reap(kc);
+
+	KASSERT(kc->kc_inuse == 0);
+	KASSERT(kc->kc_nslabs == 0);
+	KASSERT(kc->kc_partial == NULL);
+	KASSERT(kc->kc_full == NULL);
+	KASSERT(kc->kc_empty == NULL);
+	spinlock_cleanup(&kc->kc_lock);
+	wchan_destroy(kc->kc_wchan);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks, *newks = NULL;
+	unsigned ix;
+	bool construct;
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	ks = kc->kc_partial != NULL ? kc->kc_partial : kc->kc_empty;
+	if (ks == NULL) {
+		/* Get a new slab; don't hold the lock in alloc_kpages. */
+		spinlock_release(&kc->kc_lock);
+		newks = kmem_slab_create(kc);
+		if (newks == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&kc->kc_lock);
+		kc->kc_nslabs++;
+		ks = newks;
+	}
+
+	ix = kmem_slab_take(kc, ks, ks->ks_nfree - 1);
+	construct = kc->kc_ctor != NULL && !ks->ks_constructed[ix];
+	ks->ks_constructed[ix] = 1;
+	kc->kc_allocs++;
+	if (construct) {
+		kc->kc_ctors++;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	obj = KMEM_OBJ(ks, ix);
+	if (construct && kc->kc_ctor(obj)) {
+		/* Constructor failed; give it back unconstructed. */
+		spinlock_acquire(&kc->kc_lock);
+		ks->ks_constructed[ix] = 0;
+		ks = kmem_slab_put(kc, ks, ix);
+		spinlock_release(&kc->kc_lock);
+		if (ks != NULL) {
+			kmem_slab_destroy(kc, ks);
+		}
+		return NULL;
+	}
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks;
+	vaddr_t offset;
+
+	if (obj == NULL) {
+		return;
+	}
+
+	ks = KMEM_SLAB(obj);
+	offset = (vaddr_t)obj - KMEM_SLABPAGE(ks);
+	if (ks->ks_cache != kc || offset % kc->kc_size != 0 ||
+	    offset / kc->kc_size >= kc->kc_perslab) {
+		panic("kmem_cache_free: %s: invalid object %p\n",
+		      kc->kc_name, obj);
+	}
+
+	if (kc->kc_ctor == NULL) {
+		/* Nothing to preserve, so catch dangling pointers. */
+		fill_deadbeef(obj, kc->kc_size);
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_frees++;
+	ks = kmem_slab_put(kc, ks, offset / kc->kc_size);
+	spinlock_release(&kc->kc_lock);
+
+	if (ks != NULL) {
+		kmem_slab_destroy(kc, ks);
+	}
+}
+
+/*
+ * Find a free constructed object in KC, returning its slab and its
+ * position in the slab's free stack.
+ */
+static
+bool
+kmem_findconstructed(struct kmem_cache *kc, struct kmem_slab **ksret,
+		     unsigned *posret)
+{
+	struct kmem_slab *ks, *lists[2];
+	unsigned i, pos;
+
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	lists[0] = kc->kc_partial;
+	lists[1] = kc->kc_empty;
+	for (i=0; i<2; i++) {
+		for (ks = lists[i]; ks != NULL; ks = ks->ks_next) {
+			for (pos=0; pos<ks->ks_nfree; pos++) {
+				if (ks->ks_constructed[ks->ks_free[pos]]) {
+					*ksret = ks;
+					*posret = pos;
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+void
+kmem_cache_reap(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	unsigned pos, ix;
+
+	spinlock_acquire(&kc->kc_lock);
+
+	/*
+	 * Destroy the free constructed objects, one at a time, taking
+	 * each out of its slab while its destructor runs.
+	 */
+	while (kc->kc_dtor != NULL && kmem_findconstructed(kc, &ks, &pos)) {
+		ix = kmem_slab_take(kc, ks, pos);
+		ks->ks_constructed[ix] = 0;
+		kc->kc_dtors++;
+		spinlock_release(&kc->kc_lock);
+
+		kc->kc_dtor(KMEM_OBJ(ks, ix));
+
+		spinlock_acquire(&kc->kc_lock);
+		ks = kmem_slab_put(kc, ks, ix);
+		if (ks != NULL) {
+			spinlock_release(&kc->kc_lock);
+			kmem_slab_destroy(kc, ks);
+			spinlock_acquire(&kc->kc_lock);
+		}
+	}
+
+	/* Now give back all the empty slabs. */
+	while ((ks = kc->kc_empty) != NULL) {
+		kmem_slab_unlist(kc, ks);
+		spinlock_release(&kc->kc_lock);
+		kmem_slab_destroy(kc, ks);
+		spinlock_acquire(&kc->kc_lock);
+	}
+
+	spinlock_release(&kc->kc_lock);
+}
+
+/*
+ * Reap every cache. This is done before reporting heap usage, so
+ * that memory held for reuse doesn't look like a leak.
+ */
+static
+void
+kmem_reapall(void)
+{
+	struct kmem_cache *kc, *next;
+
+	spinlock_acquire(&kmem_cachelist_lock);
+	for (kc = kmem_caches; kc != NULL; kc = next) {
+		kc->kc_busy++;
+		spinlock_release(&kmem_cachelist_lock);
+
+		kmem_cache_reap(kc);
+
+		spinlock_acquire(&kmem_cachelist_lock);
+		next = kc->kc_next;
+		kc->kc_busy--;
+		if (kc->kc_busy == 0) {
+			wchan_wakeall(kc->kc_wchan, &kmem_cachelist_lock);
+		}
+	}
+	spinlock_release(&kmem_cachelist_lock);
+}
+
+/*
+ * Count the bytes in slab pages not occupied by objects in use.
+ */
+static
+unsigned long
+kmem_freebytes(void)
+{
+	struct kmem_cache *kc;
+	unsigned long total = 0;
+
+	spinlock_acquire(&kmem_cachelist_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		total += (unsigned long)kc->kc_nslabs * PAGE_SIZE -
+			(unsigned long)kc->kc_inuse * kc->kc_size;
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kmem_cachelist_lock);
+	return total;
+}
+
+static
+void
+kmem_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	kprintf("Object caches:\n");
+	spinlock_acquire(&kmem_cachelist_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		kprintf("%-16s size %-4lu %u/%u in use, %u slabs, "
+			"%lu allocs, %lu frees, %lu ctors, %lu dtors\n",
+			kc->kc_name, (unsigned long)kc->kc_size,
+			kc->kc_inuse, kc->kc_nslabs * kc->kc_perslab,
+			kc->kc_nslabs, kc->kc_allocs, kc->kc_frees,
+			kc->kc_ctors, kc->kc_dtors);
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kmem_cachelist_lock);
+}
@@ -0,0 +1,592 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Page cache for mmap.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <stat.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagecache.h>
+
+/*
+ * Number of hash chains per cache. Should be a power of 2.
+ */
+#define PAGECACHE_HASHSIZE	32
+
+/*
+ * One cached page. A page being read in is busy; it's in the cache,
+ * so nobody else reads it too, but it can't be used until it's done.
+ */
+struct pc_page {
+	off_t pp_offset;		/* where it is in the file */
+	paddr_t pp_paddr;		/* where it is in memory */
+	bool pp_dirty;			/* needs writing back */
+	bool pp_busy;			/* being read in */
+	struct pc_page *pp_next;	/* hash chain */
+};
+
+/*
+ * The cache for one file. pc_vnode is NULL for an anonymous cache.
+ * The pages are protected by pc_lock; pc_refcount and pc_next by
+ * pagecache_lock. pc_cv is for waiting for busy pages.
+ */
+struct pagecache {
+	struct vnode *pc_vnode;
+	unsigned pc_refcount;
+	struct lock *pc_lock;
+	struct cv *pc_cv;
+	struct pc_page *pc_hash[PAGECACHE_HASHSIZE];
+	struct pagecache *pc_next;
+};
+
+/*
+ * All the caches that have a file, for pagecache_reclaim. Each is
+ * also hung off its vnode's vn_pagecache, so mappings of the same
+ * file can find each other, and so can reads and writes of the file.
+ * pagecache_lock protects both. Never held while waiting for a
+ * pc_lock.
+ */
+static struct lock *pagecache_lock;
+static struct pagecache *pagecaches;
+
+static
+unsigned
+pc_hashfn(off_t offset)
+{
+	return (unsigned)(offset / PAGE_SIZE) & (PAGECACHE_HASHSIZE - 1);
+}
+
+static
+struct pc_page *
+pc_find(struct pagecache *pc, off_t offset)
+{
+	struct pc_page *pp;
+
+	KASSERT(lock_do_i_hold(pc->pc_lock));
+
+	for (pp = pc->pc_hash[pc_hashfn(offset)]; pp != NULL;
+	     pp = pp->pp_next) {
+		if (pp->pp_offset == offset) {
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Like pc_find, but wait if the page is being read in.
+ */
+static
+struct pc_page *
+pc_findwait(struct pagecache *pc, off_t offset)
+{
+	struct pc_page *pp;
+
+	while ((pp = pc_find(pc, offset)) != NULL && pp->pp_busy) {
+		cv_wait(pc->pc_cv, pc->pc_lock);
+	}
+	return pp;
+}
+
+/*
+ * Take PP out of the cache and free it.
+ */
+static
+void
+pc_remove(struct pagecache *pc, struct pc_page *pp)
+{
+	struct pc_page **ppp;
+
+	KASSERT(lock_do_i_hold(pc->pc_lock));
+
+	for (ppp = &pc->pc_hash[pc_hashfn(pp->pp_offset)]; *ppp != pp;
+	     ppp = &(*ppp)->pp_next) {
+		KASSERT(*ppp != NULL);
+	}
+	*ppp = pp->pp_next;
+	coremap_release(pp->pp_paddr, NULL);
+	kfree(pp);
+}
+
+/*
+ * Find the cache for file V and get a reference to it, or return
+ * NULL if there isn't one. Also returns NULL if the cache is locked
+ * by us: then this is its own I/O to the file.
+ *
+ * This is called for every read and write, and most files are never
+ * mapped, so check vn_pagecache without locking first. If a mapping
+ * is made as we look, it reads the file after we do, so it's as if
+ * the mapping came after this I/O.
+ */
+static
+struct pagecache *
+pc_lookup(struct vnode *v)
+{
+	struct pagecache *pc;
+
+	if (v->vn_pagecache == NULL) {
+		return NULL;
+	}
+
+	lock_acquire(pagecache_lock);
+	pc = v->vn_pagecache;
+	if (pc != NULL && lock_do_i_hold(pc->pc_lock)) {
+		pc = NULL;
+	}
+	if (pc != NULL) {
+		pc->pc_refcount++;
+	}
+	lock_release(pagecache_lock);
+	return pc;
+}
+
+/*
+ * Read in the page at OFFSET.
+ *
+ * The cache isn't kept locked during the read, so other pages of the
+ * file can be used meanwhile, and so the read can get at the cache
+ * itself (see pagecache_preio). The page goes in busy beforehand, so
+ * nobody else reads it too.
+ */
+static
+int
+pc_readpage(struct pagecache *pc, off_t offset, struct pc_page **ret)
+{
+	struct pc_page *pp;
+	struct iovec iov;
+	struct uio ku;
+	paddr_t pa;
+	void *kva;
+	int result;
+
+	KASSERT(lock_do_i_hold(pc->pc_lock));
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+	pa = coremap_allocuser(1);
+	if (pa == 0) {
+		kfree(pp);
+		return ENOMEM;
+	}
+	kva = (void *)PADDR_TO_KVADDR(pa);
+	bzero(kva, PAGE_SIZE);
+
+	pp->pp_offset = offset;
+	pp->pp_paddr = pa;
+	pp->pp_dirty = false;
+	pp->pp_busy = true;
+	pp->pp_next = pc->pc_hash[pc_hashfn(offset)];
+	pc->pc_hash[pc_hashfn(offset)] = pp;
+
+	result = 0;
+	if (pc->pc_vnode != NULL) {
+		/* A short read just means we're at end of file. */
+		lock_release(pc->pc_lock);
+		uio_kinit(&iov, &ku, kva, PAGE_SIZE, offset, UIO_READ);
+		result = VOP_READ(pc->pc_vnode, &ku);
+		lock_acquire(pc->pc_lock);
+	}
+
+	pp->pp_busy = false;
+	cv_broadcast(pc->pc_cv, pc->pc_lock);
+	if (result) {
+		pc_remove(pc, pp);
+		return result;
+	}
+	*ret = pp;
+	return 0;
+}
+
+/*
+ * Write back the page PP, or as much of it as is inside the file,
+ * which is SIZE bytes long.
+ */
+static
+int
+pc_writepage(struct pagecache *pc, struct pc_page *pp, off_t size)
+{
+	struct iovec iov;
+	struct uio ku;
+	size_t len;
+	int result;
+
+	if (pp->pp_offset < size) {
+		len = PAGE_SIZE;
+		if (size - pp->pp_offset < PAGE_SIZE) {
+			len = size - pp->pp_offset;
+		}
+		uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pp->pp_paddr),
+			  len, pp->pp_offset, UIO_WRITE);
+		result = VOP_WRITE(pc->pc_vnode, &ku);
+		if (result) {
+			return result;
+		}
+	}
+	/* Writes past end of file are just dropped. */
+	pp->pp_dirty = false;
+	return 0;
+}
+
+static
+struct pagecache *
+pc_create(struct vnode *v)
+{
+	struct pagecache *pc;
+	unsigned i;
+
+	pc = kmalloc(sizeof(*pc));
+	if (pc == NULL) {
+		return NULL;
+	}
+	pc->pc_lock = lock_create("pagecache");
+	if (pc->pc_lock == NULL) {
+		kfree(pc);
+		return NULL;
+	}
+	pc->pc_cv = cv_create("pagecache");
+	if (pc->pc_cv == NULL) {
+		lock_destroy(pc->pc_lock);
+		kfree(pc);
+		return NULL;
+	}
+	for (i=0; i<PAGECACHE_HASHSIZE; i++) {
+		pc->pc_hash[i] = NULL;
+	}
+	pc->pc_vnode = v;
+	if (v != NULL) {
+		VOP_INCREF(v);
+	}
+	pc->pc_refcount = 1;
+	pc->pc_next = NULL;
+	return pc;
+}
+
+static
+void
+pc_destroy(struct pagecache *pc)
+{
+	struct pc_page *pp;
+	unsigned i;
+	int result;
+
+	result = pagecache_flush(pc, 0, 0);
+	if (result) {
+		kprintf("pagecache: write-back failed: %s\n",
+			strerror(result));
+	}
+
+	for (i=0; i<PAGECACHE_HASHSIZE; i++) {
+		while ((pp = pc->pc_hash[i]) != NULL) {
+			KASSERT(!pp->pp_busy);
+			pc->pc_hash[i] = pp->pp_next;
+			coremap_release(pp->pp_paddr, NULL);
+			kfree(pp);
+		}
+	}
+	if (pc->pc_vnode != NULL) {
+		VOP_DECREF(pc->pc_vnode);
+	}
+	cv_destroy(pc->pc_cv);
+	lock_destroy(pc->pc_lock);
+	kfree(pc);
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+void
+pagecache_bootstrap(void)
+{
+	pagecache_lock = lock_create("pagecaches");
+	if (pagecache_lock == NULL) {
+		panic("pagecache_bootstrap: Out of memory\n");
+	}
+	pagecaches = NULL;
+}
+
+struct pagecache *
+pagecache_get(struct vnode *v)
+{
+	struct pagecache *pc;
+
+	if (v == NULL) {
+		return pc_create(NULL);
+	}
+
+	lock_acquire(pagecache_lock);
+	pc = v->vn_pagecache;
+	if (pc != NULL) {
+		pc->pc_refcount++;
+		lock_release(pagecache_lock);
+		return pc;
+	}
+	pc = pc_create(v);
+	if (pc != NULL) {
+		pc->pc_next = pagecaches;
+		pagecaches = pc;
+		v->vn_pagecache = pc;
+	}
+	lock_release(pagecache_lock);
+	return pc;
+}
+
+void
+pagecache_incref(struct pagecache *pc)
+{
+	lock_acquire(pagecache_lock);
+	KASSERT(pc->pc_refcount > 0);
+	pc->pc_refcount++;
+	lock_release(pagecache_lock);
+}
+
+void
+pagecache_decref(struct pagecache *pc)
+{
+	struct pagecache **pp;
+
+	lock_acquire(pagecache_lock);
+	KASSERT(pc->pc_refcount > 0);
+	pc->pc_refcount--;
+	if (pc->pc_refcount > 0) {
+		lock_release(pagecache_lock);
+		return;
+	}
+	if (pc->pc_vnode != NULL) {
+		for (pp = &pagecaches; *pp != pc; pp = &(*pp)->pc_next) {
+			KASSERT(*pp != NULL);
+		}
+		*pp = pc->pc_next;
+		KASSERT(pc->pc_vnode->vn_pagecache == pc);
+		pc->pc_vnode->vn_pagecache = NULL;
+	}
+	lock_release(pagecache_lock);
+
+	pc_destroy(pc);
+}
+
+int
+pagecache_getpage(struct pagecache *pc, off_t offset, paddr_t *ret)
+{
+	struct pc_page *pp;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	lock_acquire(pc->pc_lock);
+	pp = pc_findwait(pc, offset);
+	if (pp == NULL) {
+		result = pc_readpage(pc, offset, &pp);
+		if (result) {
+			lock_release(pc->pc_lock);
+			return result;
+		}
+	}
+	coremap_share(pp->pp_paddr);
+	*ret = pp->pp_paddr;
+	lock_release(pc->pc_lock);
+	return 0;
+}
+
+void
+pagecache_markdirty(struct pagecache *pc, off_t offset)
+{
+	struct pc_page *pp;
+
+	lock_acquire(pc->pc_lock);
+	pp = pc_find(pc, offset);
+	KASSERT(pp != NULL);
+	pp->pp_dirty = true;
+	lock_release(pc->pc_lock);
+}
+
+/*
+ * Write back the dirty pages from START for LEN bytes, or to the end
+ * if LEN is 0. Keeps going after an error, and returns the first.
+ */
+int
+pagecache_flush(struct pagecache *pc, off_t start, off_t len)
+{
+	struct pc_page *pp;
+	struct stat st;
+	bool gotsize;
+	unsigned i;
+	int result, ret;
+
+	lock_acquire(pc->pc_lock);
+	if (pc->pc_vnode == NULL) {
+		/* Nowhere to write it. */
+		lock_release(pc->pc_lock);
+		return 0;
+	}
+
+	gotsize = false;
+	ret = 0;
+	for (i=0; i<PAGECACHE_HASHSIZE; i++) {
+		for (pp = pc->pc_hash[i]; pp != NULL; pp = pp->pp_next) {
+			if (!pp->pp_dirty || pp->pp_offset + PAGE_SIZE <= start
+			    || (len > 0 && pp->pp_offset >= start + len)) {
+				continue;
+			}
+			if (!gotsize) {
+				/* Don't write anything past end of file. */
+				result = VOP_STAT(pc->pc_vnode, &st);
+				if (result) {
+					lock_release(pc->pc_lock);
+					return result;
+				}
+				gotsize = true;
+			}
+			result = pc_writepage(pc, pp, st.st_size);
+			if (result && ret == 0) {
+				ret = result;
+			}
+		}
+	}
+	lock_release(pc->pc_lock);
+	return ret;
+}
+
+int
+pagecache_preio(struct vnode *v, off_t offset, size_t len)
+{
+	struct pagecache *pc;
+	int result;
+
+	if (len == 0) {
+		return 0;
+	}
+	pc = pc_lookup(v);
+	if (pc == NULL) {
+		return 0;
+	}
+	result = pagecache_flush(pc, offset, len);
+	pagecache_decref(pc);
+	return result;
+}
+
+/*
+ * Read the part of each cached page that was written back in from the
+ * file. Only that part, so mappings never see anything else change.
+ */
+void
+pagecache_postwrite(struct vnode *v, off_t offset, size_t len)
+{
+	struct pagecache *pc;
+	struct pc_page *pp;
+	struct iovec iov;
+	struct uio ku;
+	off_t pos, start, end;
+	int result;
+
+	if (len == 0) {
+		return;
+	}
+	pc = pc_lookup(v);
+	if (pc == NULL) {
+		return;
+	}
+
+	lock_acquire(pc->pc_lock);
+	for (pos = offset - offset % PAGE_SIZE; pos < offset + (off_t)len;
+	     pos += PAGE_SIZE) {
+		pp = pc_findwait(pc, pos);
+		if (pp == NULL) {
+			continue;
+		}
+		start = pos < offset ? offset : pos;
+		end = pos + PAGE_SIZE;
+		if (end > offset + (off_t)len) {
+			end = offset + len;
+		}
+		uio_kinit(&iov, &ku,
+			  (char *)PADDR_TO_KVADDR(pp->pp_paddr) + (start - pos),
+			  end - start, start, UIO_READ);
+		result = VOP_READ(pc->pc_vnode, &ku);
+		if (result) {
+			/* Nothing better to do; it was just written. */
+			kprintf("pagecache: reload failed: %s\n",
+				strerror(result));
+		}
+	}
+	lock_release(pc->pc_lock);
+	pagecache_decref(pc);
+}
+
+/*
+ * Called by the pageout code, so it mustn't wait for any locks. Only
+ * clean pages nobody has mapped are let go; mapped pages are in use,
+ * and writing back dirty ones could need locks the caller holds.
+ * Anonymous caches aren't on the list, so their pages, which have no
+ * other copy, are never touched.
+ */
+unsigned
+pagecache_reclaim(unsigned max)
+{
+	struct pagecache *pc;
+	struct pc_page *pp, *next;
+	unsigned i, nfreed;
+
+	if (pagecache_lock == NULL || lock_do_i_hold(pagecache_lock) ||
+	    !lock_tryacquire(pagecache_lock)) {
+		return 0;
+	}
+
+	nfreed = 0;
+	for (pc = pagecaches; pc != NULL && nfreed < max; pc = pc->pc_next) {
+		if (lock_do_i_hold(pc->pc_lock) ||
+		    !lock_tryacquire(pc->pc_lock)) {
+			continue;
+		}
+		for (i=0; i<PAGECACHE_HASHSIZE && nfreed < max; i++) {
+			for (pp = pc->pc_hash[i]; pp != NULL && nfreed < max;
+			     pp = next) {
+				next = pp->pp_next;
+				if (pp->pp_busy || pp->pp_dirty ||
+				    coremap_isshared(pp->pp_paddr)) {
+					continue;
+				}
+				pc_remove(pc, pp);
+				nfreed++;
+			}
+		}
+		lock_release(pc->pc_lock);
+	}
+	lock_release(pagecache_lock);
+	return nfreed;
+}
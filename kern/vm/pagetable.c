@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Two-level page tables.
+ */
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i=0; i<PT_L1ENTRIES; i++) {
+		pt->pt_l2[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i, j;
+
+	for (i=0; i<PT_L1ENTRIES; i++) {
+		if (pt->pt_l2[i] == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2ENTRIES; j++) {
+			KASSERT(pt->pt_l2[i][j] == 0);
+		}
+		kfree(pt->pt_l2[i]);
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t va, bool create)
+{
+	unsigned l1;
+	pte_t *l2;
+
+	KASSERT(va < USERSPACETOP);
+
+	l1 = PT_L1INDEX(va);
+	l2 = pt->pt_l2[l1];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = kmalloc(PT_L2ENTRIES * sizeof(pte_t));
+		if (l2 == NULL) {
+			return NULL;
+		}
+		bzero(l2, PT_L2ENTRIES * sizeof(pte_t));
+		pt->pt_l2[l1] = l2;
+	}
+	return &l2[PT_L2INDEX(va)];
+}
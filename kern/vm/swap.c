@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Swap space management.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/sfs.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <stat.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <swap.h>
+
+/*
+ * Swap goes on the first disk, of lhd0 through lhd<SWAP_MAXDISK>, that
+ * isn't mounted and doesn't have a filesystem on it. Normally that's
+ * lhd0.
+ */
+#define SWAP_MAXDISK	7
+
+/*
+ * Global state. The reference counts and rotor are protected by
+ * swap_lock; the cluster buffer by swap_buflock. The rest is fixed
+ * after boot.
+ *
+ * A slot is free when its reference count is 0. It can have more
+ * than one reference when a page that was swapped out is inherited
+ * by fork: each copy of the page table entry holds one.
+ */
+static struct vnode *swap_vnode;	/* swap device, or NULL */
+static char swap_devname[16];		/* its name */
+static unsigned swap_nslots;		/* size in pages */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+static uint16_t *swap_refs;		/* references to each slot */
+static unsigned swap_rotor;		/* where to start looking */
+static struct lock *swap_buflock;
+static char *swap_buf;			/* SWAP_CLUSTER pages */
+
+/*
+ * Check if the disk V has a filesystem on it, so we don't clobber it.
+ * SFS is the only kind we know about.
+ */
+static
+bool
+swap_hasfs(struct vnode *v)
+{
+	struct sfs_superblock *sb;
+	struct iovec iov;
+	struct uio ku;
+	bool ret;
+
+	sb = kmalloc(sizeof(*sb));
+	if (sb == NULL) {
+		/* Can't tell; be careful. */
+		return true;
+	}
+	uio_kinit(&iov, &ku, sb, sizeof(*sb),
+		  (off_t)SFS_SUPER_BLOCK * SFS_BLOCKSIZE, UIO_READ);
+	ret = VOP_READ(v, &ku) == 0 && ku.uio_resid == 0 &&
+		sb->sb_magic == SFS_MAGIC;
+	kfree(sb);
+	return ret;
+}
+
+/*
+ * Find a disk to swap on and attach it.
+ */
+static
+int
+swap_probe(void)
+{
+	unsigned i;
+	int result;
+
+	for (i=0; i<=SWAP_MAXDISK; i++) {
+		snprintf(swap_devname, sizeof(swap_devname), "lhd%u", i);
+		result = vfs_swapon(swap_devname, &swap_vnode);
+		if (result == ENODEV) {
+			/* no more disks */
+			break;
+		}
+		if (result) {
+			continue;
+		}
+		if (swap_hasfs(swap_vnode)) {
+			kprintf("swap: %s has a filesystem; not using it\n",
+				swap_devname);
+			vfs_swapoff(swap_devname);
+			VOP_DECREF(swap_vnode);
+			continue;
+		}
+		return 0;
+	}
+	swap_vnode = NULL;
+	return ENODEV;
+}
+
+void
+swap_bootstrap(void)
+{
+	struct stat st;
+	unsigned i;
+	int result;
+
+	result = swap_probe();
+	if (result) {
+		kprintf("swap: No disk available; running without swap\n");
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: stat of %s failed: %s\n", swap_devname,
+		      strerror(result));
+	}
+	swap_nslots = st.st_size / PAGE_SIZE;
+
+	swap_refs = kmalloc(swap_nslots * sizeof(swap_refs[0]));
+	swap_buflock = lock_create("swapbuf");
+	swap_buf = kmalloc(SWAP_CLUSTER * PAGE_SIZE);
+	if (swap_refs == NULL || swap_buflock == NULL || swap_buf == NULL) {
+		panic("swap: Out of memory\n");
+	}
+	for (i=0; i<swap_nslots; i++) {
+		swap_refs[i] = 0;
+	}
+	swap_rotor = 0;
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, swap_devname);
+}
+
+/*
+ * Find NSLOTS free slots in a row, starting from the rotor so that
+ * successive clusters are laid out one after another.
+ */
+int
+swap_alloc(unsigned nslots, uint32_t *ret)
+{
+	unsigned start, run, i, j, slot;
+
+	KASSERT(nslots > 0);
+
+	if (swap_vnode == NULL || nslots > swap_nslots) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	start = swap_rotor;
+	run = 0;
+	for (i=0; i < swap_nslots + nslots; i++) {
+		slot = (start + i) % swap_nslots;
+		if (slot == 0) {
+			/* runs can't wrap around */
+			run = 0;
+		}
+		if (swap_refs[slot] != 0) {
+			run = 0;
+			continue;
+		}
+		run++;
+		if (run == nslots) {
+			slot = slot + 1 - nslots;
+			for (j=0; j<nslots; j++) {
+				swap_refs[slot + j] = 1;
+			}
+			swap_rotor = (slot + nslots) % swap_nslots;
+			spinlock_release(&swap_lock);
+			*ret = slot;
+			return 0;
+		}
+	}
+	spinlock_release(&swap_lock);
+	return ENOSPC;
+}
+
+void
+swap_share(uint32_t slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(swap_refs[slot] > 0 && swap_refs[slot] < 0xffff);
+	swap_refs[slot]++;
+	spinlock_release(&swap_lock);
+}
+
+void
+swap_free(uint32_t slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(swap_refs[slot] > 0);
+	swap_refs[slot]--;
+	spinlock_release(&swap_lock);
+}
+
+int
+swap_read(uint32_t slot, paddr_t pa)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pa), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(swap_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * Copy the pages into the cluster buffer and write it in one go. The
+ * copy costs far less than the extra disk requests would.
+ */
+int
+swap_write(uint32_t slot, const paddr_t *pas, unsigned npages)
+{
+	struct iovec iov;
+	struct uio ku;
+	unsigned i;
+	int result;
+
+	KASSERT(npages > 0 && npages <= SWAP_CLUSTER);
+	KASSERT(slot + npages <= swap_nslots);
+
+	lock_acquire(swap_buflock);
+	for (i=0; i<npages; i++) {
+		memcpy(swap_buf + i * PAGE_SIZE,
+		       (const void *)PADDR_TO_KVADDR(pas[i]), PAGE_SIZE);
+	}
+	uio_kinit(&iov, &ku, swap_buf, npages * PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, UIO_WRITE);
+	result = VOP_WRITE(swap_vnode, &ku);
+	if (result == 0 && ku.uio_resid != 0) {
+		result = EIO;
+	}
+	lock_release(swap_buflock);
+	return result;
+}
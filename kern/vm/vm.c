@@ -0,0 +1,1010 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Demand-paged VM: the page fault handler, pageout, and TLB
+ * management.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <proc.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <mips/tlb.h>
+#include <mips/trapframe.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagecache.h>
+#include <vmstat.h>
+
+/*
+ * How many pages vm_pageout may look at to find a batch to evict.
+ */
+#define PAGEOUT_TRIES	(4 * SWAP_CLUSTER)
+
+/*
+ * Most address spaces a shared page can be mapped in and still be
+ * paged out.
+ */
+#define PAGEOUT_MAXMAPS	4
+
+/*
+ * One mapping of a page being paged out.
+ */
+struct pageout_map {
+	struct addrspace *pm_as;
+	pte_t *pm_pte;
+	pte_t pm_oldpte;	/* *pm_pte before we changed it */
+	bool pm_locked;		/* we locked pm_as for this page */
+	bool pm_shotdown;	/* TLBs are done with it */
+};
+
+/*
+ * One page being paged out, and everywhere it's mapped.
+ */
+struct pageout_victim {
+	paddr_t pv_paddr;
+	vaddr_t pv_vaddr;
+	unsigned pv_nmaps;
+	struct pageout_map pv_maps[PAGEOUT_MAXMAPS];
+	bool pv_dirty;		/* has to be written */
+	bool pv_evict;		/* going ahead with it */
+};
+
+static struct lock *vm_pageout_lock;	/* one pageout at a time */
+
+/*
+ * Working space for vm_pageout, protected by vm_pageout_lock. It's
+ * too big for the kernel stack, which a page fault may already be
+ * using a fair amount of.
+ */
+static struct {
+	struct pageout_victim pv[SWAP_CLUSTER];
+	paddr_t wpages[SWAP_CLUSTER];
+	vaddr_t vaddrs[SWAP_CLUSTER];
+} vm_pageout_scratch;
+
+/*
+ * Per-CPU address space ID state. Each CPU hands out its own ASIDs,
+ * in generations: once all NUM_ASID of them have been handed out,
+ * the CPU flushes its TLB and starts a new generation, and every
+ * address space has to get a new ASID the next time it runs there.
+ * An address space's as_asid[] holds, for each CPU, the generation
+ * times NUM_ASID plus the ASID; generation 0 is never used, so 0
+ * means none.
+ *
+ * va_curas is the address space whose ASID the CPU is using, the
+ * only one it might be loading new translations for; to get rid of
+ * another address space's translations there it's enough to make it
+ * forget the ASID, without interrupting it. (A CPU running a kernel
+ * thread keeps the address space it was using before.)
+ *
+ * All of this, including every as_asid[], is protected by
+ * vm_asid_lock. va_entryhi is also read by the CPU itself with just
+ * interrupts off.
+ */
+static struct {
+	uint32_t va_generation;		/* current generation */
+	unsigned va_nfree;		/* ASIDs left in it */
+	uint32_t va_entryhi;		/* current ASID, as TLBHI_PID bits */
+	struct addrspace *va_curas;	/* address space using it */
+	struct cpu *va_cpu;		/* the CPU */
+} vm_asids[MAXCPUS];
+static struct spinlock vm_asid_lock = SPINLOCK_INITIALIZER;
+
+void
+vm_bootstrap(void)
+{
+	vm_pageout_lock = lock_create("pageout");
+	if (vm_pageout_lock == NULL) {
+		panic("vm_bootstrap: Out of memory\n");
+	}
+	swap_bootstrap();
+	pagecache_bootstrap();
+	as_bootstrap();
+}
+
+////////////////////////////////////////////////////////////
+// TLB
+
+/*
+ * Load a translation for the current address space into the TLB,
+ * replacing any existing one for the same page.
+ */
+static
+void
+vm_tlbload(vaddr_t vaddr, paddr_t paddr, bool writeable)
+{
+	uint32_t ehi, elo;
+	int i, spl;
+
+	elo = paddr | TLBLO_VALID;
+	if (writeable) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	ehi = vaddr | vm_asids[curcpu->c_number].va_entryhi;
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+	}
+	else {
+		tlb_random(ehi, elo);
+	}
+	splx(spl);
+}
+
+/*
+ * Invalidate this CPU's whole TLB.
+ */
+void
+vm_tlbflush(void)
+{
+	int i, spl;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	/* That clobbered the current ASID; put it back. */
+	tlb_setasid(vm_asids[curcpu->c_number].va_entryhi);
+	splx(spl);
+}
+
+/*
+ * Load this CPU's current ASID, for address space va_curas, giving
+ * it a new one if it doesn't have one from the current generation.
+ */
+static
+void
+vm_asid_load(void)
+{
+	struct addrspace *as;
+	unsigned c;
+
+	KASSERT(spinlock_do_i_hold(&vm_asid_lock));
+
+	c = curcpu->c_number;
+	as = vm_asids[c].va_curas;
+	KASSERT(as != NULL);
+
+	if (as->as_asid[c] / NUM_ASID != vm_asids[c].va_generation) {
+		if (vm_asids[c].va_nfree == 0) {
+			/*
+			 * Rollover. Whatever's in the TLB may belong
+			 * to any ASID from the old generation, which
+			 * we're about to hand out again.
+			 */
+			vm_asids[c].va_generation++;
+			if (vm_asids[c].va_generation == 0xffffffff/NUM_ASID) {
+				/* Skip 0 when the generation wraps. */
+				vm_asids[c].va_generation = 1;
+			}
+			vm_asids[c].va_nfree = NUM_ASID;
+			vm_tlbflush();
+		}
+		as->as_asid[c] = vm_asids[c].va_generation * NUM_ASID +
+			(NUM_ASID - vm_asids[c].va_nfree);
+		vm_asids[c].va_nfree--;
+	}
+	vm_asids[c].va_entryhi =
+		(as->as_asid[c] % NUM_ASID) << TLBHI_PIDSHIFT;
+	tlb_setasid(vm_asids[c].va_entryhi);
+}
+
+/*
+ * Make AS the current address space on this CPU, and point the TLB
+ * refill handler at its page table.
+ */
+void
+vm_asid_activate(struct addrspace *as)
+{
+	unsigned c;
+
+	spinlock_acquire(&vm_asid_lock);
+	c = curcpu->c_number;
+	KASSERT(c < MAXCPUS);
+	vm_asids[c].va_curas = as;
+	vm_asids[c].va_cpu = curcpu->c_self;
+	cpupagetables[c] = (vaddr_t)as->as_pt;
+	vm_asid_load();
+	spinlock_release(&vm_asid_lock);
+}
+
+/*
+ * Forget about AS, which is being destroyed.
+ */
+void
+vm_asid_release(struct addrspace *as)
+{
+	unsigned c;
+
+	spinlock_acquire(&vm_asid_lock);
+	for (c=0; c<MAXCPUS; c++) {
+		if (vm_asids[c].va_curas == as) {
+			/*
+			 * Its ASID stays loaded, but it's never handed
+			 * out again this generation, and nothing uses
+			 * user addresses until another address space
+			 * is activated.
+			 */
+			vm_asids[c].va_curas = NULL;
+			cpupagetables[c] = 0;
+		}
+	}
+	spinlock_release(&vm_asid_lock);
+}
+
+/*
+ * Carry out shootdown TS on this CPU.
+ */
+static
+void
+vm_tlbinvalidate(const struct tlbshootdown *ts)
+{
+	struct addrspace *as = ts->ts_as;
+	uint32_t pid;
+	unsigned c, j;
+	int i;
+
+	KASSERT(spinlock_do_i_hold(&vm_asid_lock));
+
+	c = curcpu->c_number;
+	if (as->as_asid[c] / NUM_ASID != vm_asids[c].va_generation) {
+		/* Nothing for it in this TLB. */
+		return;
+	}
+
+	if (ts->ts_npages == TLBSHOOTDOWN_ALL) {
+		/* Abandon its ASID. */
+		as->as_asid[c] = 0;
+		if (vm_asids[c].va_curas == as) {
+			vm_asid_load();
+		}
+		return;
+	}
+
+	pid = (as->as_asid[c] % NUM_ASID) << TLBHI_PIDSHIFT;
+	for (j=0; j<ts->ts_npages; j++) {
+		i = tlb_probe(ts->ts_pages[j] | pid, 0);
+		if (i >= 0) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	/* The probes clobbered the current ASID; put it back. */
+	tlb_setasid(vm_asids[c].va_entryhi);
+}
+
+/*
+ * Get rid of the translations described by TS in every TLB, and wait
+ * until it's done. The page table must already have been changed.
+ *
+ * Only CPUs currently using the address space get an IPI (one, for
+ * the whole batch); the others just forget its ASID.
+ *
+ * The caller must keep the address space from being destroyed, by
+ * holding its as_lock or being its thread.
+ */
+static
+void
+vm_shootdown(struct tlbshootdown *ts)
+{
+	uint32_t targets;		/* one bit per CPU */
+	unsigned c, me;
+
+	COMPILE_ASSERT(MAXCPUS <= 32);
+
+	targets = 0;
+	spinlock_acquire(&vm_asid_lock);
+	me = curcpu->c_number;
+	for (c=0; c<MAXCPUS; c++) {
+		if (c == me) {
+			continue;
+		}
+		if (vm_asids[c].va_curas == ts->ts_as) {
+			targets |= (uint32_t)1 << c;
+		}
+		else {
+			ts->ts_as->as_asid[c] = 0;
+		}
+	}
+	vm_tlbinvalidate(ts);
+	spinlock_release(&vm_asid_lock);
+
+	/* va_cpu doesn't change once set, so it's safe to use here. */
+	for (c=0; c<MAXCPUS; c++) {
+		if (targets & ((uint32_t)1 << c)) {
+			ipi_tlbshootdown(vm_asids[c].va_cpu, ts);
+		}
+	}
+	for (c=0; c<MAXCPUS; c++) {
+		if (targets & ((uint32_t)1 << c)) {
+			ipi_tlbshootdown_wait(vm_asids[c].va_cpu);
+		}
+	}
+}
+
+/*
+ * Invalidate NPAGES pages of AS, starting at PAGES, everywhere.
+ */
+void
+vm_shootdown_pages(struct addrspace *as, const vaddr_t *pages,
+		   unsigned npages)
+{
+	struct tlbshootdown ts;
+	unsigned i;
+
+	ts.ts_as = as;
+	if (npages > TLBSHOOTDOWN_PAGES) {
+		ts.ts_npages = TLBSHOOTDOWN_ALL;
+	}
+	else {
+		ts.ts_npages = npages;
+		for (i=0; i<npages; i++) {
+			ts.ts_pages[i] = pages[i];
+		}
+	}
+	vm_shootdown(&ts);
+}
+
+/*
+ * Invalidate all of AS's translations everywhere.
+ */
+void
+vm_shootdown_as(struct addrspace *as)
+{
+	struct tlbshootdown ts;
+
+	ts.ts_as = as;
+	ts.ts_npages = TLBSHOOTDOWN_ALL;
+	vm_shootdown(&ts);
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	spinlock_acquire(&vm_asid_lock);
+	vm_tlbinvalidate(ts);
+	spinlock_release(&vm_asid_lock);
+}
+
+void
+vm_tlbshootdown_all(void)
+{
+	vm_tlbflush();
+}
+
+////////////////////////////////////////////////////////////
+// Paging
+
+/*
+ * Fill in a newly allocated, zeroed page PADDR for virtual address
+ * VADDR in region VR of AS: read in whatever parts of the region's
+ * file data fall in it. A page where two merged segments meet gets
+ * data from both.
+ */
+static
+int
+vm_fillpage(struct addrspace *as, struct vm_region *vr, vaddr_t vaddr,
+	    paddr_t paddr)
+{
+	const struct vm_filemap *fm;
+	vaddr_t kvaddr, start, end;
+	struct iovec iov;
+	struct uio ku;
+	bool filled = false;
+	unsigned i;
+	int result;
+
+	kvaddr = PADDR_TO_KVADDR(paddr);
+
+	for (i=0; vr->vr_vnode != NULL && i<vr->vr_nfilemaps; i++) {
+		fm = &vr->vr_filemaps[i];
+
+		start = vaddr;
+		if (start < fm->fm_vaddr) {
+			start = fm->fm_vaddr;
+		}
+		end = vaddr + PAGE_SIZE;
+		if (end > fm->fm_vaddr + fm->fm_size) {
+			end = fm->fm_vaddr + fm->fm_size;
+		}
+		if (start >= end) {
+			/* None of this file data is in the page. */
+			continue;
+		}
+		filled = true;
+
+		DEBUG(DB_VM, "vm: Loading %lu bytes to 0x%lx\n",
+		      (unsigned long)(end - start), (unsigned long)start);
+
+		uio_kinit(&iov, &ku, (void *)(kvaddr + (start - vaddr)),
+			  end - start,
+			  fm->fm_offset + (start - fm->fm_vaddr), UIO_READ);
+		result = VOP_READ(vr->vr_vnode, &ku);
+		if (result) {
+			return result;
+		}
+		if (ku.uio_resid != 0) {
+			/* short read; problem with executable? */
+			kprintf("vm: short read on segment - "
+				"file truncated?\n");
+			return ENOEXEC;
+		}
+	}
+
+	/* A page with no file data in it (e.g. bss) is just zeros. */
+	vmstat_inc(as, filled ? VMSTAT_FILEFILL : VMSTAT_ZEROFILL);
+	return 0;
+}
+
+/*
+ * Bring in the page at VADDR, whose entry is PTE: from swap if it's
+ * there, otherwise from scratch. Either way it starts out clean; a
+ * page read from swap keeps its slot as long as it stays clean, so
+ * it needn't be written again to be evicted.
+ *
+ * In an mmap region with a page cache, "from scratch" means mapping
+ * the cached page, copy-on-write unless the mapping is shared.
+ */
+static
+int
+vm_pagein(struct addrspace *as, struct vm_region *vr, vaddr_t vaddr,
+	  pte_t *pte)
+{
+	paddr_t paddr;
+	uint32_t slot;
+	int result;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT((*pte & PTE_VALID) == 0);
+
+	if ((*pte & PTE_SWAPPED) == 0 && vr->vr_cache != NULL) {
+		result = pagecache_getpage(vr->vr_cache,
+				vr->vr_cacheoffset + (vaddr - vr->vr_base),
+				&paddr);
+		if (result) {
+			return result;
+		}
+		*pte = paddr | PTE_VALID;
+		if ((vr->vr_flags & VR_SHARED) == 0) {
+			*pte |= PTE_COW;
+		}
+		vmstat_inc(as, VMSTAT_CACHEFILL);
+		return 0;
+	}
+
+	/* Pages filled from scratch start from a pre-zeroed one. */
+	paddr = coremap_allocpage(as, vaddr, (*pte & PTE_SWAPPED) == 0);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+
+	if (*pte & PTE_SWAPPED) {
+		slot = PTE_SLOT(*pte);
+		DEBUG(DB_VM, "vm: 0x%x in from slot %u\n", vaddr, slot);
+		result = swap_read(slot, paddr);
+		if (result == 0) {
+			coremap_setslot(paddr, slot);
+			vmstat_inc(as, VMSTAT_SWAPIN);
+		}
+	}
+	else {
+		result = vm_fillpage(as, vr, vaddr, paddr);
+	}
+	if (result) {
+		coremap_unpin(paddr);
+		coremap_free(paddr);
+		return result;
+	}
+
+	*pte = paddr | PTE_VALID;
+	coremap_unpin(paddr);
+	return 0;
+}
+
+/*
+ * Add AS's mapping of PV's page, if it has one, to PV. AS has to be
+ * locked for it to count; if we don't hold its lock already, we only
+ * try for it.
+ */
+static
+void
+vm_pageout_addmap(struct pageout_victim *pv, struct addrspace *as)
+{
+	struct pageout_map *pm;
+	pte_t *pte;
+	bool locked;
+
+	if (pv->pv_nmaps == PAGEOUT_MAXMAPS) {
+		return;
+	}
+	if (lock_do_i_hold(as->as_lock)) {
+		locked = false;
+	}
+	else if (lock_tryacquire(as->as_lock)) {
+		locked = true;
+	}
+	else {
+		return;
+	}
+
+	pte = pt_lookup(as->as_pt, pv->pv_vaddr, false);
+	if (pte == NULL || (*pte & PTE_VALID) == 0 ||
+	    (*pte & PTE_FRAME) != pv->pv_paddr) {
+		if (locked) {
+			lock_release(as->as_lock);
+		}
+		return;
+	}
+
+	pm = &pv->pv_maps[pv->pv_nmaps++];
+	pm->pm_as = as;
+	pm->pm_pte = pte;
+	pm->pm_oldpte = *pte;
+	pm->pm_locked = locked;
+	if (*pte & PTE_DIRTY) {
+		pv->pv_dirty = true;
+	}
+}
+
+/*
+ * Release the address space locks taken for PV.
+ */
+static
+void
+vm_pageout_unlockmaps(struct pageout_victim *pv)
+{
+	unsigned i;
+
+	for (i=0; i<pv->pv_nmaps; i++) {
+		if (pv->pv_maps[i].pm_locked) {
+			lock_release(pv->pv_maps[i].pm_as->as_lock);
+		}
+	}
+}
+
+/*
+ * Find and lock every mapping of the page PADDR, which the clock
+ * algorithm picked, found mapped at VADDR in AS (if not NULL). A
+ * page shared copy-on-write is mapped at the same address in every
+ * address space that has it, so the others can be found by looking
+ * there in all of them.
+ *
+ * Returns false, with nothing locked, unless every mapping was found.
+ * Once we hold all their address spaces, nobody can share the page
+ * or let go of it, so the count can't change after that.
+ */
+static
+bool
+vm_pageout_findmaps(struct pageout_victim *pv, paddr_t paddr,
+		    struct addrspace *as, vaddr_t vaddr)
+{
+	struct addrspace *other;
+	unsigned nrefs;
+
+	pv->pv_paddr = paddr;
+	pv->pv_vaddr = vaddr;
+	pv->pv_nmaps = 0;
+	pv->pv_dirty = false;
+	pv->pv_evict = false;
+
+	nrefs = coremap_refcount(paddr);
+	if (nrefs > PAGEOUT_MAXMAPS) {
+		return false;
+	}
+	if (as != NULL) {
+		vm_pageout_addmap(pv, as);
+	}
+	if (pv->pv_nmaps < nrefs && lock_tryacquire(as_listlock)) {
+		for (other = as_list; other != NULL && pv->pv_nmaps < nrefs;
+		     other = other->as_next) {
+			if (other != as) {
+				vm_pageout_addmap(pv, other);
+			}
+		}
+		lock_release(as_listlock);
+	}
+
+	if (pv->pv_nmaps > 0 && pv->pv_nmaps == coremap_refcount(paddr)) {
+		return true;
+	}
+	vm_pageout_unlockmaps(pv);
+	return false;
+}
+
+/*
+ * Get rid of the translations of the pages being evicted, in a batch
+ * per address space. (An address space maps each page once at most,
+ * so a batch is never more than SWAP_CLUSTER pages.)
+ */
+static
+void
+vm_pageout_shootdown(struct pageout_victim *pv, unsigned npv,
+		     vaddr_t *vaddrs)
+{
+	struct pageout_map *pm, *pm2;
+	unsigned i, j, k, l, n;
+
+	for (i=0; i<npv; i++) {
+		for (j=0; j<pv[i].pv_nmaps; j++) {
+			pv[i].pv_maps[j].pm_shotdown = !pv[i].pv_evict;
+		}
+	}
+	for (i=0; i<npv; i++) {
+		for (j=0; j<pv[i].pv_nmaps; j++) {
+			pm = &pv[i].pv_maps[j];
+			if (pm->pm_shotdown) {
+				continue;
+			}
+			n = 0;
+			for (k=i; k<npv; k++) {
+				for (l=0; l<pv[k].pv_nmaps; l++) {
+					pm2 = &pv[k].pv_maps[l];
+					if (!pm2->pm_shotdown &&
+					    pm2->pm_as == pm->pm_as) {
+						KASSERT(n < SWAP_CLUSTER);
+						vaddrs[n++] = pv[k].pv_vaddr;
+						pm2->pm_shotdown = true;
+					}
+				}
+			}
+			vm_shootdown_pages(pm->pm_as, vaddrs, n);
+		}
+	}
+}
+
+/*
+ * Evict a batch of up to SWAP_CLUSTER user pages picked by the clock
+ * algorithm. Clean pages are just dropped: either they still have a
+ * copy in swap, or they can be filled in again from scratch. Dirty
+ * pages are written to a run of consecutive swap slots in one I/O.
+ * A page shared copy-on-write goes to one slot, and every address
+ * space that had it gets a reference to the slot. But first, if the
+ * page cache has pages it can give up, take those instead.
+ *
+ * The address spaces mapping each victim have to be locked so they
+ * can't fault the page back in halfway through. We may already hold
+ * some address space locks (our own, if we got here from vm_fault),
+ * so to avoid deadlock we only try for the others, and skip pages
+ * if any of their address spaces is busy.
+ */
+unsigned
+vm_pageout(void)
+{
+	struct pageout_victim *pv;
+	struct pageout_map *pm;
+	paddr_t *wpages;
+	vaddr_t *vaddrs;
+	unsigned npv, nwrite, nslots, nfreed, i, j, tries;
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	uint32_t slot, wslot;
+	int result;
+
+	if (vm_pageout_lock == NULL || lock_do_i_hold(vm_pageout_lock)) {
+		/* Too early in boot, or recursing. */
+		return 0;
+	}
+	lock_acquire(vm_pageout_lock);
+
+	/* File pages nobody has mapped are the cheapest to let go. */
+	nfreed = pagecache_reclaim(SWAP_CLUSTER);
+	if (nfreed > 0) {
+		lock_release(vm_pageout_lock);
+		return nfreed;
+	}
+
+	pv = vm_pageout_scratch.pv;
+	wpages = vm_pageout_scratch.wpages;
+	vaddrs = vm_pageout_scratch.vaddrs;
+
+	/* Pick victims and lock their address spaces. */
+	npv = 0;
+	for (tries = 0; tries < PAGEOUT_TRIES && npv < SWAP_CLUSTER; tries++) {
+		paddr = coremap_pickvictim(&as, &vaddr);
+		if (paddr == 0) {
+			break;
+		}
+		if (vm_pageout_findmaps(&pv[npv], paddr, as, vaddr)) {
+			npv++;
+		}
+		else {
+			coremap_unpin(paddr);
+		}
+	}
+
+	/* Get swap for the dirty ones; as much of it in a row as we can. */
+	nwrite = 0;
+	for (i=0; i<npv; i++) {
+		if (pv[i].pv_dirty) {
+			nwrite++;
+		}
+	}
+	nslots = nwrite;
+	wslot = 0;
+	while (nslots > 0 && swap_alloc(nslots, &wslot) != 0) {
+		nslots /= 2;
+	}
+
+	/* Unmap them. */
+	nwrite = 0;
+	for (i=0; i<npv; i++) {
+		paddr = pv[i].pv_paddr;
+		if (pv[i].pv_dirty) {
+			if (nwrite == nslots) {
+				/* no swap for this one */
+				continue;
+			}
+			KASSERT(coremap_getslot(paddr) == CM_NONE);
+			slot = wslot + nwrite;
+			wpages[nwrite++] = paddr;
+		}
+		else {
+			slot = coremap_getslot(paddr);
+			if (slot != CM_NONE) {
+				coremap_setslot(paddr, CM_NONE);
+			}
+		}
+		for (j=0; j<pv[i].pv_nmaps; j++) {
+			pm = &pv[i].pv_maps[j];
+			if (slot == CM_NONE) {
+				*pm->pm_pte = 0;
+				continue;
+			}
+			if (j > 0) {
+				swap_share(slot);
+			}
+			*pm->pm_pte = PTE_MKSWAP(slot);
+		}
+		pv[i].pv_evict = true;
+	}
+
+	vm_pageout_shootdown(pv, npv, vaddrs);
+
+	if (nwrite > 0) {
+		DEBUG(DB_VM, "vm: %u pages out to slot %u\n", nwrite, wslot);
+		result = swap_write(wslot, wpages, nwrite);
+		if (result) {
+			kprintf("vm: swap write failed: %s\n",
+				strerror(result));
+			/* Put the dirty pages back. */
+			for (i=0; i<npv; i++) {
+				if (!pv[i].pv_evict || !pv[i].pv_dirty) {
+					continue;
+				}
+				for (j=0; j<pv[i].pv_nmaps; j++) {
+					pm = &pv[i].pv_maps[j];
+					swap_free(PTE_SLOT(*pm->pm_pte));
+					*pm->pm_pte = pm->pm_oldpte;
+				}
+				pv[i].pv_evict = false;
+			}
+		}
+	}
+	for (i=nwrite; i<nslots; i++) {
+		swap_free(wslot + i);
+	}
+
+	nfreed = 0;
+	for (i=0; i<npv; i++) {
+		coremap_unpin(pv[i].pv_paddr);
+		if (pv[i].pv_evict) {
+			as = pv[i].pv_maps[0].pm_as;
+			if (pv[i].pv_dirty) {
+				vmstat_inc(as, VMSTAT_SWAPOUT);
+			}
+			vmstat_inc(as, VMSTAT_EVICT);
+			for (j=0; j<pv[i].pv_nmaps; j++) {
+				coremap_release(pv[i].pv_paddr,
+						pv[i].pv_maps[j].pm_as);
+			}
+			nfreed++;
+		}
+	}
+	for (i=0; i<npv; i++) {
+		vm_pageout_unlockmaps(&pv[i]);
+	}
+
+	lock_release(vm_pageout_lock);
+	return nfreed;
+}
+
+/*
+ * Handle a write to a copy-on-write page: copy it, unless nobody else
+ * has it any more, in which case just take it over.
+ *
+ * Returns EAGAIN if the page went away while we were getting memory
+ * for the copy, which may have paged it out; the caller should start
+ * over.
+ */
+static
+int
+vm_cowbreak(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t oldpaddr, newpaddr;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT((*pte & (PTE_VALID | PTE_COW)) == (PTE_VALID | PTE_COW));
+
+	oldpaddr = *pte & PTE_FRAME;
+	if (!coremap_isshared(oldpaddr)) {
+		*pte &= ~PTE_COW;
+		vmstat_inc(as, VMSTAT_COWTAKE);
+		return 0;
+	}
+
+	newpaddr = coremap_allocpage(as, vaddr, false);
+	if (newpaddr == 0) {
+		return ENOMEM;
+	}
+	if ((*pte & PTE_VALID) == 0) {
+		coremap_unpin(newpaddr);
+		coremap_free(newpaddr);
+		return EAGAIN;
+	}
+	KASSERT((*pte & PTE_FRAME) == oldpaddr);
+	DEBUG(DB_VM, "vm: copying 0x%x for write\n", vaddr);
+	memmove((void *)PADDR_TO_KVADDR(newpaddr),
+		(const void *)PADDR_TO_KVADDR(oldpaddr), PAGE_SIZE);
+	*pte = newpaddr | PTE_VALID | PTE_DIRTY;
+	coremap_unpin(newpaddr);
+	vmstat_inc(as, VMSTAT_COWCOPY);
+	vm_shootdown_pages(as, &vaddr, 1);
+	coremap_release(oldpaddr, as);
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct vm_region *vr;
+	pte_t *pte;
+	paddr_t paddr;
+	uint32_t slot;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	lock_acquire(as->as_lock);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+		vmstat_inc(as, VMSTAT_FAULT_READONLY);
+		break;
+	    case VM_FAULT_READ:
+		vmstat_inc(as, VMSTAT_FAULT_READ);
+		break;
+	    case VM_FAULT_WRITE:
+		vmstat_inc(as, VMSTAT_FAULT_WRITE);
+		break;
+	}
+
+	vr = as_findregion(as, faultaddress);
+	if (vr == NULL ||
+	    (faulttype != VM_FAULT_READ && !vr->vr_writeable)) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+
+ again:
+	if ((*pte & PTE_VALID) == 0) {
+		result = vm_pagein(as, vr, faultaddress, pte);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+	}
+
+	if (faulttype != VM_FAULT_READ && (*pte & PTE_COW)) {
+		result = vm_cowbreak(as, faultaddress, pte);
+		if (result == EAGAIN) {
+			goto again;
+		}
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+	}
+	paddr = *pte & PTE_FRAME;
+
+	if (faulttype != VM_FAULT_READ && (*pte & PTE_DIRTY) == 0) {
+		/* First write; any copy in swap is now stale. */
+		*pte |= PTE_DIRTY;
+		slot = coremap_getslot(paddr);
+		if (slot != CM_NONE) {
+			coremap_setslot(paddr, CM_NONE);
+			swap_free(slot);
+		}
+		if (vr->vr_flags & VR_SHARED) {
+			/* The file will need it too. */
+			pagecache_markdirty(vr->vr_cache, vr->vr_cacheoffset +
+					    (faultaddress - vr->vr_base));
+		}
+	}
+
+	/* Writeable only if dirty already, and not shared. */
+	coremap_reference(paddr, as);
+	vm_tlbload(faultaddress, paddr,
+		   (*pte & (PTE_DIRTY | PTE_COW)) == PTE_DIRTY);
+
+	lock_release(as->as_lock);
+	return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * VM statistics.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <platform/maxcpus.h>
+#include <mips/trapframe.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <vmstat.h>
+
+static const char *const vmstat_names[VMSTAT_NCOUNTERS] = {
+	"TLB refills",
+	"Read faults",
+	"Write faults",
+	"Read-only faults",
+	"Zero fills",
+	"File reads",
+	"Page cache maps",
+	"Copy-on-write copies",
+	"Copy-on-write takeovers",
+	"Swap ins",
+	"Swap outs",
+	"Evictions",
+};
+
+/*
+ * System-wide counters, except TLB refills, which the refill handler
+ * counts per CPU in cputlbrefills[] (see exception-mips1.S).
+ */
+static struct spinlock vmstat_lock = SPINLOCK_INITIALIZER;
+static uint32_t vmstat_counters[VMSTAT_NCOUNTERS];
+
+/*
+ * Count AS's pages in memory, and how many of them have been used
+ * since the clock hand last went by.
+ */
+static
+void
+vmstat_resident(struct addrspace *as, uint32_t *resident, uint32_t *recent)
+{
+	struct pagetable *pt = as->as_pt;
+	unsigned i, j;
+	pte_t *l2;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	*resident = *recent = 0;
+	for (i=0; i<PT_L1ENTRIES; i++) {
+		l2 = pt->pt_l2[i];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2ENTRIES; j++) {
+			if ((l2[j] & PTE_VALID) == 0) {
+				continue;
+			}
+			(*resident)++;
+			if (coremap_usebits[(l2[j] & PTE_FRAME) / PAGE_SIZE]) {
+				(*recent)++;
+			}
+		}
+	}
+}
+
+void
+vmstat_inc(struct addrspace *as, unsigned counter)
+{
+	KASSERT(counter < VMSTAT_NCOUNTERS);
+
+	if (as != NULL) {
+		KASSERT(lock_do_i_hold(as->as_lock));
+		as->as_vmstat[counter]++;
+	}
+	spinlock_acquire(&vmstat_lock);
+	vmstat_counters[counter]++;
+	spinlock_release(&vmstat_lock);
+}
+
+void
+vmstat_get(struct addrspace *as, struct vmstat *vs)
+{
+	unsigned i;
+
+	if (as != NULL) {
+		lock_acquire(as->as_lock);
+		for (i=0; i<VMSTAT_NCOUNTERS; i++) {
+			vs->vs_counters[i] = as->as_vmstat[i];
+		}
+		vmstat_resident(as, &vs->vs_resident, &vs->vs_recent);
+		lock_release(as->as_lock);
+		return;
+	}
+
+	spinlock_acquire(&vmstat_lock);
+	for (i=0; i<VMSTAT_NCOUNTERS; i++) {
+		vs->vs_counters[i] = vmstat_counters[i];
+	}
+	spinlock_release(&vmstat_lock);
+	for (i=0; i<MAXCPUS; i++) {
+		vs->vs_counters[VMSTAT_TLBREFILL] += cputlbrefills[i];
+	}
+	vs->vs_resident = coremap_userpages(&vs->vs_recent);
+}
+
+void
+vmstat_printstats(void)
+{
+	struct addrspace *as;
+	struct vmstat vs;
+	unsigned i;
+
+	vmstat_get(NULL, &vs);
+	kprintf("VM: %u user pages in memory, %u recently used\n",
+		vs.vs_resident, vs.vs_recent);
+	for (i=0; i<VMSTAT_NCOUNTERS; i++) {
+		kprintf("    %-24s %u\n", vmstat_names[i],
+			vs.vs_counters[i]);
+	}
+
+	lock_acquire(as_listlock);
+	for (as = as_list; as != NULL; as = as->as_next) {
+		vmstat_get(as, &vs);
+		kprintf("Address space %p: %u pages in memory, "
+			"%u recently used\n", as, vs.vs_resident,
+			vs.vs_recent);
+		kprintf("    faults %u/%u/%u (r/w/ro), zero %u, file %u, "
+			"cache %u\n",
+			vs.vs_counters[VMSTAT_FAULT_READ],
+			vs.vs_counters[VMSTAT_FAULT_WRITE],
+			vs.vs_counters[VMSTAT_FAULT_READONLY],
+			vs.vs_counters[VMSTAT_ZEROFILL],
+			vs.vs_counters[VMSTAT_FILEFILL],
+			vs.vs_counters[VMSTAT_CACHEFILL]);
+		kprintf("    cow %u/%u (copied/taken), swap %u/%u (in/out), "
+			"evicted %u\n",
+			vs.vs_counters[VMSTAT_COWCOPY],
+			vs.vs_counters[VMSTAT_COWTAKE],
+			vs.vs_counters[VMSTAT_SWAPIN],
+			vs.vs_counters[VMSTAT_SWAPOUT],
+			vs.vs_counters[VMSTAT_EVICT]);
+	}
+	lock_release(as_listlock);
+}
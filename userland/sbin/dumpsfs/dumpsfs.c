@@ -73,6 +73,9 @@ static bool dofiles, dodirs;
 static bool doindirect;
 static bool recurse;
 
+/* Set while dumping a hashed directory */
+static bool dirhashed;
+
 ////////////////////////////////////////////////////////////
 // printouts
 
@@ -304,7 +307,6 @@ dumpdirblock(uint32_t fileblock, uint32_t diskblock)
 	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
 	int i;
 
-	(void)fileblock;
 	if (diskblock == 0) {
 		printf("    [block %u - empty]\n", diskblock);
 		return;
@@ -314,7 +316,19 @@ dumpdirblock(uint32_t fileblock, uint32_t diskblock)
 	printf("    [block %u]\n", diskblock);
 	for (i=0; i<nsds; i++) {
 		uint32_t ino = SWAP32(sds[i].sfd_ino);
-		if (ino==SFS_NOINO) {
+		if (dirhashed && i == 0) {
+			struct sfs_dirhdr *hdr = (struct sfs_dirhdr *)&sds[0];
+
+			if (SWAP32(hdr->sdh_magic) != SFS_DIRHASH_MAGIC) {
+				printf("        [bad bucket header: magic 0x%x]\n",
+				       SWAP32(hdr->sdh_magic));
+			}
+			else {
+				printf("        [bucket %u header: %u passing]\n",
+				       fileblock, SWAP32(hdr->sdh_passing));
+			}
+		}
+		else if (ino==SFS_NOINO) {
 			printf("        [free entry]\n");
 		}
 		else {
@@ -334,8 +348,18 @@ dumpdir(uint32_t ino, const struct sfs_dinode *sfi)
 	if (SWAP32(sfi->sfi_size) % sizeof(struct sfs_direntry) != 0) {
 		warnx("Warning: dir size is not a multiple of dir entry size");
 	}
-	printf("Directory contents for inode %u: %d entries\n", ino, nentries);
+	dirhashed = (SWAP32(sfi->sfi_flags) & SFS_IFLAG_HASHDIR) != 0;
+	if (dirhashed) {
+		printf("Directory contents for inode %u: %d entries, "
+		       "hashed, %u buckets\n", ino, nentries,
+		       SWAP32(sfi->sfi_size) / SFS_BLOCKSIZE);
+	}
+	else {
+		printf("Directory contents for inode %u: %d entries\n",
+		       ino, nentries);
+	}
 	traverse(sfi, dumpdirblock);
+	dirhashed = false;
 }
 
 static
@@ -449,6 +473,8 @@ dumpinode(uint32_t ino, const char *name)
 	dumpvalf("Type", "%u (%s)", SWAP16(sfi.sfi_type), typename);
 	dumpvalf("Size", "%u", SWAP32(sfi.sfi_size));
 	dumpvalf("Link count", "%u", SWAP16(sfi.sfi_linkcount));
+	dumpvalf("Flags", "0x%x%s", SWAP32(sfi.sfi_flags),
+		 (SWAP32(sfi.sfi_flags) & SFS_IFLAG_HASHDIR) ? " (hashed)" : "");
 	printf("\n");
 
         printf("    Direct blocks:\n");
@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
@@ -73,6 +74,20 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_dirhdr)==sizeof(struct sfs_direntry));
+}
+
+/*
+ * Check if a block is allocated.
+ */
+static
+int
+blockinuse(uint32_t block)
+{
+	uint32_t mapbyte = block/CHAR_BIT;
+	unsigned char mask = (1<<(block % CHAR_BIT));
+
+	return (freemapbuf[mapbyte] & mask) != 0;
 }
 
 /*
@@ -120,6 +135,25 @@ initfreemap(uint32_t fsblocks)
 	}
 }
 
+/*
+ * Allocate the first free block.
+ */
+static
+uint32_t
+findfreeblock(uint32_t fsblocks)
+{
+	uint32_t i;
+
+	for (i=0; i<fsblocks; i++) {
+		if (!blockinuse(i)) {
+			allocblock(i);
+			return i;
+		}
+	}
+	errx(1, "Filesystem too small");
+	return 0;
+}
+
 /*
  * Initialize and write out the superblock.
  */
@@ -165,20 +199,64 @@ writefreemap(uint32_t fsblocks)
 }
 
 /*
- * Write out the root directory inode.
+ * Write out an empty hashed directory bucket.
+ */
+static
+void
+writebucket(uint32_t block)
+{
+	struct sfs_direntry sds[SFS_DIRSLOTS];
+	struct sfs_dirhdr *hdr;
+
+	bzero((void *)sds, sizeof(sds));
+	hdr = (struct sfs_dirhdr *)&sds[0];
+	hdr->sdh_noino = SWAP32(SFS_NOINO);
+	hdr->sdh_magic = SWAP32(SFS_DIRHASH_MAGIC);
+	hdr->sdh_passing = SWAP32(0);
+
+	diskwrite(sds, block);
+}
+
+/*
+ * Write out the root directory inode. If NBUCKETS is nonzero, make it
+ * a hashed directory with that many buckets. This must be done before
+ * the freemap is written, as it allocates blocks.
  */
 static
 void
-writerootdir(void)
+writerootdir(uint32_t fsblocks, uint32_t nbuckets)
 {
 	struct sfs_dinode sfi;
+	uint32_t indirect[SFS_DBPERIDB];
+	uint32_t i, block;
 
 	/* Initialize the dinode */
 	bzero((void *)&sfi, sizeof(sfi));
-	sfi.sfi_size = SWAP32(0);
+	sfi.sfi_size = SWAP32(nbuckets * SFS_BLOCKSIZE);
 	sfi.sfi_type = SWAP16(SFS_TYPE_DIR);
 	sfi.sfi_linkcount = SWAP16(1);
 
+	if (nbuckets > 0) {
+		sfi.sfi_flags = SWAP32(SFS_IFLAG_HASHDIR);
+		bzero((void *)indirect, sizeof(indirect));
+
+		for (i=0; i<nbuckets; i++) {
+			block = findfreeblock(fsblocks);
+			writebucket(block);
+			if (i < SFS_NDIRECT) {
+				sfi.sfi_direct[i] = SWAP32(block);
+			}
+			else {
+				indirect[i - SFS_NDIRECT] = SWAP32(block);
+			}
+		}
+		if (nbuckets > SFS_NDIRECT) {
+			block = findfreeblock(fsblocks);
+			diskwrite(indirect, block);
+			sfi.sfi_indirect = SWAP32(block);
+		}
+	}
+
 	/* Write it out */
 	diskwrite(&sfi, SFS_ROOTDIR_INO);
 }
@@ -189,15 +267,28 @@ writerootdir(void)
 int
 main(int argc, char **argv)
 {
-	uint32_t size, blocksize;
+	uint32_t size, blocksize, nbuckets;
 	char *volname, *s;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	nbuckets = 0;
+	if (argc==5 && !strcmp(argv[1], "-h")) {
+		nbuckets = atoi(argv[2]);
+		if (nbuckets < 1 || nbuckets > SFS_NDIRECT + SFS_DBPERIDB) {
+			errx(1, "Hashed root directory must have between "
+			     "1 and %u buckets",
+			     (unsigned)(SFS_NDIRECT + SFS_DBPERIDB));
+		}
+		argv += 2;
+		argc -= 2;
+	}
+
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, "Usage: mksfs [-h buckets] device/diskfile "
+		     "volume-name");
 	}
 
 	check();
@@ -231,8 +322,8 @@ main(int argc, char **argv)
 	/* Write out the on-disk structures */
 	initfreemap(size);
 	writesuper(volname, size);
+	writerootdir(size, nbuckets);
 	writefreemap(size);
-	writerootdir();
 
 	closedisk();
 
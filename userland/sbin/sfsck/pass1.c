@@ -277,6 +277,15 @@ pass1_inode(uint32_t ino, struct sfs_dinode *sfi, int alreadychanged)
 		changed = 1;
 	}
 
+	if ((sfi->sfi_flags & ~SFS_IFLAG_HASHDIR) != 0 ||
+	    (!isdir && sfi->sfi_flags != 0)) {
+		warnx("Inode %lu: Invalid flags 0x%lx (fixed)",
+		      (unsigned long) ino, (unsigned long) sfi->sfi_flags);
+		setbadness(EXIT_RECOV);
+		sfi->sfi_flags &= isdir ? SFS_IFLAG_HASHDIR : 0;
+		changed = 1;
+	}
+
 	if (check_inode_blocks(ino, sfi, isdir)) {
 		changed = 1;
 	}
@@ -362,7 +371,7 @@ pass1_dir(uint32_t ino, const char *pathsofar)
 	struct sfs_dinode sfi;
 	struct sfs_direntry *direntries;
 	uint32_t ndirentries, i;
-	int ichanged=0, dchanged=0;
+	int ichanged=0, dchanged=0, hashed;
 
 	sfs_readinode(ino, &sfi);
 
@@ -374,6 +383,15 @@ pass1_dir(uint32_t ino, const char *pathsofar)
 					   sizeof(struct sfs_direntry));
 		ichanged = 1;
 	}
+	if ((sfi.sfi_flags & SFS_IFLAG_HASHDIR) &&
+	    (sfi.sfi_size == 0 || sfi.sfi_size % SFS_BLOCKSIZE != 0)) {
+		setbadness(EXIT_RECOV);
+		warnx("Directory %s: Hashed directory has illegal size %lu "
+		      "(converted to unhashed)",
+		      pathsofar, (unsigned long) sfi.sfi_size);
+		sfi.sfi_flags &= ~SFS_IFLAG_HASHDIR;
+		ichanged = 1;
+	}
 	count_dirs++;
 
 	if (pass1_inode(ino, &sfi, ichanged)) {
@@ -381,19 +399,47 @@ pass1_dir(uint32_t ino, const char *pathsofar)
 		return;
 	}
 
+	hashed = (sfi.sfi_flags & SFS_IFLAG_HASHDIR) != 0;
 	ndirentries = sfi.sfi_size/sizeof(struct sfs_direntry);
 	direntries = domalloc(sfi.sfi_size);
 
 	sfs_readdir(&sfi, direntries, ndirentries);
 
+	if (hashed) {
+		for (i=0; i<ndirentries; i += SFS_DIRSLOTS) {
+			if (direntries[i].sfd_ino != SFS_NOINO) {
+				setbadness(EXIT_RECOV);
+				warnx("Directory %s entry %lu is in a hash "
+				      "bucket header (removed)",
+				      pathsofar, (unsigned long) i);
+				direntries[i].sfd_ino = SFS_NOINO;
+				dchanged = 1;
+			}
+		}
+	}
+
 	for (i=0; i<ndirentries; i++) {
+		if (hashed && i % SFS_DIRSLOTS == 0) {
+			continue;
+		}
 		if (pass1_direntry(pathsofar, i, &direntries[i])) {
 			dchanged = 1;
 		}
 	}
 
+	/* Do this after the name checks, which may rename entries. */
+	if (hashed && sfsdir_rehash(direntries, ndirentries)) {
+		setbadness(EXIT_RECOV);
+		warnx("Directory %s: Hash bucket headers incorrect (fixed)",
+		      pathsofar);
+		dchanged = 1;
+	}
+
 	for (i=0; i<ndirentries; i++) {
-		if (direntries[i].sfd_ino == SFS_NOINO) {
+		if (hashed && i % SFS_DIRSLOTS == 0) {
+			/* nothing */
+		}
+		else if (direntries[i].sfd_ino == SFS_NOINO) {
 			/* nothing */
 		}
 		else if (!strcmp(direntries[i].sfd_name, ".")) {
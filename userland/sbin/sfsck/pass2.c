@@ -66,7 +66,7 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	struct sfs_direntry *direntries;
 	int *sortvector;
 	uint32_t dirsize, ndirentries, maxdirentries, subdircount, i;
-	int ichanged=0, dchanged=0, dotseen=0, dotdotseen=0;
+	int ichanged=0, dchanged=0, dotseen=0, dotdotseen=0, hashed;
 
 	if (inode_visitdir(ino)) {
 		/* crosslinked dir; tell parent to remove the entry */
@@ -75,6 +75,7 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 
 	/* Load the inode. */
 	sfs_readinode(ino, &sfi);
+	hashed = (sfi.sfi_flags & SFS_IFLAG_HASHDIR) != 0;
 
 	/*
 	 * Load the directory. If there is any leftover room in the
@@ -173,14 +174,15 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	 */
 
 	if (!dotseen) {
-		if (sfsdir_tryadd(direntries, ndirentries, ".", ino)==0) {
+		if (sfsdir_tryadd(direntries, ndirentries, hashed,
+				  ".", ino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory %s: No `.' entry (added)",
 			      pathsofar);
 			dchanged = 1;
 		}
-		else if (sfsdir_tryadd(direntries, maxdirentries, ".",
-				       ino)==0) {
+		else if (sfsdir_tryadd(direntries, maxdirentries, hashed,
+				       ".", ino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory %s: No `.' entry (added)",
 			      pathsofar);
@@ -201,15 +203,15 @@ pass2_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 	 */
 
 	if (!dotdotseen) {
-		if (sfsdir_tryadd(direntries, ndirentries, "..",
-				  parentino)==0) {
+		if (sfsdir_tryadd(direntries, ndirentries, hashed,
+				  "..", parentino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory %s: No `..' entry (added)",
 			      pathsofar);
 			dchanged = 1;
 		}
-		else if (sfsdir_tryadd(direntries, maxdirentries, "..",
-				    parentino)==0) {
+		else if (sfsdir_tryadd(direntries, maxdirentries, hashed,
+				       "..", parentino)==0) {
 			setbadness(EXIT_RECOV);
 			warnx("Directory %s: No `..' entry (added)",
 			      pathsofar);
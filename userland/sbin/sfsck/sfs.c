@@ -51,6 +51,7 @@ sfs_setup(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_dirhdr)==sizeof(struct sfs_direntry));
 }
 
 ////////////////////////////////////////////////////////////
@@ -81,6 +82,7 @@ swapinode(struct sfs_dinode *sfi)
 	sfi->sfi_size = SWAP32(sfi->sfi_size);
 	sfi->sfi_type = SWAP16(sfi->sfi_type);
 	sfi->sfi_linkcount = SWAP16(sfi->sfi_linkcount);
+	sfi->sfi_flags = SWAP32(sfi->sfi_flags);
 
 	for (i=0; i<NUM_D; i++) {
 		SET_D(sfi, i) = SWAP32(GET_D(sfi, i));
@@ -369,6 +371,11 @@ sfs_writedir(const struct sfs_dinode *sfi, struct sfs_direntry *d, unsigned nd)
 	struct sfs_direntry buffer[atonce];
 	uint32_t diskblock;
 
+	/* Make sure the hash index matches the entries. */
+	if (sfi->sfi_flags & SFS_IFLAG_HASHDIR) {
+		sfsdir_rehash(d, nd);
+	}
+
 	left = nd;
 	for (i=0; i<nblocks; i++) {
 		diskblock = bmap(sfi, i);
@@ -444,15 +451,21 @@ sfsdir_sort(struct sfs_direntry *d, unsigned nd, int *vector)
 
 /*
  * Try to add an entry NAME/INO to D (which has ND entries) by
- * finding an empty slot. Cannot allocate new space.
+ * finding an empty slot. Cannot allocate new space. If HASHED is
+ * set, D is a hashed directory and bucket headers are skipped; the
+ * new entry becomes reachable when the directory is written out.
  *
  * Returns 0 on success and nonzero on failure.
  */
 int
-sfsdir_tryadd(struct sfs_direntry *d, int nd, const char *name, uint32_t ino)
+sfsdir_tryadd(struct sfs_direntry *d, int nd, int hashed,
+	      const char *name, uint32_t ino)
 {
 	int i;
 	for (i=0; i<nd; i++) {
+		if (hashed && i % SFS_DIRSLOTS == 0) {
+			continue;
+		}
 		if (d[i].sfd_ino==SFS_NOINO) {
 			d[i].sfd_ino = ino;
 			assert(strlen(name) < sizeof(d[i].sfd_name));
@@ -462,3 +475,76 @@ sfsdir_tryadd(struct sfs_direntry *d, int nd, const char *name, uint32_t ino)
 	}
 	return -1;
 }
+
+/*
+ * The hashed directory hash function, as defined in <kern/sfs.h>.
+ */
+static
+uint32_t
+sfsdir_hash(const char *name)
+{
+	uint32_t hash = SFS_DIRHASH_BASIS;
+
+	while (*name) {
+		hash ^= (unsigned char)*name;
+		hash *= SFS_DIRHASH_PRIME;
+		name++;
+	}
+	return hash;
+}
+
+/*
+ * Recompute the bucket headers of the hashed directory D (which has
+ * ND entries, a whole number of buckets) from the entries in it.
+ * Entries are not moved; every entry is reachable from its home
+ * bucket once the passing counts are right.
+ *
+ * Returns nonzero if any header changed.
+ */
+int
+sfsdir_rehash(struct sfs_direntry *d, unsigned nd)
+{
+	unsigned nbuckets = nd / SFS_DIRSLOTS;
+	uint32_t *passing;
+	struct sfs_dirhdr hdr;
+	unsigned i, b, target;
+	int changed = 0;
+
+	assert(nd % SFS_DIRSLOTS == 0);
+	if (nbuckets == 0) {
+		return 0;
+	}
+
+	passing = domalloc(nbuckets * sizeof(uint32_t));
+	bzero(passing, nbuckets * sizeof(uint32_t));
+
+	for (i=0; i<nd; i++) {
+		if (i % SFS_DIRSLOTS == 0 || d[i].sfd_ino == SFS_NOINO) {
+			continue;
+		}
+		target = i / SFS_DIRSLOTS;
+		for (b = sfsdir_hash(d[i].sfd_name) % nbuckets;
+		     b != target;
+		     b = (b + 1) % nbuckets) {
+			passing[b]++;
+		}
+	}
+
+	for (b=0; b<nbuckets; b++) {
+		/*
+		 * Directory entries are kept with sfd_ino byte-swapped
+		 * and the rest in disk order; do the same here.
+		 */
+		bzero(&hdr, sizeof(hdr));
+		hdr.sdh_noino = SFS_NOINO;
+		hdr.sdh_magic = SWAP32(SFS_DIRHASH_MAGIC);
+		hdr.sdh_passing = SWAP32(passing[b]);
+		if (memcmp(&d[b * SFS_DIRSLOTS], &hdr, sizeof(hdr)) != 0) {
+			memcpy(&d[b * SFS_DIRSLOTS], &hdr, sizeof(hdr));
+			changed = 1;
+		}
+	}
+
+	free(passing);
+	return changed;
+}
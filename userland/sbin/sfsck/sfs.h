@@ -71,9 +71,12 @@ void sfs_writedir(const struct sfs_dinode *sfi,
 		  struct sfs_direntry *d, unsigned nd);
 
 /* Try to add an entry to a directory. */
-int sfsdir_tryadd(struct sfs_direntry *d, int nd,
+int sfsdir_tryadd(struct sfs_direntry *d, int nd, int hashed,
 		  const char *name, uint32_t ino);
 
+/* Recompute the bucket headers of a hashed directory. */
+int sfsdir_rehash(struct sfs_direntry *d, unsigned nd);
+
 /* Sort a directory by creating a permutation vector. */
 void sfsdir_sort(struct sfs_direntry *d, unsigned nd, int *vector);
 